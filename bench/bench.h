@@ -0,0 +1,86 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef HS_BENCH_H
+#define HS_BENCH_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct bench_result {
+    const char *name;
+
+    uint64_t ops;
+    uint64_t bytes;
+    // Wall clock and CPU time in nanoseconds, cpu is optional
+    uint64_t elapsed;
+    uint64_t cpu;
+
+    // Optional per-operation latencies in nanoseconds, sorted by bench_report()
+    uint64_t *samples;
+    size_t samples_count;
+
+    // Optional churn accounting, reported when rss_end is set (see bench_rss())
+    uint64_t allocations;
+    uint64_t rss_start;
+    uint64_t rss_end;
+} bench_result;
+
+typedef struct bench_timer {
+    uint64_t start;
+    uint64_t cpu_start;
+    uint64_t ops;
+} bench_timer;
+
+typedef void bench_func(void);
+
+typedef struct bench_suite {
+    const char *name;
+    bench_func *f;
+} bench_suite;
+
+extern const bench_suite bench_core_suites[];
+extern const bench_suite bench_io_suites[];
+extern const bench_suite bench_alloc_suites[];
+
+uint64_t bench_cpu_time(void);
+// Resident set size in kB, or 0 if unknown
+uint64_t bench_rss(void);
+// Heap allocations made by the whole process so far, always 0 without glibc
+uint64_t bench_allocations(void);
+
+// Run the timed loop until the time budget (--time) is exhausted
+void bench_start(bench_timer *timer);
+bool bench_running(bench_timer *timer);
+void bench_stop(bench_timer *timer, bench_result *result);
+
+// Latency sample buffer, big enough for one benchmark run
+uint64_t *bench_alloc_samples(size_t *rcount);
+
+void bench_report(bench_result *result);
+void bench_fail(const char *name, const char *reason);
+
+#endif
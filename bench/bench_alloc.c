@@ -0,0 +1,476 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hs.h"
+#include "uevent_trace_priv.h"
+#include "bench.h"
+
+#define STEADY_DEVICES 64
+#define STEADY_CYCLES 16
+#define CHURN_DEVICES 8
+#define CHURN_CYCLES 4096
+
+#ifdef __GLIBC__
+
+/* glibc lets programs interpose the allocator, every malloc() in the process (including the
+   ones made by libc itself and libudev) ends up here. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static uint64_t allocations;
+
+void *malloc(size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+uint64_t bench_allocations(void)
+{
+    return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+static void check_allocations(const char *name, uint64_t count, bench_result *result)
+{
+    if (count) {
+        char reason[128];
+
+        snprintf(reason, sizeof(reason), "%" PRIu64 " allocations in %" PRIu64 " operations",
+                 count, result->ops);
+        bench_fail(name, reason);
+        return;
+    }
+
+    bench_report(result);
+}
+
+/* Each operation is a full exchange with the peer end, done inline: a peer thread would
+   allocate behind our back. */
+static int exchange_hid(hs_handle *h, int peer_fd)
+{
+    uint8_t buf[65] = {0};
+    ssize_t r;
+
+    r = hs_hid_write(h, buf, sizeof(buf));
+    if (r < 0)
+        return (int)r;
+    if (read(peer_fd, buf, sizeof(buf)) != sizeof(buf))
+        return -1;
+
+    // Nothing to read yet, this goes through the EAGAIN path
+    r = hs_hid_read(h, buf, sizeof(buf), 0);
+    if (r)
+        return -1;
+
+    if (write(peer_fd, buf, 64) != 64)
+        return -1;
+    r = hs_hid_read(h, buf, sizeof(buf), 1000);
+    if (r <= 0)
+        return -1;
+
+    return 0;
+}
+
+static int exchange_serial(hs_handle *h, int peer_fd)
+{
+    uint8_t buf[64] = {0};
+    struct pollfd pfd = {peer_fd, POLLIN};
+    size_t done;
+    ssize_t r;
+
+    r = hs_serial_write(h, buf, sizeof(buf));
+    if (r != sizeof(buf))
+        return -1;
+    for (done = 0; done < sizeof(buf); done += (size_t)r) {
+        if (poll(&pfd, 1, 1000) <= 0)
+            return -1;
+        r = read(peer_fd, buf, sizeof(buf) - done);
+        if (r <= 0)
+            return -1;
+    }
+
+    r = hs_serial_read(h, buf, sizeof(buf), 0);
+    if (r)
+        return -1;
+
+    if (write(peer_fd, buf, sizeof(buf)) != sizeof(buf))
+        return -1;
+    for (done = 0; done < sizeof(buf); done += (size_t)r) {
+        r = hs_serial_read(h, buf, sizeof(buf) - done, 1000);
+        if (r <= 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void bench_steady_io(const char *name, hs_device_type type,
+                            int (*exchange)(hs_handle *h, int peer_fd))
+{
+    hs_virtual_device_info info = {0};
+    hs_virtual_device *vdev;
+    hs_handle *h = NULL;
+    bench_result result = {name};
+    bench_timer timer;
+    uint64_t start;
+    int peer_fd, r;
+
+    info.type = type;
+    info.vid = 0x16C0;
+    info.pid = 0x0478;
+
+    r = hs_virtual_device_new(&info, &vdev);
+    if (r < 0) {
+        bench_fail(name, "cannot create virtual device");
+        return;
+    }
+    r = hs_device_open(hs_virtual_device_get_device(vdev), &h);
+    if (r >= 0 && type == HS_DEVICE_TYPE_SERIAL)
+        r = hs_serial_set_attributes(h, 115200, 0);
+    if (r < 0) {
+        bench_fail(name, "cannot open virtual device");
+        goto cleanup;
+    }
+    peer_fd = hs_virtual_device_get_peer(vdev);
+
+    // Warm up: lazy buffers are allocated by the first calls
+    r = (*exchange)(h, peer_fd);
+    if (r < 0) {
+        bench_fail(name, "exchange failed");
+        goto cleanup;
+    }
+
+    start = bench_allocations();
+    bench_start(&timer);
+    while (bench_running(&timer)) {
+        r = (*exchange)(h, peer_fd);
+        if (r < 0)
+            break;
+    }
+    bench_stop(&timer, &result);
+
+    if (r < 0) {
+        bench_fail(name, "exchange failed");
+    } else {
+        check_allocations(name, bench_allocations() - start, &result);
+    }
+
+cleanup:
+    hs_handle_close(h);
+    hs_virtual_device_free(vdev);
+}
+
+static void make_uevent(_hs_uevent *event, _hs_uevent_action action, unsigned int idx,
+                        char (*strings)[128])
+{
+    memset(event->attributes, 0, sizeof(event->attributes));
+    event->action = action;
+
+    snprintf(strings[0], 128, "/devices/pci0000:00/0000:00:14.0/usb1/1-%u/1-%u:1.0"
+             "/0003:16C0:0486.%04X/hidraw/hidraw%u", idx + 1, idx + 1, idx, idx);
+    snprintf(strings[1], 128, "/dev/hidraw%u", idx);
+    snprintf(strings[2], 128, "%u", idx + 1);
+    snprintf(strings[3], 128, "/devices/pci0000:00/0000:00:14.0/usb1/1-%u/1-%u:1.0",
+             idx + 1, idx + 1);
+
+    event->attributes[_HS_UEVENT_SUBSYSTEM] = "hidraw";
+    event->attributes[_HS_UEVENT_DEVPATH] = strings[0];
+    if (action == _HS_UEVENT_OTHER || action == _HS_UEVENT_REMOVE)
+        return;
+
+    event->attributes[_HS_UEVENT_DEVNODE] = strings[1];
+    event->attributes[_HS_UEVENT_USB_BUSNUM] = "1";
+    event->attributes[_HS_UEVENT_USB_DEVPATH] = strings[2];
+    event->attributes[_HS_UEVENT_USB_VID] = "16c0";
+    event->attributes[_HS_UEVENT_USB_PID] = "0486";
+    event->attributes[_HS_UEVENT_IFACE_DEVPATH] = strings[3];
+}
+
+// Known devices flapping: add and change events for devices the monitor already has
+static int write_steady_trace(const char *filename)
+{
+    _hs_uevent_writer *writer;
+    _hs_uevent event;
+    char strings[4][128];
+    int r;
+
+    r = _hs_uevent_writer_open(filename, &writer);
+    if (r < 0)
+        return r;
+
+    for (unsigned int i = 0; i < STEADY_DEVICES; i++) {
+        make_uevent(&event, _HS_UEVENT_SNAPSHOT, i, strings);
+        _hs_uevent_writer_append(writer, &event);
+    }
+    for (unsigned int i = 0; i < STEADY_CYCLES; i++) {
+        for (unsigned int j = 0; j < STEADY_DEVICES; j++) {
+            make_uevent(&event, _HS_UEVENT_ADD, j, strings);
+            _hs_uevent_writer_append(writer, &event);
+            make_uevent(&event, _HS_UEVENT_OTHER, j, strings);
+            _hs_uevent_writer_append(writer, &event);
+        }
+    }
+
+    return _hs_uevent_writer_close(writer);
+}
+
+static void bench_steady_monitor(void)
+{
+    char filename[] = "/tmp/hs_bench_XXXXXX";
+    bench_result result = {"steady_monitor_refresh"};
+    bench_timer timer;
+    uint64_t allocs = 0;
+    int fd, r = 0;
+
+    fd = mkstemp(filename);
+    if (fd < 0) {
+        bench_fail(result.name, "cannot create trace file");
+        return;
+    }
+    close(fd);
+
+    if (write_steady_trace(filename) < 0) {
+        bench_fail(result.name, "cannot write trace");
+        goto cleanup;
+    }
+
+    // Replays are one-shot, only the refresh of each monitor is counted
+    bench_start(&timer);
+    while (bench_running(&timer)) {
+        hs_monitor *monitor;
+        struct pollfd pfd;
+        uint64_t start;
+
+        r = hs_monitor_new_from_trace(filename, 0.0, &monitor);
+        if (r < 0)
+            break;
+
+        pfd.fd = hs_monitor_get_descriptor(monitor);
+        pfd.events = POLLIN;
+        poll(&pfd, 1, 1000);
+
+        start = bench_allocations();
+        r = hs_monitor_refresh(monitor);
+        allocs += bench_allocations() - start;
+
+        hs_monitor_free(monitor);
+        if (r < 0)
+            break;
+    }
+    bench_stop(&timer, &result);
+    result.ops *= STEADY_CYCLES * STEADY_DEVICES * 2;
+
+    if (r < 0) {
+        bench_fail(result.name, "hs_monitor_refresh() failed");
+    } else {
+        check_allocations(result.name, allocs, &result);
+    }
+
+cleanup:
+    unlink(filename);
+}
+
+// Flashing stations: the same few boards connect and disconnect over and over
+static int write_churn_trace(const char *filename)
+{
+    _hs_uevent_writer *writer;
+    _hs_uevent event;
+    char strings[4][128];
+    int r;
+
+    r = _hs_uevent_writer_open(filename, &writer);
+    if (r < 0)
+        return r;
+
+    for (unsigned int i = 0; i < CHURN_CYCLES; i++) {
+        for (unsigned int j = 0; j < CHURN_DEVICES; j++) {
+            make_uevent(&event, _HS_UEVENT_ADD, j, strings);
+            _hs_uevent_writer_append(writer, &event);
+        }
+        for (unsigned int j = 0; j < CHURN_DEVICES; j++) {
+            make_uevent(&event, _HS_UEVENT_REMOVE, j, strings);
+            _hs_uevent_writer_append(writer, &event);
+        }
+    }
+
+    return _hs_uevent_writer_close(writer);
+}
+
+static void bench_churn_devices(void)
+{
+    char filename[] = "/tmp/hs_bench_XXXXXX";
+    bench_result result = {"churn_devices"};
+    bench_timer timer;
+    int fd, r = 0;
+
+    fd = mkstemp(filename);
+    if (fd < 0) {
+        bench_fail(result.name, "cannot create trace file");
+        return;
+    }
+    close(fd);
+
+    if (write_churn_trace(filename) < 0) {
+        bench_fail(result.name, "cannot write trace");
+        goto cleanup;
+    }
+
+    // Each iteration replays CHURN_CYCLES plug/unplug cycles, only the refresh is counted
+    result.rss_start = bench_rss();
+    bench_start(&timer);
+    while (bench_running(&timer)) {
+        hs_monitor *monitor;
+        struct pollfd pfd;
+        uint64_t start;
+
+        r = hs_monitor_new_from_trace(filename, 0.0, &monitor);
+        if (r < 0)
+            break;
+
+        pfd.fd = hs_monitor_get_descriptor(monitor);
+        pfd.events = POLLIN;
+        poll(&pfd, 1, 1000);
+
+        start = bench_allocations();
+        r = hs_monitor_refresh(monitor);
+        result.allocations += bench_allocations() - start;
+
+        hs_monitor_free(monitor);
+        if (r < 0)
+            break;
+    }
+    bench_stop(&timer, &result);
+    result.ops *= CHURN_CYCLES * CHURN_DEVICES;
+    result.rss_end = bench_rss();
+
+    if (r < 0) {
+        bench_fail(result.name, "hs_monitor_refresh() failed");
+    } else {
+        bench_report(&result);
+    }
+
+cleanup:
+    unlink(filename);
+}
+
+static void bench_churn_handles(const char *name, hs_device_type type)
+{
+    hs_virtual_device_info info = {0};
+    hs_virtual_device *vdev;
+    bench_result result = {name};
+    bench_timer timer;
+    uint64_t start;
+    int r;
+
+    info.type = type;
+    info.vid = 0x16C0;
+    info.pid = 0x0478;
+
+    r = hs_virtual_device_new(&info, &vdev);
+    if (r < 0) {
+        bench_fail(name, "cannot create virtual device");
+        return;
+    }
+
+    result.rss_start = bench_rss();
+    start = bench_allocations();
+    bench_start(&timer);
+    while (bench_running(&timer)) {
+        hs_handle *h;
+
+        r = hs_device_open(hs_virtual_device_get_device(vdev), &h);
+        if (r < 0)
+            break;
+        hs_handle_close(h);
+    }
+    bench_stop(&timer, &result);
+    result.allocations = bench_allocations() - start;
+    result.rss_end = bench_rss();
+
+    if (r < 0) {
+        bench_fail(name, "hs_device_open() failed");
+    } else {
+        bench_report(&result);
+    }
+
+    hs_virtual_device_free(vdev);
+}
+
+static void bench_churn(void)
+{
+    bench_churn_devices();
+    bench_churn_handles("churn_hid_handles", HS_DEVICE_TYPE_HID);
+    bench_churn_handles("churn_serial_handles", HS_DEVICE_TYPE_SERIAL);
+}
+
+static void bench_steady_state(void)
+{
+    bench_steady_io("steady_hid", HS_DEVICE_TYPE_HID, exchange_hid);
+    bench_steady_io("steady_serial", HS_DEVICE_TYPE_SERIAL, exchange_serial);
+    bench_steady_monitor();
+}
+
+const bench_suite bench_alloc_suites[] = {
+    {"steady_state", bench_steady_state},
+    {"churn",        bench_churn},
+    {0}
+};
+
+#else
+
+uint64_t bench_allocations(void)
+{
+    return 0;
+}
+
+// Counting allocations needs malloc interposition, which only glibc supports the easy way
+const bench_suite bench_alloc_suites[] = {
+    {0}
+};
+
+#endif
@@ -0,0 +1,510 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include "hs.h"
+#include "htable.h"
+#include "uevent_trace_priv.h"
+#include "bench.h"
+
+#define TABLE_ENTRIES 256
+#define CHURN_DEVICES 64
+#define STORM_DEVICES 256
+#define STORM_CYCLES 4
+
+struct table_entry {
+    _hs_htable_head hnode;
+    char key[128];
+};
+
+static struct table_entry *create_entries(void)
+{
+    struct table_entry *entries;
+
+    entries = calloc(TABLE_ENTRIES, sizeof(*entries));
+    if (!entries)
+        return NULL;
+
+    // Look like the udev device paths used as keys by the monitor
+    for (unsigned int i = 0; i < TABLE_ENTRIES; i++)
+        snprintf(entries[i].key, sizeof(entries[i].key),
+                 "/devices/pci0000:00/0000:00:14.0/usb1/1-%u/1-%u:1.%u/tty/ttyACM%u",
+                 i / 4 + 1, i / 4 + 1, i % 4, i);
+
+    return entries;
+}
+
+static struct table_entry *find_entry(_hs_htable *table, const char *key)
+{
+    hs_htable_foreach_hash(cur, table, _hs_htable_hash_str(key)) {
+        struct table_entry *entry = _hs_container_of(cur, struct table_entry, hnode);
+
+        if (strcmp(entry->key, key) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void bench_htable(void)
+{
+    struct table_entry *entries;
+    _hs_htable table;
+    bench_timer timer;
+    unsigned int i;
+
+    entries = create_entries();
+    if (!entries || _hs_htable_init(&table, 64) < 0) {
+        bench_fail("htable", "allocation failed");
+        free(entries);
+        return;
+    }
+
+    {
+        bench_result result = {"htable_add_remove"};
+
+        i = 0;
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            struct table_entry *entry = &entries[i++ % TABLE_ENTRIES];
+
+            _hs_htable_add(&table, _hs_htable_hash_str(entry->key), &entry->hnode);
+            _hs_htable_remove(&entry->hnode);
+        }
+        bench_stop(&timer, &result);
+        bench_report(&result);
+    }
+
+    for (i = 0; i < TABLE_ENTRIES; i++)
+        _hs_htable_add(&table, _hs_htable_hash_str(entries[i].key), &entries[i].hnode);
+
+    {
+        bench_result result = {"htable_lookup_hit"};
+        unsigned int found = 0;
+
+        i = 0;
+        bench_start(&timer);
+        while (bench_running(&timer))
+            found += !!find_entry(&table, entries[i++ % TABLE_ENTRIES].key);
+        bench_stop(&timer, &result);
+        if (found != result.ops) {
+            bench_fail(result.name, "lookup failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    {
+        bench_result result = {"htable_lookup_miss"};
+        char key[160];
+
+        snprintf(key, sizeof(key), "%s-missing", entries[0].key);
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            if (find_entry(&table, key))
+                break;
+        }
+        bench_stop(&timer, &result);
+        bench_report(&result);
+    }
+
+    {
+        bench_result result = {"htable_iterate_256"};
+        unsigned int count = 0;
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            hs_htable_foreach(cur, &table)
+                count++;
+        }
+        bench_stop(&timer, &result);
+        if (count != result.ops * TABLE_ENTRIES) {
+            bench_fail(result.name, "iteration failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    _hs_htable_release(&table);
+    free(entries);
+}
+
+static void bench_hid_open_descriptor(const char *name, const uint8_t *desc, size_t desc_size)
+{
+    hs_virtual_device_info info = {0};
+    hs_virtual_device *vdev;
+    bench_result result = {name};
+    bench_timer timer;
+    int r;
+
+    info.type = HS_DEVICE_TYPE_HID;
+    info.report_descriptor = desc;
+    info.report_descriptor_size = desc_size;
+
+    r = hs_virtual_device_new(&info, &vdev);
+    if (r < 0) {
+        bench_fail(name, "cannot create virtual device");
+        return;
+    }
+
+    bench_start(&timer);
+    while (bench_running(&timer)) {
+        hs_handle *h;
+
+        r = hs_device_open(hs_virtual_device_get_device(vdev), &h);
+        if (r < 0)
+            break;
+        hs_handle_close(h);
+    }
+    bench_stop(&timer, &result);
+
+    if (r < 0) {
+        bench_fail(name, "open failed");
+    } else {
+        bench_report(&result);
+    }
+
+    hs_virtual_device_free(vdev);
+}
+
+static void bench_hid_open(void)
+{
+    static const uint8_t small_desc[] = {
+        0x06, 0xAB, 0xFF, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x01, 0x75, 0x08, 0x95, 0x40, 0x09, 0x01,
+        0x81, 0x02, 0x09, 0x01, 0x91, 0x02, 0xC0
+    };
+    uint8_t large_desc[4096];
+    size_t len = 0;
+
+    /* Lots of nested collections and short items, the parser has to walk every byte. This
+       exercises parse_descriptor() while the small descriptor mostly measures the open. */
+    while (len + 24 <= sizeof(large_desc) - 1) {
+        static const uint8_t chunk[] = {
+            0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x75, 0x08,
+            0x95, 0x08, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x81, 0x02, 0xC0, 0xC0, 0x00
+        };
+
+        memcpy(large_desc + len, chunk, sizeof(chunk) - 1);
+        len += sizeof(chunk) - 1;
+    }
+
+    bench_hid_open_descriptor("hid_open_small_descriptor", small_desc, sizeof(small_desc));
+    bench_hid_open_descriptor("hid_open_large_descriptor", large_desc, len);
+}
+
+static int count_device(hs_device *dev, void *udata)
+{
+    (void)dev;
+
+    (*(unsigned int *)udata)++;
+    return 0;
+}
+
+static void bench_enumerate(void)
+{
+    bench_result result = {"enumerate_host"};
+    bench_timer timer;
+    unsigned int count = 0;
+    int r = 0;
+
+    // This depends on the devices of the machine, see trace_enumerate_256 for a stable workload
+    bench_start(&timer);
+    while (bench_running(&timer)) {
+        r = hs_enumerate(count_device, &count);
+        if (r < 0)
+            break;
+    }
+    bench_stop(&timer, &result);
+
+    if (r < 0) {
+        bench_fail(result.name, "hs_enumerate() failed");
+    } else {
+        bench_report(&result);
+    }
+}
+
+static void bench_monitor(void)
+{
+    hs_monitor *monitor = NULL;
+    hs_virtual_device *vdevs[CHURN_DEVICES] = {0};
+    unsigned int events = 0;
+    bench_timer timer;
+    int r;
+
+    r = hs_monitor_new(&monitor);
+    if (r < 0) {
+        bench_fail("monitor", "cannot create monitor");
+        return;
+    }
+    hs_monitor_register_callback(monitor, count_device, &events);
+
+    for (unsigned int i = 0; i < CHURN_DEVICES; i++) {
+        hs_virtual_device_info info = {0};
+
+        info.type = HS_DEVICE_TYPE_HID;
+        info.vid = 0x16C0;
+        info.pid = (uint16_t)(0x0400 + i);
+
+        r = hs_virtual_device_new(&info, &vdevs[i]);
+        if (r < 0) {
+            bench_fail("monitor", "cannot create virtual device");
+            goto cleanup;
+        }
+    }
+
+    {
+        bench_result result = {"monitor_plug_unplug"};
+        unsigned int i = 0;
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            hs_virtual_device_plug(vdevs[i % CHURN_DEVICES], monitor);
+            hs_virtual_device_unplug(vdevs[i % CHURN_DEVICES]);
+            i++;
+        }
+        bench_stop(&timer, &result);
+        bench_report(&result);
+    }
+
+    {
+        bench_result result = {"monitor_refresh_idle"};
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            r = hs_monitor_refresh(monitor);
+            if (r < 0)
+                break;
+        }
+        bench_stop(&timer, &result);
+        bench_report(&result);
+    }
+
+    for (unsigned int i = 0; i < CHURN_DEVICES; i++)
+        hs_virtual_device_plug(vdevs[i], monitor);
+
+    {
+        bench_result result = {"monitor_list_64"};
+        unsigned int count = 0;
+
+        bench_start(&timer);
+        while (bench_running(&timer))
+            hs_monitor_list(monitor, count_device, &count);
+        bench_stop(&timer, &result);
+        bench_report(&result);
+    }
+
+cleanup:
+    for (unsigned int i = 0; i < CHURN_DEVICES; i++)
+        hs_virtual_device_free(vdevs[i]);
+    hs_monitor_free(monitor);
+}
+
+static void make_uevent(_hs_uevent *event, _hs_uevent_action action, unsigned int idx,
+                        char (*strings)[128])
+{
+    unsigned int hub = idx / 8 + 1, port = idx % 8 + 1;
+
+    memset(event->attributes, 0, sizeof(event->attributes));
+    event->action = action;
+
+    // A few hubs full of Teensy boards, as seen after a hub power cycle
+    snprintf(strings[0], 128, "/devices/pci0000:00/0000:00:14.0/usb1/1-%u/1-%u.%u/1-%u.%u:1.0"
+             "/0003:16C0:0486.%04X/hidraw/hidraw%u", hub, hub, port, hub, port, idx, idx);
+    snprintf(strings[1], 128, "/dev/hidraw%u", idx);
+    snprintf(strings[2], 128, "%u.%u", hub, port);
+    snprintf(strings[3], 128, "/devices/pci0000:00/0000:00:14.0/usb1/1-%u/1-%u.%u/1-%u.%u:1.0",
+             hub, hub, port, hub, port);
+    snprintf(strings[4], 128, "%u", 1000000 + idx);
+
+    event->attributes[_HS_UEVENT_SUBSYSTEM] = "hidraw";
+    event->attributes[_HS_UEVENT_DEVPATH] = strings[0];
+    if (action == _HS_UEVENT_REMOVE)
+        return;
+
+    event->attributes[_HS_UEVENT_DEVNODE] = strings[1];
+    event->attributes[_HS_UEVENT_USB_BUSNUM] = "1";
+    event->attributes[_HS_UEVENT_USB_DEVPATH] = strings[2];
+    event->attributes[_HS_UEVENT_USB_VID] = "16c0";
+    event->attributes[_HS_UEVENT_USB_PID] = "0486";
+    event->attributes[_HS_UEVENT_USB_MANUFACTURER] = "Teensyduino";
+    event->attributes[_HS_UEVENT_USB_PRODUCT] = "Teensyduino RawHID";
+    event->attributes[_HS_UEVENT_USB_SERIAL] = strings[4];
+    event->attributes[_HS_UEVENT_IFACE_DEVPATH] = strings[3];
+}
+
+// Synthetic traces stand in for a fixture sysfs tree, libudev always reads the real one
+static int write_trace(const char *filename, unsigned int snapshot, unsigned int cycles)
+{
+    _hs_uevent_writer *writer;
+    _hs_uevent event;
+    char strings[5][128];
+    int r;
+
+    r = _hs_uevent_writer_open(filename, &writer);
+    if (r < 0)
+        return r;
+
+    for (unsigned int i = 0; i < snapshot; i++) {
+        make_uevent(&event, _HS_UEVENT_SNAPSHOT, i, strings);
+        _hs_uevent_writer_append(writer, &event);
+    }
+    for (unsigned int i = 0; i < cycles; i++) {
+        for (unsigned int j = 0; j < STORM_DEVICES; j++) {
+            make_uevent(&event, _HS_UEVENT_ADD, j, strings);
+            _hs_uevent_writer_append(writer, &event);
+        }
+        for (unsigned int j = 0; j < STORM_DEVICES; j++) {
+            make_uevent(&event, _HS_UEVENT_REMOVE, j, strings);
+            _hs_uevent_writer_append(writer, &event);
+        }
+    }
+
+    return _hs_uevent_writer_close(writer);
+}
+
+struct storm_context {
+    uint64_t refresh_start;
+    bench_result *result;
+    size_t samples_size;
+};
+
+static int record_callback_latency(hs_device *dev, void *udata)
+{
+    struct storm_context *ctx = udata;
+
+    (void)dev;
+
+    if (ctx->result->samples_count < ctx->samples_size)
+        ctx->result->samples[ctx->result->samples_count++] = hs_nanos() - ctx->refresh_start;
+    return 0;
+}
+
+static void bench_uevent(void)
+{
+    char filename[] = "/tmp/hs_bench_XXXXXX";
+    bench_timer timer;
+    int fd, r = 0;
+
+    fd = mkstemp(filename);
+    if (fd < 0) {
+        bench_fail("uevent", "cannot create trace file");
+        return;
+    }
+    close(fd);
+
+    if (write_trace(filename, STORM_DEVICES, 0) < 0) {
+        bench_fail("uevent", "cannot write trace");
+        goto cleanup;
+    }
+
+    {
+        bench_result result = {"trace_enumerate_256"};
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            hs_monitor *monitor;
+
+            r = hs_monitor_new_from_trace(filename, 0.0, &monitor);
+            if (r < 0)
+                break;
+            hs_monitor_free(monitor);
+        }
+        bench_stop(&timer, &result);
+
+        if (r < 0) {
+            bench_fail(result.name, "hs_monitor_new_from_trace() failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    if (write_trace(filename, 0, STORM_CYCLES) < 0) {
+        bench_fail("uevent", "cannot write trace");
+        goto cleanup;
+    }
+
+    {
+        bench_result result = {"uevent_storm"};
+        struct storm_context ctx = {0};
+        uint64_t events = 0;
+
+        ctx.result = &result;
+        result.samples = bench_alloc_samples(&ctx.samples_size);
+        if (!result.samples) {
+            bench_fail(result.name, "allocation failed");
+            goto cleanup;
+        }
+
+        /* Each iteration replays a whole storm, callback latency is measured from the moment
+           hs_monitor_refresh() starts, and shows how long the last devices wait. */
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            hs_monitor *monitor;
+            struct pollfd pfd;
+
+            r = hs_monitor_new_from_trace(filename, 0.0, &monitor);
+            if (r < 0)
+                break;
+            hs_monitor_register_callback(monitor, record_callback_latency, &ctx);
+
+            pfd.fd = hs_monitor_get_descriptor(monitor);
+            pfd.events = POLLIN;
+            poll(&pfd, 1, 1000);
+
+            ctx.refresh_start = hs_nanos();
+            r = hs_monitor_refresh(monitor);
+            hs_monitor_free(monitor);
+            if (r < 0)
+                break;
+
+            events += STORM_CYCLES * STORM_DEVICES * 2;
+        }
+        bench_stop(&timer, &result);
+        result.ops = events;
+
+        if (r < 0) {
+            bench_fail(result.name, "storm replay failed");
+        } else {
+            bench_report(&result);
+        }
+        free(result.samples);
+    }
+
+cleanup:
+    unlink(filename);
+}
+
+const bench_suite bench_core_suites[] = {
+    {"htable",    bench_htable},
+    {"hid_open",  bench_hid_open},
+    {"enumerate", bench_enumerate},
+    {"monitor",   bench_monitor},
+    {"uevent",    bench_uevent},
+    {0}
+};
@@ -0,0 +1,1112 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hs.h"
+#include "bench.h"
+
+#define PEER_BUFFER_SIZE 65536
+
+enum peer_mode {
+    PEER_DRAIN,
+    PEER_FEED,
+    PEER_ECHO,
+    // Echo HID output reports as input reports, without the report ID
+    PEER_ECHO_HID
+};
+
+struct peer {
+    pthread_t thread;
+    int fd;
+    enum peer_mode mode;
+    size_t feed_size;
+
+    volatile bool stop;
+};
+
+static void *peer_thread(void *udata)
+{
+    struct peer *peer = udata;
+    uint8_t *buf;
+
+    buf = malloc(PEER_BUFFER_SIZE);
+    if (!buf)
+        return NULL;
+    memset(buf, 0x55, PEER_BUFFER_SIZE);
+
+    while (!peer->stop) {
+        struct pollfd pfd = {peer->fd, peer->mode == PEER_FEED ? POLLOUT : POLLIN};
+        ssize_t r;
+
+        // Wake up regularly to check the stop flag
+        r = poll(&pfd, 1, 20);
+        if (r < 0 && errno != EINTR)
+            break;
+        if (r <= 0)
+            continue;
+        if (pfd.revents & (POLLERR | POLLNVAL))
+            break;
+
+        switch (peer->mode) {
+        case PEER_DRAIN:
+            r = read(peer->fd, buf, PEER_BUFFER_SIZE);
+            break;
+        case PEER_FEED:
+            r = write(peer->fd, buf, peer->feed_size);
+            break;
+        case PEER_ECHO:
+            r = read(peer->fd, buf, PEER_BUFFER_SIZE);
+            if (r > 0)
+                r = write(peer->fd, buf, (size_t)r);
+            break;
+        case PEER_ECHO_HID:
+            r = read(peer->fd, buf, PEER_BUFFER_SIZE);
+            if (r > 1)
+                r = write(peer->fd, buf + 1, (size_t)r - 1);
+            break;
+        }
+        if (r < 0 && errno != EINTR && errno != EAGAIN)
+            break;
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static int start_peer(struct peer *peer, const hs_virtual_device *vdev, enum peer_mode mode,
+                      size_t feed_size)
+{
+    peer->fd = hs_virtual_device_get_peer(vdev);
+    peer->mode = mode;
+    peer->feed_size = feed_size;
+    peer->stop = false;
+
+    // Blocking writes would prevent the thread from seeing the stop flag
+    fcntl(peer->fd, F_SETFL, fcntl(peer->fd, F_GETFL) | O_NONBLOCK);
+
+    return pthread_create(&peer->thread, NULL, peer_thread, peer) ? -1 : 0;
+}
+
+static void stop_peer(struct peer *peer)
+{
+    peer->stop = true;
+    pthread_join(peer->thread, NULL);
+}
+
+static int open_virtual(hs_device_type type, hs_virtual_device **rvdev, hs_handle **rh)
+{
+    hs_virtual_device_info info = {0};
+    hs_virtual_device *vdev;
+    hs_handle *h;
+    int r;
+
+    info.type = type;
+    info.vid = 0x16C0;
+    info.pid = 0x0478;
+
+    r = hs_virtual_device_new(&info, &vdev);
+    if (r < 0)
+        return r;
+    r = hs_device_open(hs_virtual_device_get_device(vdev), &h);
+    if (r < 0) {
+        hs_virtual_device_free(vdev);
+        return r;
+    }
+
+    if (type == HS_DEVICE_TYPE_SERIAL) {
+        r = hs_serial_set_attributes(h, 115200, 0);
+        if (r < 0) {
+            hs_handle_close(h);
+            hs_virtual_device_free(vdev);
+            return r;
+        }
+    }
+
+    *rvdev = vdev;
+    *rh = h;
+    return 0;
+}
+
+static void close_virtual(hs_virtual_device *vdev, hs_handle *h)
+{
+    hs_handle_close(h);
+    hs_virtual_device_free(vdev);
+}
+
+static void bench_hid(void)
+{
+    hs_virtual_device *vdev;
+    hs_handle *h;
+    struct peer peer;
+    uint8_t buf[65];
+    bench_timer timer;
+    ssize_t r = 0;
+
+    if (open_virtual(HS_DEVICE_TYPE_HID, &vdev, &h) < 0) {
+        bench_fail("hid", "cannot open virtual device");
+        return;
+    }
+    memset(buf, 0, sizeof(buf));
+
+    {
+        bench_result result = {"hid_write_64"};
+
+        if (start_peer(&peer, vdev, PEER_DRAIN, 0) < 0) {
+            bench_fail(result.name, "cannot start peer thread");
+            goto cleanup;
+        }
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            r = hs_hid_write(h, buf, sizeof(buf));
+            if (r < 0)
+                break;
+            result.bytes += 64;
+        }
+        bench_stop(&timer, &result);
+        stop_peer(&peer);
+
+        if (r < 0) {
+            bench_fail(result.name, "hs_hid_write() failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    {
+        bench_result result = {"hid_read_64"};
+
+        if (start_peer(&peer, vdev, PEER_FEED, 64) < 0) {
+            bench_fail(result.name, "cannot start peer thread");
+            goto cleanup;
+        }
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            r = hs_hid_read(h, buf, sizeof(buf), 1000);
+            if (r <= 0)
+                break;
+            result.bytes += 64;
+        }
+        bench_stop(&timer, &result);
+        stop_peer(&peer);
+
+        if (r <= 0) {
+            bench_fail(result.name, "hs_hid_read() failed");
+        } else {
+            bench_report(&result);
+        }
+
+        // Flush reports left over by the feeder
+        while (hs_hid_read(h, buf, sizeof(buf), 0) > 0)
+            continue;
+    }
+
+    {
+        bench_result result = {"hid_round_trip"};
+        size_t count;
+
+        result.samples = bench_alloc_samples(&count);
+        if (!result.samples || start_peer(&peer, vdev, PEER_ECHO_HID, 0) < 0) {
+            bench_fail(result.name, "cannot start peer thread");
+            free(result.samples);
+            goto cleanup;
+        }
+
+        bench_start(&timer);
+        while (bench_running(&timer) && result.samples_count < count) {
+            uint64_t start = hs_nanos();
+
+            r = hs_hid_write(h, buf, sizeof(buf));
+            if (r < 0)
+                break;
+            r = hs_hid_read(h, buf, sizeof(buf), 1000);
+            if (r <= 0)
+                break;
+
+            result.samples[result.samples_count++] = hs_nanos() - start;
+        }
+        bench_stop(&timer, &result);
+        stop_peer(&peer);
+
+        if (r <= 0) {
+            bench_fail(result.name, "round trip failed");
+        } else {
+            result.ops = result.samples_count;
+            bench_report(&result);
+        }
+        free(result.samples);
+    }
+
+cleanup:
+    close_virtual(vdev, h);
+}
+
+static void bench_serial_throughput(void)
+{
+    hs_virtual_device *vdev;
+    hs_handle *h;
+    struct peer peer;
+    uint8_t buf[4096];
+    bench_timer timer;
+    ssize_t r = 0;
+
+    if (open_virtual(HS_DEVICE_TYPE_SERIAL, &vdev, &h) < 0) {
+        bench_fail("serial", "cannot open virtual device");
+        return;
+    }
+    memset(buf, 0xAA, sizeof(buf));
+
+    {
+        bench_result result = {"serial_write_4k"};
+
+        if (start_peer(&peer, vdev, PEER_DRAIN, 0) < 0) {
+            bench_fail(result.name, "cannot start peer thread");
+            goto cleanup;
+        }
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            r = hs_serial_write_all(h, buf, sizeof(buf), 1000);
+            if (r <= 0)
+                break;
+            result.bytes += (uint64_t)r;
+        }
+        bench_stop(&timer, &result);
+        stop_peer(&peer);
+
+        if (r <= 0) {
+            bench_fail(result.name, "hs_serial_write_all() failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    {
+        bench_result result = {"serial_read_4k"};
+
+        if (start_peer(&peer, vdev, PEER_FEED, sizeof(buf)) < 0) {
+            bench_fail(result.name, "cannot start peer thread");
+            goto cleanup;
+        }
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            r = hs_serial_read(h, buf, sizeof(buf), 1000);
+            if (r <= 0)
+                break;
+            result.bytes += (uint64_t)r;
+        }
+        bench_stop(&timer, &result);
+        stop_peer(&peer);
+
+        if (r <= 0) {
+            bench_fail(result.name, "hs_serial_read() failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+cleanup:
+    close_virtual(vdev, h);
+}
+
+static void bench_serial_latency_spin(const char *name, unsigned int spin_budget)
+{
+    hs_virtual_device *vdev;
+    hs_handle *h;
+    struct peer peer;
+    bench_result result = {name};
+    bench_timer timer;
+    uint8_t buf[16] = {0};
+    size_t count;
+    ssize_t r = 0;
+
+    if (open_virtual(HS_DEVICE_TYPE_SERIAL, &vdev, &h) < 0) {
+        bench_fail(name, "cannot open virtual device");
+        return;
+    }
+    hs_serial_set_spin_budget(h, spin_budget);
+
+    result.samples = bench_alloc_samples(&count);
+    if (!result.samples || start_peer(&peer, vdev, PEER_ECHO, 0) < 0) {
+        bench_fail(name, "cannot start peer thread");
+        free(result.samples);
+        close_virtual(vdev, h);
+        return;
+    }
+
+    bench_start(&timer);
+    while (bench_running(&timer) && result.samples_count < count) {
+        uint64_t start = hs_nanos();
+
+        r = hs_serial_write_all(h, buf, sizeof(buf), 1000);
+        if (r <= 0)
+            break;
+        r = hs_serial_read_exact(h, buf, sizeof(buf), 1000);
+        if (r <= 0)
+            break;
+
+        result.samples[result.samples_count++] = hs_nanos() - start;
+    }
+    bench_stop(&timer, &result);
+    stop_peer(&peer);
+
+    if (r <= 0) {
+        bench_fail(name, "round trip failed");
+    } else {
+        result.ops = result.samples_count;
+        bench_report(&result);
+    }
+
+    free(result.samples);
+    close_virtual(vdev, h);
+}
+
+static void bench_serial_latency(void)
+{
+    bench_serial_latency_spin("serial_round_trip", 0);
+    bench_serial_latency_spin("serial_round_trip_spin50", 50);
+}
+
+static void bench_serial_writev(void)
+{
+    hs_virtual_device *vdev;
+    hs_handle *h;
+    struct peer peer;
+    hs_serial_iovec iov[16];
+    uint8_t chunk[16];
+    bench_timer timer;
+    ssize_t r = 0;
+
+    if (open_virtual(HS_DEVICE_TYPE_SERIAL, &vdev, &h) < 0) {
+        bench_fail("writev", "cannot open virtual device");
+        return;
+    }
+    if (start_peer(&peer, vdev, PEER_DRAIN, 0) < 0) {
+        bench_fail("writev", "cannot start peer thread");
+        close_virtual(vdev, h);
+        return;
+    }
+
+    memset(chunk, 0x42, sizeof(chunk));
+    for (unsigned int i = 0; i < 16; i++) {
+        iov[i].buf = chunk;
+        iov[i].size = sizeof(chunk);
+    }
+
+    {
+        bench_result result = {"serial_writev_16x16"};
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            r = hs_serial_writev(h, iov, 16, 1000);
+            if (r <= 0)
+                break;
+            result.bytes += (uint64_t)r;
+        }
+        bench_stop(&timer, &result);
+
+        if (r <= 0) {
+            bench_fail(result.name, "hs_serial_writev() failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    {
+        bench_result result = {"serial_write_16x16"};
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            for (unsigned int i = 0; i < 16; i++) {
+                r = hs_serial_write_all(h, chunk, sizeof(chunk), 1000);
+                if (r <= 0)
+                    break;
+                result.bytes += (uint64_t)r;
+            }
+            if (r <= 0)
+                break;
+        }
+        bench_stop(&timer, &result);
+
+        if (r <= 0) {
+            bench_fail(result.name, "hs_serial_write_all() failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    stop_peer(&peer);
+    close_virtual(vdev, h);
+}
+
+static void bench_framing_protocol(const char *name, hs_serial_framing framing)
+{
+    hs_virtual_device *vdev;
+    hs_handle *h;
+    struct peer peer;
+    bench_result result = {name};
+    bench_timer timer;
+    uint8_t frame[256], buf[256];
+    ssize_t r = 0;
+
+    if (open_virtual(HS_DEVICE_TYPE_SERIAL, &vdev, &h) < 0) {
+        bench_fail(name, "cannot open virtual device");
+        return;
+    }
+    hs_serial_set_framing(h, framing);
+
+    // Include bytes that need escaping with both protocols
+    for (unsigned int i = 0; i < sizeof(frame); i++)
+        frame[i] = (uint8_t)i;
+
+    if (start_peer(&peer, vdev, PEER_ECHO, 0) < 0) {
+        bench_fail(name, "cannot start peer thread");
+        close_virtual(vdev, h);
+        return;
+    }
+
+    bench_start(&timer);
+    while (bench_running(&timer)) {
+        r = hs_serial_write_frame(h, frame, sizeof(frame), 1000);
+        if (r <= 0)
+            break;
+        r = hs_serial_read_frame(h, buf, sizeof(buf), 1000);
+        if (r != (ssize_t)sizeof(frame)) {
+            r = -1;
+            break;
+        }
+        result.bytes += sizeof(frame);
+    }
+    bench_stop(&timer, &result);
+    stop_peer(&peer);
+
+    if (r <= 0) {
+        bench_fail(name, "frame round trip failed");
+    } else {
+        bench_report(&result);
+    }
+
+    close_virtual(vdev, h);
+}
+
+static void bench_framing(void)
+{
+    bench_framing_protocol("framing_cobs_256", HS_SERIAL_FRAMING_COBS);
+    bench_framing_protocol("framing_slip_256", HS_SERIAL_FRAMING_SLIP);
+}
+
+static void bench_splice(void)
+{
+    hs_virtual_device *vdev;
+    hs_handle *h;
+    struct peer peer;
+    int null_fd;
+    bench_timer timer;
+    ssize_t r = 0;
+
+    if (open_virtual(HS_DEVICE_TYPE_SERIAL, &vdev, &h) < 0) {
+        bench_fail("splice", "cannot open virtual device");
+        return;
+    }
+    null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (null_fd < 0 || start_peer(&peer, vdev, PEER_FEED, 4096) < 0) {
+        bench_fail("splice", "cannot start peer thread");
+        if (null_fd >= 0)
+            close(null_fd);
+        close_virtual(vdev, h);
+        return;
+    }
+
+    {
+        bench_result result = {"serial_splice_to"};
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            r = hs_serial_splice_to(h, null_fd, 65536, 1000);
+            if (r <= 0)
+                break;
+            result.bytes += (uint64_t)r;
+        }
+        bench_stop(&timer, &result);
+
+        if (r <= 0) {
+            bench_fail(result.name, "hs_serial_splice_to() failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    {
+        bench_result result = {"serial_read_write_copy"};
+        uint8_t buf[65536];
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            r = hs_serial_read(h, buf, sizeof(buf), 1000);
+            if (r <= 0)
+                break;
+            if (write(null_fd, buf, (size_t)r) < 0) {
+                r = -1;
+                break;
+            }
+            result.bytes += (uint64_t)r;
+        }
+        bench_stop(&timer, &result);
+
+        if (r <= 0) {
+            bench_fail(result.name, "copy failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    stop_peer(&peer);
+    close(null_fd);
+    close_virtual(vdev, h);
+}
+
+static void bench_serial_rate(void)
+{
+    hs_virtual_device *vdev;
+    hs_handle *h;
+    bench_timer timer;
+    int r = 0;
+
+    // Ptys ignore the rate, this measures the cost of reconfiguring the port
+    if (open_virtual(HS_DEVICE_TYPE_SERIAL, &vdev, &h) < 0) {
+        bench_fail("serial_rate", "cannot open virtual device");
+        return;
+    }
+
+    {
+        bench_result result = {"serial_set_rate_standard"};
+        unsigned int i = 0;
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            r = hs_serial_set_attributes(h, (i++ & 1) ? 115200 : 921600, 0);
+            if (r < 0)
+                break;
+        }
+        bench_stop(&timer, &result);
+
+        if (r < 0) {
+            bench_fail(result.name, "hs_serial_set_attributes() failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    {
+        bench_result result = {"serial_set_rate_custom"};
+        unsigned int i = 0;
+
+        bench_start(&timer);
+        while (bench_running(&timer)) {
+            r = hs_serial_set_attributes(h, (i++ & 1) ? 250000 : 1500000, 0);
+            if (r < 0)
+                break;
+        }
+        bench_stop(&timer, &result);
+
+        if (r < 0) {
+            bench_fail(result.name, "hs_serial_set_attributes() failed");
+        } else {
+            bench_report(&result);
+        }
+    }
+
+    close_virtual(vdev, h);
+}
+
+#define MANY_REPORT_SIZE 64
+
+struct many_devices {
+    hs_virtual_device **vdevs;
+    hs_handle **handles;
+    unsigned int count;
+
+    // Bytes still expected by each handle in the current round
+    size_t *pending;
+};
+
+static int open_many(struct many_devices *many, unsigned int count)
+{
+    memset(many, 0, sizeof(*many));
+
+    many->vdevs = calloc(count, sizeof(*many->vdevs));
+    many->handles = calloc(count, sizeof(*many->handles));
+    many->pending = calloc(count, sizeof(*many->pending));
+    if (!many->vdevs || !many->handles || !many->pending)
+        return -1;
+
+    for (; many->count < count; many->count++) {
+        int r = open_virtual(HS_DEVICE_TYPE_SERIAL, &many->vdevs[many->count],
+                             &many->handles[many->count]);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+static void close_many(struct many_devices *many)
+{
+    for (unsigned int i = 0; i < many->count; i++)
+        close_virtual(many->vdevs[i], many->handles[i]);
+
+    free(many->pending);
+    free(many->handles);
+    free(many->vdevs);
+}
+
+static int feed_many(struct many_devices *many)
+{
+    uint8_t buf[MANY_REPORT_SIZE];
+
+    memset(buf, 0x55, sizeof(buf));
+    for (unsigned int i = 0; i < many->count; i++) {
+        if (write(hs_virtual_device_get_peer(many->vdevs[i]), buf, sizeof(buf)) != sizeof(buf))
+            return -1;
+        many->pending[i] = sizeof(buf);
+    }
+
+    return 0;
+}
+
+// Read what feed_many() sent to every handle
+static int drain_many_sync(struct many_devices *many, uint64_t *rops)
+{
+    uint8_t buf[MANY_REPORT_SIZE];
+
+    for (unsigned int i = 0; i < many->count; i++) {
+        while (many->pending[i]) {
+            ssize_t r = hs_serial_read(many->handles[i], buf, many->pending[i], 1000);
+            if (r <= 0)
+                return -1;
+            many->pending[i] -= (size_t)r;
+            (*rops)++;
+        }
+    }
+
+    return 0;
+}
+
+// Same thing with one read queued per handle, submitted and reaped in batches
+static int drain_many_engine(struct many_devices *many, hs_io_engine *engine, uint8_t *bufs,
+                             hs_io_completion *completions, uint64_t *rops)
+{
+    unsigned int remaining = many->count;
+
+    for (unsigned int i = 0; i < many->count; i++) {
+        if (hs_io_engine_queue_read(engine, many->handles[i], bufs + i * MANY_REPORT_SIZE,
+                                    many->pending[i], (void *)(uintptr_t)i) != 1)
+            return -1;
+    }
+
+    while (remaining) {
+        int r = hs_io_engine_reap(engine, completions, many->count, 1000);
+        if (r <= 0)
+            return -1;
+
+        for (int j = 0; j < r; j++) {
+            unsigned int i = (unsigned int)(uintptr_t)completions[j].udata;
+
+            if (completions[j].r <= 0)
+                return -1;
+            many->pending[i] -= (size_t)completions[j].r;
+            (*rops)++;
+
+            if (!many->pending[i]) {
+                remaining--;
+            } else if (hs_io_engine_queue_read(engine, many->handles[i],
+                                               bufs + i * MANY_REPORT_SIZE, many->pending[i],
+                                               completions[j].udata) != 1) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Without use_engine, the handles are read one hs_serial_read() call at a time
+static void bench_io_engine_backend(const char *name, struct many_devices *many,
+                                    bool use_engine, hs_io_backend backend)
+{
+    bench_result result = {name};
+    hs_io_engine *engine = NULL;
+    uint8_t *bufs = NULL;
+    hs_io_completion *completions = NULL;
+    bench_timer timer;
+    int r = 0;
+
+    if (use_engine) {
+        bufs = malloc(many->count * MANY_REPORT_SIZE);
+        completions = malloc(many->count * sizeof(*completions));
+        if (!bufs || !completions || hs_io_engine_new(backend, many->count, &engine) < 0) {
+            bench_fail(result.name, "cannot create I/O engine");
+            goto cleanup;
+        }
+    }
+
+    bench_start(&timer);
+    while (bench_running(&timer)) {
+        r = feed_many(many);
+        if (r < 0)
+            break;
+
+        if (engine) {
+            r = drain_many_engine(many, engine, bufs, completions, &result.ops);
+        } else {
+            r = drain_many_sync(many, &result.ops);
+        }
+        if (r < 0)
+            break;
+        result.bytes += many->count * MANY_REPORT_SIZE;
+    }
+    bench_stop(&timer, &result);
+
+    if (r < 0) {
+        bench_fail(result.name, "round failed");
+    } else {
+        bench_report(&result);
+    }
+
+cleanup:
+    hs_io_engine_free(engine);
+    free(completions);
+    free(bufs);
+}
+
+// Read a 64-byte burst from each of many serial handles, per round
+static void bench_io_engine(void)
+{
+    struct many_devices many;
+    hs_io_engine *engine;
+    bool uring = false;
+
+    if (open_many(&many, 128) < 0) {
+        bench_fail("io_engine", "cannot open virtual devices");
+        close_many(&many);
+        return;
+    }
+
+    // Asking for io_uring directly would log an error on kernels without it
+    if (hs_io_engine_new(HS_IO_BACKEND_AUTO, 1, &engine) == 0) {
+        uring = (hs_io_engine_get_backend(engine) == HS_IO_BACKEND_URING);
+        hs_io_engine_free(engine);
+    }
+
+    bench_io_engine_backend("io_sync_128", &many, false, HS_IO_BACKEND_AUTO);
+    bench_io_engine_backend("io_epoll_128", &many, true, HS_IO_BACKEND_EPOLL);
+    if (uring)
+        bench_io_engine_backend("io_uring_128", &many, true, HS_IO_BACKEND_URING);
+
+    close_many(&many);
+}
+
+#define POLLER_HANDLES 1000
+#define POLLER_BATCH 64
+
+static void bench_poller_latency(struct many_devices *many, hs_poller *poller)
+{
+    bench_result result = {"poller_wakeup_1000"};
+    size_t count;
+    int *ids;
+    uint8_t buf[16];
+    bench_timer timer;
+    unsigned int i = 0;
+    int r = 0;
+
+    result.samples = bench_alloc_samples(&count);
+    ids = malloc(many->count * sizeof(*ids));
+    if (!result.samples || !ids) {
+        bench_fail(result.name, "out of memory");
+        goto cleanup;
+    }
+
+    // One descriptor becomes ready at a time, the others stay idle
+    bench_start(&timer);
+    while (bench_running(&timer) && result.samples_count < count) {
+        uint64_t start = hs_nanos();
+
+        if (write(hs_virtual_device_get_peer(many->vdevs[i]), "x", 1) != 1) {
+            r = -1;
+            break;
+        }
+        r = hs_poller_wait(poller, ids, many->count, 1000);
+        if (r != 1 || ids[0] != (int)i) {
+            r = -1;
+            break;
+        }
+        result.samples[result.samples_count++] = hs_nanos() - start;
+
+        r = (int)hs_serial_read(many->handles[i], buf, sizeof(buf), 0);
+        if (r <= 0)
+            break;
+        i = (i + 1) % many->count;
+    }
+    bench_stop(&timer, &result);
+
+    if (r <= 0) {
+        bench_fail(result.name, "wakeup failed");
+    } else {
+        result.ops = result.samples_count;
+        bench_report(&result);
+    }
+
+cleanup:
+    free(ids);
+    free(result.samples);
+}
+
+static void bench_poller_fairness(struct many_devices *many, hs_poller *poller)
+{
+    bench_result result = {"poller_wait_all_ready"};
+    unsigned int *hits;
+    int *ids;
+    uint8_t buf[16];
+    unsigned int ready = 0, min_hits = UINT32_MAX, max_hits = 0;
+    bench_timer timer;
+    int r = 0;
+
+    hits = calloc(many->count, sizeof(*hits));
+    ids = malloc(many->count * sizeof(*ids));
+    if (!hits || !ids) {
+        bench_fail(result.name, "out of memory");
+        goto cleanup;
+    }
+
+    // Make every descriptor ready, the pty layer needs a moment to propagate the data
+    for (unsigned int i = 0; i < many->count; i++) {
+        if (write(hs_virtual_device_get_peer(many->vdevs[i]), "x", 1) != 1) {
+            bench_fail(result.name, "peer write failed");
+            goto cleanup;
+        }
+    }
+    for (unsigned int tries = 0; ready < many->count && tries < 100; tries++) {
+        r = hs_poller_wait(poller, ids, many->count, 1000);
+        if (r < 0)
+            break;
+        ready = (unsigned int)r;
+    }
+    if (ready < many->count) {
+        bench_fail(result.name, "descriptors did not become ready");
+        goto drain;
+    }
+
+    /* Nothing is consumed, so every call sees all the descriptors ready but only gets
+       POLLER_BATCH of them. A fair poller hands them out in turn. */
+    bench_start(&timer);
+    while (bench_running(&timer)) {
+        r = hs_poller_wait(poller, ids, POLLER_BATCH, 0);
+        if (r != POLLER_BATCH)
+            break;
+        for (int j = 0; j < r; j++)
+            hits[ids[j]]++;
+    }
+    bench_stop(&timer, &result);
+
+    for (unsigned int i = 0; i < many->count; i++) {
+        if (hits[i] < min_hits)
+            min_hits = hits[i];
+        if (hits[i] > max_hits)
+            max_hits = hits[i];
+    }
+
+    if (r != POLLER_BATCH) {
+        bench_fail(result.name, "hs_poller_wait() failed");
+    } else if (max_hits - min_hits > 1) {
+        // Round-robin gives every descriptor the same count, give or take the last lap
+        bench_fail(result.name, "some descriptors were starved");
+    } else {
+        bench_report(&result);
+    }
+
+drain:
+    for (unsigned int i = 0; i < many->count; i++)
+        hs_serial_read(many->handles[i], buf, sizeof(buf), 0);
+cleanup:
+    free(ids);
+    free(hits);
+}
+
+static void bench_poller(void)
+{
+    struct many_devices many;
+    hs_poller *poller = NULL;
+
+    if (open_many(&many, POLLER_HANDLES) < 0) {
+        bench_fail("poller", "cannot open virtual devices");
+        goto cleanup;
+    }
+    if (hs_poller_new(&poller) < 0) {
+        bench_fail("poller", "cannot create poller");
+        goto cleanup;
+    }
+    for (unsigned int i = 0; i < many.count; i++) {
+        if (hs_poller_add(poller, hs_handle_get_descriptor(many.handles[i]), (int)i) < 0) {
+            bench_fail("poller", "hs_poller_add() failed");
+            goto cleanup;
+        }
+    }
+
+    bench_poller_latency(&many, poller);
+    bench_poller_fairness(&many, poller);
+
+cleanup:
+    hs_poller_free(poller);
+    close_many(&many);
+}
+
+static ssize_t read_replug(hs_handle *h, uint8_t *buf, size_t size)
+{
+    if (hs_device_get_type(hs_handle_get_device(h)) == HS_DEVICE_TYPE_HID)
+        return hs_hid_read(h, buf, size, 1000);
+    return hs_serial_read(h, buf, size, 1000);
+}
+
+// Unplug and replug the same virtual device, the registered handle must keep working
+static void bench_replug(const char *name, hs_device_type type)
+{
+    bench_result result = {name};
+    hs_monitor *monitor = NULL;
+    hs_virtual_device *vdev;
+    hs_handle *h;
+    hs_poller *poller = NULL;
+    hs_io_engine *engine = NULL;
+    int peer_fd;
+    uint8_t buf[16], engine_buf[16];
+    bench_timer timer;
+    const char *failure = NULL;
+    ssize_t r;
+
+    if (open_virtual(type, &vdev, &h) < 0) {
+        bench_fail(result.name, "cannot open virtual device");
+        return;
+    }
+    peer_fd = hs_virtual_device_get_peer(vdev);
+
+    if (hs_monitor_new(&monitor) < 0 || hs_virtual_device_plug(vdev, monitor) < 0 ||
+            hs_monitor_register_handle(monitor, h) < 0) {
+        failure = "cannot register handle";
+        goto cleanup;
+    }
+    if (hs_poller_new(&poller) < 0 || hs_poller_add(poller, hs_handle_get_descriptor(h), 1) < 0) {
+        failure = "cannot create poller";
+        goto cleanup;
+    }
+    // The epoll backend is the one that depends on descriptor registrations
+    if (hs_io_engine_new(HS_IO_BACKEND_EPOLL, 4, &engine) < 0 ||
+            hs_io_engine_queue_read(engine, h, engine_buf, sizeof(engine_buf), NULL) < 0 ||
+            hs_io_engine_submit(engine) < 0) {
+        failure = "cannot create I/O engine";
+        goto cleanup;
+    }
+
+    bench_start(&timer);
+    while (bench_running(&timer)) {
+        int id;
+
+        hs_virtual_device_unplug(vdev);
+        r = hs_virtual_device_plug(vdev, monitor);
+        if (r < 0) {
+            failure = "hs_virtual_device_plug() failed";
+            break;
+        }
+        if (hs_device_get_status(hs_handle_get_device(h)) != HS_DEVICE_STATUS_ONLINE) {
+            failure = "handle was not reopened";
+            break;
+        }
+
+        if (write(peer_fd, "x", 1) != 1) {
+            failure = "peer write failed";
+            break;
+        }
+        r = hs_poller_wait(poller, &id, 1, 1000);
+        if (r != 1) {
+            failure = "descriptor lost by hs_poller";
+            break;
+        }
+        // HID reads prepend the report ID
+        r = read_replug(h, buf, sizeof(buf));
+        if (r < 1 || buf[r - 1] != 'x') {
+            failure = "read failed";
+            break;
+        }
+    }
+    bench_stop(&timer, &result);
+
+    if (!failure) {
+        hs_io_completion completion;
+
+        // The read queued before the first replug must still complete
+        if (write(peer_fd, "y", 1) != 1 || hs_io_engine_reap(engine, &completion, 1, 1000) != 1 ||
+                completion.r < 1 || engine_buf[completion.r - 1] != 'y')
+            failure = "descriptor lost by hs_io_engine";
+    }
+
+cleanup:
+    if (failure) {
+        bench_fail(result.name, failure);
+    } else {
+        bench_report(&result);
+    }
+
+    hs_io_engine_free(engine);
+    hs_poller_free(poller);
+    hs_virtual_device_unplug(vdev);
+    close_virtual(vdev, h);
+    hs_monitor_free(monitor);
+}
+
+static void bench_reconnect(void)
+{
+    bench_replug("serial_replug", HS_DEVICE_TYPE_SERIAL);
+    bench_replug("hid_replug", HS_DEVICE_TYPE_HID);
+}
+
+const bench_suite bench_io_suites[] = {
+    {"hid",            bench_hid},
+    {"serial",         bench_serial_throughput},
+    {"serial_latency", bench_serial_latency},
+    {"serial_writev",  bench_serial_writev},
+    {"serial_rate",    bench_serial_rate},
+    {"framing",        bench_framing},
+    {"splice",         bench_splice},
+    {"reconnect",      bench_reconnect},
+    {"io_engine",      bench_io_engine},
+    {"poller",         bench_poller},
+    {0}
+};
@@ -0,0 +1,318 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#include "hs.h"
+#include "bench.h"
+
+#define MAX_SAMPLES 262144
+
+struct baseline_entry {
+    char name[64];
+    double ns_per_op;
+};
+
+static uint64_t budget = 250 * 1000000ull;
+static const char *filter;
+static struct baseline_entry *baseline;
+static size_t baseline_count;
+static double threshold = 10.0;
+static bool failed, regressed;
+
+static void print_usage(FILE *fp)
+{
+    fprintf(fp, "usage: hs_bench [options]\n\n"
+                "Options:\n"
+                "   -t, --time <ms>         Time budget for each benchmark (default: 250)\n"
+                "   -f, --filter <name>     Only run suites whose name contains <name>\n"
+                "   -b, --baseline <file>   Compare results against a previous run\n"
+                "       --threshold <pct>   Slowdown reported as a regression (default: 10)\n"
+                "   -l, --list              List benchmark suites and exit\n\n"
+                "Results are printed as one JSON object per line. Save them to a file and pass\n"
+                "it with --baseline to detect regressions, hs_bench then exits with code 2.\n");
+}
+
+uint64_t bench_cpu_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t bench_rss(void)
+{
+    FILE *fp;
+    unsigned long long size, resident;
+    int r;
+
+    fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+    r = fscanf(fp, "%llu %llu", &size, &resident);
+    fclose(fp);
+    if (r != 2)
+        return 0;
+
+    return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+void bench_start(bench_timer *timer)
+{
+    timer->ops = 0;
+    timer->cpu_start = bench_cpu_time();
+    timer->start = hs_nanos();
+}
+
+bool bench_running(bench_timer *timer)
+{
+    // Checking the clock every time would distort the cheapest benchmarks
+    if (timer->ops++ % 16)
+        return true;
+
+    return hs_nanos() - timer->start < budget;
+}
+
+void bench_stop(bench_timer *timer, bench_result *result)
+{
+    result->elapsed = hs_nanos() - timer->start;
+    result->cpu = bench_cpu_time() - timer->cpu_start;
+    if (!result->ops)
+        result->ops = timer->ops ? timer->ops - 1 : 0;
+}
+
+uint64_t *bench_alloc_samples(size_t *rcount)
+{
+    uint64_t *samples = malloc(MAX_SAMPLES * sizeof(*samples));
+
+    *rcount = samples ? MAX_SAMPLES : 0;
+    return samples;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    uint64_t sa = *(const uint64_t *)a, sb = *(const uint64_t *)b;
+    return (sa > sb) - (sa < sb);
+}
+
+static const struct baseline_entry *find_baseline(const char *name)
+{
+    for (size_t i = 0; i < baseline_count; i++) {
+        if (strcmp(baseline[i].name, name) == 0)
+            return &baseline[i];
+    }
+
+    return NULL;
+}
+
+void bench_report(bench_result *result)
+{
+    const struct baseline_entry *base;
+    double ns_per_op;
+
+    if (!result->ops) {
+        bench_fail(result->name, "no operation completed");
+        return;
+    }
+    ns_per_op = (double)result->elapsed / (double)result->ops;
+
+    printf("{\"name\": \"%s\", \"ops\": %"PRIu64", \"ns_per_op\": %.1f, \"ops_per_sec\": %.0f",
+           result->name, result->ops, ns_per_op, 1e9 / ns_per_op);
+    if (result->bytes) {
+        printf(", \"mb_per_sec\": %.2f",
+               (double)result->bytes / 1048576.0 / ((double)result->elapsed / 1e9));
+        if (result->cpu)
+            printf(", \"cpu_ns_per_mb\": %.0f",
+                   (double)result->cpu / ((double)result->bytes / 1048576.0));
+    }
+    if (result->samples_count) {
+        qsort(result->samples, result->samples_count, sizeof(*result->samples), compare_samples);
+        printf(", \"p50_ns\": %"PRIu64", \"p99_ns\": %"PRIu64", \"max_ns\": %"PRIu64,
+               result->samples[result->samples_count / 2],
+               result->samples[result->samples_count * 99 / 100],
+               result->samples[result->samples_count - 1]);
+    }
+
+    if (result->rss_end) {
+        printf(", \"allocs_per_op\": %.3f", (double)result->allocations / (double)result->ops);
+        printf(", \"rss_start_kb\": %"PRIu64", \"rss_end_kb\": %"PRIu64,
+               result->rss_start, result->rss_end);
+    }
+
+    base = find_baseline(result->name);
+    if (base && base->ns_per_op > 0.0) {
+        double change = (ns_per_op - base->ns_per_op) / base->ns_per_op * 100.0;
+
+        printf(", \"baseline_ns_per_op\": %.1f, \"change_pct\": %.1f", base->ns_per_op, change);
+        if (change > threshold) {
+            printf(", \"regression\": true");
+            regressed = true;
+        }
+    }
+
+    printf("}\n");
+    fflush(stdout);
+}
+
+void bench_fail(const char *name, const char *reason)
+{
+    printf("{\"name\": \"%s\", \"error\": \"%s\"}\n", name, reason);
+    fflush(stdout);
+
+    failed = true;
+}
+
+static int load_baseline(const char *filename)
+{
+    FILE *fp;
+    char line[1024];
+    size_t allocated = 0;
+
+    fp = fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "Cannot open baseline '%s'\n", filename);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        const char *name, *value;
+        struct baseline_entry entry;
+
+        name = strstr(line, "\"name\": \"");
+        value = strstr(line, "\"ns_per_op\": ");
+        if (!name || !value)
+            continue;
+
+        if (sscanf(name + 9, "%63[^\"]", entry.name) != 1 ||
+                sscanf(value + 13, "%lf", &entry.ns_per_op) != 1)
+            continue;
+
+        if (baseline_count == allocated) {
+            struct baseline_entry *tmp;
+
+            allocated = allocated ? allocated * 2 : 64;
+            tmp = realloc(baseline, allocated * sizeof(*baseline));
+            if (!tmp) {
+                fclose(fp);
+                return -1;
+            }
+            baseline = tmp;
+        }
+        baseline[baseline_count++] = entry;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static void run_suites(const bench_suite *suites, bool list)
+{
+    for (const bench_suite *suite = suites; suite->name; suite++) {
+        if (list) {
+            printf("%s\n", suite->name);
+            continue;
+        }
+        if (filter && !strstr(suite->name, filter))
+            continue;
+
+        (*suite->f)();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    enum {
+        OPTION_THRESHOLD = 0x100
+    };
+    static const struct option long_options[] = {
+        {"time",      required_argument, NULL, 't'},
+        {"filter",    required_argument, NULL, 'f'},
+        {"baseline",  required_argument, NULL, 'b'},
+        {"threshold", required_argument, NULL, OPTION_THRESHOLD},
+        {"list",      no_argument,       NULL, 'l'},
+        {"help",      no_argument,       NULL, 'h'},
+        {0}
+    };
+
+    bool list = false;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "t:f:b:lh", long_options, NULL)) != -1) {
+        switch (c) {
+        case 't':
+            budget = strtoull(optarg, NULL, 10) * 1000000;
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'b':
+            if (load_baseline(optarg) < 0)
+                return 1;
+            break;
+        case OPTION_THRESHOLD:
+            threshold = strtod(optarg, NULL);
+            break;
+        case 'l':
+            list = true;
+            break;
+        case 'h':
+            print_usage(stdout);
+            return 0;
+
+        default:
+            print_usage(stderr);
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        print_usage(stderr);
+        return 1;
+    }
+
+    // Some suites open hundreds of virtual devices, with two descriptors each
+    if (!list) {
+        struct rlimit limit;
+
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+
+    run_suites(bench_core_suites, list);
+    run_suites(bench_io_suites, list);
+    run_suites(bench_alloc_suites, list);
+
+    free(baseline);
+
+    if (failed)
+        return 1;
+    return regressed ? 2 : 0;
+}
@@ -25,11 +25,14 @@
 #ifndef HS_HS_H
 #define HS_HS_H
 
+#include "hs/capture.h"
 #include "hs/common.h"
 #include "hs/device.h"
 #include "hs/hid.h"
+#include "hs/io.h"
 #include "hs/monitor.h"
 #include "hs/platform.h"
 #include "hs/serial.h"
+#include "hs/virtual.h"
 
 #endif
@@ -0,0 +1,217 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef HS_CAPTURE_H
+#define HS_CAPTURE_H
+
+#include "common.h"
+#include "device.h"
+
+HS_BEGIN_C
+
+#if defined(__linux__) || defined(__APPLE__)
+
+struct hs_monitor;
+struct hs_virtual_device;
+
+/**
+ * @defgroup capture HID capture and replay
+ * @brief Record HID traffic to a file and feed it back through virtual devices.
+ *
+ * Attach a capture to HID handles with hs_handle_set_capture(), and every report that goes
+ * through hs_hid_read(), hs_hid_write(), hs_hid_get_feature_report() and
+ * hs_hid_send_feature_report() is appended to the capture file. On Linux, hs_replay_new()
+ * loads this file and recreates the devices as virtual devices (see @ref virtual), and
+ * hs_replay_run() sends the recorded input reports at the original or accelerated speed.
+ *
+ * The file is a sequence of 8-byte aligned structures in host byte order, so it can be used
+ * in place once mapped in memory:
+ * - A 16-byte header: the "HSCP" magic, a 16-bit version (1), the 16-bit header size, and
+ *   the CLOCK_REALTIME time of creation in nanoseconds.
+ * - Records made of a 16-byte record header (64-bit time in nanoseconds since the creation
+ *   of the capture, 32-bit payload size, 16-bit device index, 8-bit record type and one
+ *   reserved byte) followed by the payload, padded to a multiple of 8 bytes.
+ *
+ * A device record (type 0) is written the first time a handle is attached to a capture, and
+ * gives the device its index. Its payload holds the VID, PID, usage page and usage (16-bit
+ * each), the interface number (8-bit) and 3 reserved bytes, followed by the location,
+ * manufacturer, product and serial number strings (NUL-terminated, empty when unknown).
+ * Report records (1 = input, 2 = output, 3 = get feature, 4 = send feature) contain the
+ * report as seen by the application, report ID first.
+ */
+
+/**
+ * @ingroup capture
+ * @brief Opaque structure representing a capture file being recorded.
+ */
+typedef struct hs_capture hs_capture;
+
+/**
+ * @ingroup capture
+ * @brief Create a capture file.
+ *
+ * Records are buffered in memory, use hs_capture_flush() to write them out. The capture is
+ * thread-safe: you can attach it to handles used by different threads.
+ *
+ * @param      filename Path of the capture file, it is truncated if it exists.
+ * @param[out] rcapture A pointer to the variable that receives the capture, it will stay
+ *     unchanged if the function fails.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_capture_free()
+ */
+HS_PUBLIC int hs_capture_new(const char *filename, hs_capture **rcapture);
+/**
+ * @ingroup capture
+ * @brief Flush and close a capture file.
+ *
+ * Detach the capture from all handles (or close them) before you call this.
+ *
+ * @param capture Capture object.
+ */
+HS_PUBLIC void hs_capture_free(hs_capture *capture);
+
+/**
+ * @ingroup capture
+ * @brief Write buffered records to the capture file.
+ *
+ * The tap never makes I/O calls fail: if the capture file cannot be written, recording stops
+ * and the error is reported by this function.
+ *
+ * @param capture Capture object.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_capture_flush(hs_capture *capture);
+
+/**
+ * @ingroup capture
+ * @brief Record the reports exchanged through a HID handle.
+ *
+ * Recording costs one clock read and one copy per report. Attaching the same handle again
+ * does not add a new device record, and handles opened on the same device share its device index.
+ *
+ * @param h       Open HID device handle.
+ * @param capture Capture object, or NULL to stop recording this handle.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_handle_set_capture(hs_handle *h, hs_capture *capture);
+
+#endif
+
+#ifdef __linux__
+
+/**
+ * @ingroup capture
+ * @brief Opaque structure representing a capture file loaded for replay.
+ */
+typedef struct hs_replay hs_replay;
+
+/**
+ * @ingroup capture
+ * @brief Load a capture file and create its virtual devices.
+ *
+ * The file is mapped in memory. Each recorded device becomes a virtual HID device with the
+ * same identity, and recorded feature reports are used to answer hs_hid_get_feature_report()
+ * calls made on these devices.
+ *
+ * @param      filename Path of the capture file.
+ * @param[out] rreplay  A pointer to the variable that receives the replay object, it will
+ *     stay unchanged if the function fails.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *     HS_ERROR_INVALID is returned if the file is not a valid capture file.
+ *
+ * @sa hs_replay_free()
+ */
+HS_PUBLIC int hs_replay_new(const char *filename, hs_replay **rreplay);
+/**
+ * @ingroup capture
+ * @brief Free a replay object and its virtual devices.
+ *
+ * @param replay Replay object.
+ */
+HS_PUBLIC void hs_replay_free(hs_replay *replay);
+
+/**
+ * @ingroup capture
+ * @brief Get the number of devices in the capture.
+ *
+ * @param replay Replay object.
+ * @return This function returns the number of devices.
+ */
+HS_PUBLIC unsigned int hs_replay_get_device_count(const hs_replay *replay);
+/**
+ * @ingroup capture
+ * @brief Get the virtual device that replays a recorded device.
+ *
+ * Open it directly with hs_device_open(hs_virtual_device_get_device()), or plug all the
+ * devices into a monitor with hs_replay_plug().
+ *
+ * @param replay Replay object.
+ * @param idx    Device index, less than hs_replay_get_device_count().
+ * @return This function returns the virtual device.
+ */
+HS_PUBLIC struct hs_virtual_device *hs_replay_get_device(const hs_replay *replay,
+                                                         unsigned int idx);
+/**
+ * @ingroup capture
+ * @brief Plug all the devices of the capture into a monitor.
+ *
+ * @param replay  Replay object.
+ * @param monitor Device monitor.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_replay_plug(hs_replay *replay, struct hs_monitor *monitor);
+
+/**
+ * @ingroup capture
+ * @brief Send the recorded input reports to the handles opened on the virtual devices.
+ *
+ * This function blocks until every input report has been sent or hs_replay_stop() is called,
+ * so you probably want to call it from a dedicated thread. Reports are never dropped: if an
+ * application falls behind, the replay waits for it and then catches up with the schedule.
+ * Output reports sent by the application are read and discarded.
+ *
+ * @param replay Replay object.
+ * @param speed  Time scale relative to the capture (2.0 replays twice as fast), or 0 to send
+ *     the reports as fast as possible.
+ * @return This function returns the number of input reports sent, or a negative
+ *     @ref hs_error_code value.
+ */
+HS_PUBLIC ssize_t hs_replay_run(hs_replay *replay, double speed);
+/**
+ * @ingroup capture
+ * @brief Interrupt hs_replay_run().
+ *
+ * This function is thread-safe, hs_replay_run() returns within 100 milliseconds.
+ *
+ * @param replay Replay object.
+ */
+HS_PUBLIC void hs_replay_stop(hs_replay *replay);
+
+#endif
+
+HS_END_C
+
+#endif
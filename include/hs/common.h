@@ -142,11 +142,33 @@ typedef enum hs_error_code {
     /** Generic system error. */
     HS_ERROR_SYSTEM        = -5,
     /** Invalid data error. */
-    HS_ERROR_INVALID       = -6
+    HS_ERROR_INVALID       = -6,
+    /** Operation cancelled through a cancel token, see hs_handle_set_cancel_token(). */
+    HS_ERROR_CANCELLED     = -7
 } hs_error_code;
 
 typedef void hs_log_func(hs_log_level level, const char *msg, void *udata);
 
+/**
+ * @ingroup misc
+ * @brief Custom memory allocator, see hs_set_allocator().
+ *
+ * The three functions follow the semantics of malloc(), realloc() and free(): @p alloc and
+ * @p realloc return NULL on failure, @p realloc with a NULL pointer allocates and @p free must
+ * accept NULL.
+ */
+typedef struct hs_allocator {
+    /** Allocate @p size bytes. */
+    void *(*alloc)(size_t size, void *udata);
+    /** Resize the memory block, the content is preserved up to the smallest size. */
+    void *(*realloc)(void *ptr, size_t size, void *udata);
+    /** Release a memory block allocated by @p alloc or @p realloc. */
+    void (*free)(void *ptr, void *udata);
+
+    /** Pointer to user-defined data, passed to the allocator functions. */
+    void *udata;
+} hs_allocator;
+
 /**
  * @{
  * @name Version Functions
@@ -178,6 +200,33 @@ HS_PUBLIC const char *hs_version_string(void);
 
 /** @} */
 
+/**
+ * @{
+ * @name Memory Functions
+ */
+
+/**
+ * @ingroup misc
+ * @brief Route libhs memory allocations through a custom allocator.
+ *
+ * Every allocation made by libhs (devices, handles, monitors, callbacks, buffers and strings)
+ * goes through this allocator. Memory allocated by the system libraries libhs depends on
+ * (libudev, IOKit, SetupAPI) is not affected.
+ *
+ * Call this function before any other libhs function, and don't change the allocator while
+ * libhs objects are alive: memory would be freed with the wrong allocator. Objects libhs keeps
+ * around for reuse are given back to the previous allocator by this call. The structure is
+ * copied, it does not have to outlive the call.
+ *
+ * libhs never calls the allocator from process exit handlers, the memory it still holds at
+ * that point is left to the system.
+ *
+ * @param allocator Allocator functions, or NULL to restore the default malloc-based allocator.
+ */
+HS_PUBLIC void hs_set_allocator(const hs_allocator *allocator);
+
+/** @} */
+
 /**
  * @{
  * @name Log Functions
@@ -188,7 +237,8 @@ HS_PUBLIC const char *hs_version_string(void);
  * @brief Change the log callback function.
  *
  * The default callback prints the message to stderr. It does not print debug messages unless
- * the environment variable LIBHS_DEBUG is set.
+ * the environment variable LIBHS_DEBUG is set, custom callbacks receive them unless you change
+ * the log level with hs_log_set_level().
  *
  * @param f     New repport message callback, or NULL to restore the default one.
  * @param udata Pointer to user-defined data for the callback.
@@ -196,13 +246,34 @@ HS_PUBLIC const char *hs_version_string(void);
  * @sa hs_error()
  */
 HS_PUBLIC void hs_log_redirect(hs_log_func *f, void *udata);
+/**
+ * @ingroup misc
+ * @brief Set the minimum level of logged messages.
+ *
+ * Messages below this level are dropped before they are even formatted. Until you call this
+ * function, the level is HS_LOG_DEBUG if LIBHS_DEBUG is set (it is read once at startup) or if
+ * a custom log callback is used, HS_LOG_WARNING otherwise.
+ *
+ * @param level Minimum log level.
+ *
+ * @sa hs_log_get_level()
+ */
+HS_PUBLIC void hs_log_set_level(hs_log_level level);
+/**
+ * @ingroup misc
+ * @brief Get the minimum level of logged messages.
+ *
+ * @return This function returns the current minimum log level.
+ *
+ * @sa hs_log_set_level()
+ */
+HS_PUBLIC hs_log_level hs_log_get_level(void);
 /**
  * @ingroup misc
  * @brief Call the log callback with a printf-formatted message.
  *
  * Format a message and call the log callback with it. The default callback prints it to stderr,
- * see hs_log_redirect(). This callback does not print debug messages unless the environment
- * variable LIBHS_DEBUG is set.
+ * see hs_log_redirect(). Messages below the log level (see hs_log_set_level()) are ignored.
  *
  * @param level Log level.
  * @param fmt Format string, using printf syntax.
@@ -212,6 +283,35 @@ HS_PUBLIC void hs_log_redirect(hs_log_func *f, void *udata);
  */
 HS_PUBLIC void hs_log(hs_log_level level, const char *fmt, ...) HS_PRINTF_FORMAT(2, 3);
 
+#if defined(__linux__) || defined(__APPLE__)
+/**
+ * @ingroup misc
+ * @brief Hand log messages to a background writer thread.
+ *
+ * Once started, hs_log() and hs_error() copy formatted messages to a lock-free ring and return
+ * without calling the log callback, which then runs in the writer thread. Use this if your
+ * callback is slow (e.g. writes to a file or a socket) and you don't want it to stall I/O.
+ * If the ring is full, messages are dropped and the writer reports how many were lost.
+ *
+ * Calling this function again while the writer is running does nothing.
+ *
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_log_stop_async()
+ */
+HS_PUBLIC int hs_log_start_async(void);
+/**
+ * @ingroup misc
+ * @brief Stop the background log writer.
+ *
+ * Pending messages are passed to the log callback before this function returns, subsequent
+ * messages are logged synchronously again.
+ *
+ * @sa hs_log_start_async()
+ */
+HS_PUBLIC void hs_log_stop_async(void);
+#endif
+
 /** @} */
 
 /**
@@ -236,13 +336,28 @@ HS_PUBLIC void hs_log(hs_log_level level, const char *fmt, ...) HS_PRINTF_FORMAT
  * @endcode
  *
  * The masked codes are kept in a limited stack, you must not forget to unmask codes quickly
- * with @ref hs_error_unmask().
+ * with @ref hs_error_unmask(). Each thread has its own stack, masking a code only affects
+ * errors raised by the calling thread.
+ *
+ * Masked errors are not formatted at all, they are only recorded for hs_error_last_code().
  *
  * @param err Error code to mask.
  *
  * @sa hs_error_unmask()
+ * @sa hs_error_mask_all()
  */
 HS_PUBLIC void hs_error_mask(hs_error_code err);
+/**
+ * @ingroup misc
+ * @brief Mask all error codes.
+ *
+ * Use this around code that expects failures, such as probing devices that may be busy, and
+ * check hs_error_last_code() afterwards if needed. Errors stay cheap: they are neither
+ * formatted nor logged. Call hs_error_unmask() to undo it, like hs_error_mask().
+ *
+ * @sa hs_error_mask()
+ */
+HS_PUBLIC void hs_error_mask_all(void);
 /**
  * @ingroup misc
  * @brief Unmask the last masked error code.
@@ -250,6 +365,32 @@ HS_PUBLIC void hs_error_mask(hs_error_code err);
  * @sa hs_error_mask()
  */
 HS_PUBLIC void hs_error_unmask(void);
+
+/**
+ * @ingroup misc
+ * @brief Get the code of the last error raised by the calling thread.
+ *
+ * Masked errors are recorded too. The value is not reset by successful calls.
+ *
+ * @return This function returns the last @ref hs_error_code value, or 0 if no error occurred
+ *     in this thread.
+ *
+ * @sa hs_error_last_message()
+ */
+HS_PUBLIC int hs_error_last_code(void);
+/**
+ * @ingroup misc
+ * @brief Get the message of the last error raised by the calling thread.
+ *
+ * This is the message passed to the log callback. Masked errors are never formatted, you get
+ * a generic message matching the error code for them (e.g. "I/O error").
+ *
+ * @return This function returns a thread-local string, valid until the next error in this
+ *     thread. It returns an empty string if no error occurred.
+ *
+ * @sa hs_error_last_code()
+ */
+HS_PUBLIC const char *hs_error_last_message(void);
 /**
  * @ingroup misc
  * @brief Call the log callback with a printf-formatted error message.
@@ -256,6 +256,224 @@ HS_PUBLIC hs_device *hs_handle_get_device(const hs_handle *h);
  */
 HS_PUBLIC hs_descriptor hs_handle_get_descriptor(const hs_handle *h);
 
+/**
+ * @ingroup device
+ * @brief Enable or disable read timestamps.
+ *
+ * When enabled, each successful call to hs_hid_read() or hs_serial_read() records the
+ * hs_nanos() time at which the data was obtained from the system, which you can query with
+ * hs_handle_get_read_timestamp(). The clock is read right after the read syscall returns (or
+ * when IOHIDDevice delivers the report on OSX), so it excludes time spent in libhs and in
+ * your own code.
+ *
+ * For serial devices, the timestamp applies to the chunk returned by the system: data that
+ * arrived in one chunk shares the same timestamp.
+ *
+ * Timestamping is disabled by default.
+ *
+ * @param h      Device handle.
+ * @param enable Non-zero to enable timestamps, 0 to disable them.
+ *
+ * @sa hs_nanos()
+ */
+HS_PUBLIC void hs_handle_set_timestamping(hs_handle *h, int enable);
+/**
+ * @ingroup device
+ * @brief Get the timestamp of the last successful read.
+ *
+ * @param h Device handle.
+ * @return This function returns an hs_nanos() value, or 0 if nothing has been read since
+ *     timestamping was enabled.
+ *
+ * @sa hs_handle_set_timestamping()
+ */
+HS_PUBLIC uint64_t hs_handle_get_read_timestamp(const hs_handle *h);
+
+/**
+ * @ingroup device
+ * @brief Number of buckets in the @ref hs_handle_stats histograms.
+ */
+#define HS_HANDLE_STATS_BUCKETS 32
+
+/**
+ * @ingroup device
+ * @brief I/O statistics of a device handle.
+ *
+ * Reads and writes are counted at the system level: serial data served from the receive buffer
+ * (see hs_serial_read_until()) does not count as a read.
+ *
+ * Histogram bucket 0 counts durations under 1 µs, bucket i counts durations between
+ * 2^(i - 1) and 2^i µs, and the last bucket also counts everything above.
+ *
+ * Counters are updated atomically: you can read and write from different threads, and call
+ * hs_handle_get_stats() at any time. A snapshot taken during I/O is not consistent across
+ * counters (e.g. reads and read_bytes may be one call apart).
+ *
+ * @sa hs_handle_set_stats()
+ */
+typedef struct hs_handle_stats {
+    /** Successful reads (reports for HID devices, chunks for serial devices). */
+    uint64_t reads;
+    /** Bytes read. */
+    uint64_t read_bytes;
+    /** Successful writes. */
+    uint64_t writes;
+    /** Bytes written. */
+    uint64_t written_bytes;
+
+    /** Reads and writes that would have blocked (EAGAIN and equivalents). */
+    uint64_t eagain;
+    /** Writes that transferred only part of the data. */
+    uint64_t partial_writes;
+    /** Failed reads and writes, cancellation excluded. */
+    uint64_t errors;
+    /** Times the device was reported ready but no data could be read. */
+    uint64_t empty_wakeups;
+
+    /** Time between the start of each successful read and the data becoming available. */
+    uint64_t read_wait[HS_HANDLE_STATS_BUCKETS];
+    /** Duration of each successful write. */
+    uint64_t write_time[HS_HANDLE_STATS_BUCKETS];
+} hs_handle_stats;
+
+/**
+ * @ingroup device
+ * @brief Enable or disable I/O statistics.
+ *
+ * Statistics are disabled by default, and cost a pointer test per I/O call in this state.
+ * When enabled, each read and write also reads the hs_nanos() clock twice. Disabling them
+ * discards the collected data.
+ *
+ * Unlike the other statistics functions, this one must not be called while another thread
+ * is using the handle.
+ *
+ * @param h      Device handle.
+ * @param enable Non-zero to enable statistics, 0 to disable them.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_handle_get_stats()
+ */
+HS_PUBLIC int hs_handle_set_stats(hs_handle *h, int enable);
+/**
+ * @ingroup device
+ * @brief Get the I/O statistics collected so far.
+ *
+ * @param      h      Device handle.
+ * @param[out] rstats Statistics, zeroed if they are not enabled.
+ *
+ * @sa hs_handle_set_stats()
+ * @sa hs_handle_reset_stats()
+ */
+HS_PUBLIC void hs_handle_get_stats(const hs_handle *h, hs_handle_stats *rstats);
+/**
+ * @ingroup device
+ * @brief Reset the I/O statistics.
+ *
+ * This can be called while other threads perform I/O on the handle, each counter is cleared
+ * atomically but the reset is not atomic as a whole.
+ *
+ * @param h Device handle.
+ *
+ * @sa hs_handle_get_stats()
+ */
+HS_PUBLIC void hs_handle_reset_stats(hs_handle *h);
+
+#if defined(__linux__) || defined(__APPLE__)
+
+/**
+  * @{
+  * @name Cancellation Functions
+  */
+
+/**
+ * @ingroup device
+ * @typedef hs_cancel_token
+ * @brief Opaque token used to interrupt blocking reads and writes.
+ *
+ * Once triggered, any read or write blocked on a handle bound to the token (see
+ * hs_handle_set_cancel_token()) returns @ref HS_ERROR_CANCELLED promptly, and so do new calls
+ * until the token is reset. Triggering is sticky and thread-safe, you can share one token
+ * between many handles.
+ *
+ * Only the waiting part is interruptible: a write() that the kernel is already executing (this
+ * happens with hidraw devices, which do not support non-blocking writes) runs to completion.
+ */
+typedef struct hs_cancel_token hs_cancel_token;
+
+/**
+ * @ingroup device
+ * @brief Create a new cancel token.
+ *
+ * @param[out] rtoken A pointer to the variable that receives the token, it will stay
+ *     unchanged if the function fails.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_cancel_token_free()
+ */
+HS_PUBLIC int hs_cancel_token_new(hs_cancel_token **rtoken);
+/**
+ * @ingroup device
+ * @brief Free a cancel token.
+ *
+ * Unbind the token from all handles before you free it.
+ *
+ * @param token Cancel token.
+ */
+HS_PUBLIC void hs_cancel_token_free(hs_cancel_token *token);
+
+/**
+ * @ingroup device
+ * @brief Get a pollable descriptor that becomes ready when the token is triggered.
+ *
+ * Use it to include cancellation in your own event loop. Do not read from it.
+ *
+ * @param token Cancel token.
+ * @return This function returns a pollable descriptor.
+ */
+HS_PUBLIC hs_descriptor hs_cancel_token_get_descriptor(const hs_cancel_token *token);
+
+/**
+ * @ingroup device
+ * @brief Trigger the token and wake up blocked operations.
+ *
+ * This function is async-signal-safe and can be called from any thread.
+ *
+ * @param token Cancel token.
+ */
+HS_PUBLIC void hs_cancel_token_trigger(hs_cancel_token *token);
+/**
+ * @ingroup device
+ * @brief Reset a triggered token so that it can be reused.
+ *
+ * Do not call this concurrently with hs_cancel_token_trigger().
+ *
+ * @param token Cancel token.
+ */
+HS_PUBLIC void hs_cancel_token_reset(hs_cancel_token *token);
+/**
+ * @ingroup device
+ * @brief Test whether the token has been triggered.
+ *
+ * @param token Cancel token.
+ * @return This function returns 1 if the token is triggered, 0 otherwise.
+ */
+HS_PUBLIC int hs_cancel_token_is_triggered(const hs_cancel_token *token);
+
+/**
+ * @ingroup device
+ * @brief Bind a cancel token to a device handle.
+ *
+ * Blocking reads and writes on this handle wait on both the device and the token, and
+ * fail with @ref HS_ERROR_CANCELLED (without logging an error) when the token is triggered.
+ * Pass NULL to unbind the current token.
+ *
+ * @param h     Device handle.
+ * @param token Cancel token, or NULL.
+ */
+HS_PUBLIC void hs_handle_set_cancel_token(hs_handle *h, hs_cancel_token *token);
+
+#endif
+
 HS_END_C
 
 #endif
@@ -75,6 +75,9 @@ HS_PUBLIC int hs_hid_parse_descriptor(struct hs_handle *h, hs_hid_descriptor *de
  * If no report is available, the function waits for up to @p timeout milliseconds. Use a
  * negative value to wait indefinitely.
  *
+ * This function does not allocate memory, unless a capture is attached to the handle (see
+ * hs_handle_set_capture()).
+ *
  * @param      h       Device handle.
  * @param[out] buf     Input report buffer.
  * @param      size    Size of the report buffer (make room for the report ID).
@@ -88,7 +91,8 @@ HS_PUBLIC ssize_t hs_hid_read(struct hs_handle *h, uint8_t *buf, size_t size, in
  * @ingroup hid
  * @brief Send an output report to the device.
  *
- * The first byte must be the report ID, or 0 if the device does not use report IDs.
+ * The first byte must be the report ID, or 0 if the device does not use report IDs. Like
+ * hs_hid_read(), this function does not allocate memory.
  *
  * @param h    Device handle.
  * @param buf  Output report data.
@@ -130,6 +134,124 @@ HS_PUBLIC ssize_t hs_hid_get_feature_report(hs_handle *h, uint8_t report_id, uin
  */
 HS_PUBLIC ssize_t hs_hid_send_feature_report(struct hs_handle *h, const uint8_t *buf, size_t size);
 
+#if defined(__linux__) || defined(__APPLE__)
+/**
+ * @ingroup hid
+ * @brief Opaque structure representing an asynchronous HID write queue.
+ *
+ * On Linux, O_NONBLOCK is not honoured for hidraw writes and USB requests can block for up to
+ * 5000 ms. The write queue moves hs_hid_write() calls to a dedicated writer thread, so that
+ * a stalled device does not block your event loop.
+ *
+ * @sa hs_hid_write_queue_new()
+ */
+typedef struct hs_hid_write_queue hs_hid_write_queue;
+
+/**
+ * @ingroup hid
+ * @brief Result of a queued output report.
+ *
+ * @sa hs_hid_write_queue_reap()
+ */
+typedef struct hs_hid_write_completion {
+    /** Value passed to hs_hid_write_queue_push() for this report. */
+    void *udata;
+    /** Value returned by hs_hid_write(), or 0 if the report expired before it was sent. */
+    ssize_t r;
+} hs_hid_write_completion;
+
+/**
+ * @ingroup hid
+ * @brief Create an asynchronous write queue for a HID device.
+ *
+ * A writer thread is started for the queue. Output reports are sent in order, and completions
+ * are signalled through a pollable descriptor, see hs_hid_write_queue_get_descriptor().
+ *
+ * The handle must stay open until the queue is freed. You can keep using hs_hid_read() and
+ * the feature report functions on the handle in the meantime.
+ *
+ * @param      h      Device handle.
+ * @param      depth  Maximum number of reports that can be queued or waiting to be reaped.
+ * @param[out] rqueue A pointer to the variable that receives the write queue, it will stay
+ *     unchanged if the function fails.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_hid_write_queue_free()
+ */
+HS_PUBLIC int hs_hid_write_queue_new(struct hs_handle *h, unsigned int depth,
+                                     hs_hid_write_queue **rqueue);
+/**
+ * @ingroup hid
+ * @brief Stop the writer thread and free the write queue.
+ *
+ * Reports that have not been sent yet are dropped. If a report is being written, this
+ * function waits for the write to return.
+ *
+ * @param queue Write queue.
+ */
+HS_PUBLIC void hs_hid_write_queue_free(hs_hid_write_queue *queue);
+
+/**
+ * @ingroup hid
+ * @brief Get a pollable descriptor for write completions.
+ *
+ * The descriptor becomes readable when completed reports are waiting to be reaped, and stays
+ * readable until hs_hid_write_queue_reap() has consumed all of them.
+ *
+ * @param queue Write queue.
+ * @return This function returns a pollable descriptor.
+ *
+ * @sa hs_hid_write_queue_reap()
+ */
+HS_PUBLIC hs_descriptor hs_hid_write_queue_get_descriptor(const hs_hid_write_queue *queue);
+
+/**
+ * @ingroup hid
+ * @brief Queue an output report.
+ *
+ * The report is copied and the function returns immediately. The first byte must be the report
+ * ID, or 0 if the device does not use report IDs.
+ *
+ * If the writer thread does not get to the report within @p timeout milliseconds (for example
+ * because a previous write is stalled), the report is dropped and completed with a result of 0.
+ * A write that has already started cannot be interrupted.
+ *
+ * @param queue   Write queue.
+ * @param buf     Output report data.
+ * @param size    Output report size (including the report ID byte).
+ * @param timeout Timeout in milliseconds, or -1 to wait indefinitely.
+ * @param udata   Pointer to user-defined arbitrary data, returned with the completion.
+ * @return This function returns 1 if the report was queued, 0 if the queue is full, or a
+ *     negative @ref hs_error_code value.
+ *
+ * @sa hs_hid_write_queue_reap()
+ */
+HS_PUBLIC int hs_hid_write_queue_push(hs_hid_write_queue *queue, const uint8_t *buf, size_t size,
+                                      int timeout, void *udata);
+/**
+ * @ingroup hid
+ * @brief Get the results of completed reports.
+ *
+ * Completions are returned in the order the reports were queued. This function does not block.
+ * Reaping completions frees slots in the queue.
+ *
+ * @param      queue       Write queue.
+ * @param[out] completions Array that receives the completions.
+ * @param      count       Maximum number of completions to reap.
+ * @return This function returns the number of completions reaped.
+ */
+HS_PUBLIC int hs_hid_write_queue_reap(hs_hid_write_queue *queue,
+                                      hs_hid_write_completion *completions, unsigned int count);
+/**
+ * @ingroup hid
+ * @brief Get the number of reports that have not been sent yet.
+ *
+ * @param queue Write queue.
+ * @return This function returns the number of queued reports, including the one being written.
+ */
+HS_PUBLIC unsigned int hs_hid_write_queue_get_pending(hs_hid_write_queue *queue);
+#endif
+
 HS_END_C
 
 #endif
@@ -0,0 +1,213 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef HS_IO_H
+#define HS_IO_H
+
+#include "common.h"
+
+HS_BEGIN_C
+
+#ifdef __linux__
+
+/**
+ * @defgroup io Batched I/O
+ * @brief Submit reads and writes for many device handles and reap completions in bulk.
+ *
+ * hs_hid_read(), hs_serial_read() and friends perform one poll() and one read() or write()
+ * per call. When you manage many handles, the I/O engine lets you queue reads and writes on
+ * all of them, submit them in one batch and collect the results as they complete.
+ *
+ * The engine uses io_uring when the kernel supports it, and falls back to an epoll-based
+ * implementation otherwise. Both backends give the same results.
+ */
+
+struct hs_handle;
+
+/**
+ * @ingroup io
+ * @brief Opaque structure representing an I/O engine.
+ */
+typedef struct hs_io_engine hs_io_engine;
+
+/**
+ * @ingroup io
+ * @brief I/O engine backends.
+ *
+ * @sa hs_io_engine_new()
+ */
+typedef enum hs_io_backend {
+    /** Use io_uring if available, epoll otherwise. */
+    HS_IO_BACKEND_AUTO,
+    /** Use io_uring, fail if it is not available. */
+    HS_IO_BACKEND_URING,
+    /** Use epoll and non-blocking reads and writes. */
+    HS_IO_BACKEND_EPOLL
+} hs_io_backend;
+
+/**
+ * @ingroup io
+ * @brief I/O operation types.
+ */
+typedef enum hs_io_op {
+    /** Read an input report (HID) or bytes (serial). */
+    HS_IO_READ,
+    /** Write an output report (HID) or bytes (serial). */
+    HS_IO_WRITE
+} hs_io_op;
+
+/**
+ * @ingroup io
+ * @brief Result of a completed I/O operation.
+ *
+ * @sa hs_io_engine_reap()
+ */
+typedef struct hs_io_completion {
+    /** Device handle passed when the operation was queued. */
+    struct hs_handle *h;
+    /** Operation type. */
+    hs_io_op op;
+    /** Value passed when the operation was queued. */
+    void *udata;
+    /** Same as the matching synchronous function (e.g. hs_hid_read()), or a negative
+        @ref hs_error_code value. */
+    ssize_t r;
+} hs_io_completion;
+
+/**
+ * @ingroup io
+ * @brief Create a new I/O engine.
+ *
+ * @param      backend Backend to use, see @ref hs_io_backend.
+ * @param      depth   Maximum number of operations in flight.
+ * @param[out] rengine A pointer to the variable that receives the I/O engine, it will stay
+ *     unchanged if the function fails.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_io_engine_free()
+ */
+HS_PUBLIC int hs_io_engine_new(hs_io_backend backend, unsigned int depth, hs_io_engine **rengine);
+/**
+ * @ingroup io
+ * @brief Free an I/O engine.
+ *
+ * Operations that have not completed are cancelled. With io_uring, the function waits for
+ * the kernel to acknowledge the cancellations, so buffers and handles can be released as soon
+ * as it returns.
+ *
+ * @param engine I/O engine.
+ */
+HS_PUBLIC void hs_io_engine_free(hs_io_engine *engine);
+
+/**
+ * @ingroup io
+ * @brief Get the backend used by an I/O engine.
+ *
+ * @param engine I/O engine.
+ * @return This function returns HS_IO_BACKEND_URING or HS_IO_BACKEND_EPOLL.
+ */
+HS_PUBLIC hs_io_backend hs_io_engine_get_backend(const hs_io_engine *engine);
+/**
+ * @ingroup io
+ * @brief Get a pollable descriptor for I/O completions.
+ *
+ * The descriptor becomes readable when hs_io_engine_reap() has something to do. Operations
+ * must have been submitted first, see hs_io_engine_submit().
+ *
+ * @param engine I/O engine.
+ * @return This function returns a pollable descriptor.
+ */
+HS_PUBLIC hs_descriptor hs_io_engine_get_descriptor(const hs_io_engine *engine);
+
+/**
+ * @ingroup io
+ * @brief Queue a read on a device handle.
+ *
+ * The read completes when the device has data, there is no timeout. The HID report ID
+ * rules are the same as for hs_hid_read(). The buffer must remain valid until the
+ * operation completes.
+ *
+ * The operation is only sent to the kernel by hs_io_engine_submit() or hs_io_engine_reap().
+ *
+ * @param engine I/O engine.
+ * @param h      Device handle, it must stay open until the operation completes.
+ * @param buf    Data buffer.
+ * @param size   Size of the buffer.
+ * @param udata  Pointer to user-defined arbitrary data, returned with the completion.
+ * @return This function returns 1 if the operation was queued, 0 if too many operations
+ *     are in flight, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_io_engine_queue_read(hs_io_engine *engine, struct hs_handle *h, uint8_t *buf,
+                                      size_t size, void *udata);
+/**
+ * @ingroup io
+ * @brief Queue a write on a device handle.
+ *
+ * The HID report ID rules are the same as for hs_hid_write(). Serial writes may be
+ * partial, like hs_serial_write(). The buffer must remain valid until the operation completes.
+ *
+ * The operation is only sent to the kernel by hs_io_engine_submit() or hs_io_engine_reap().
+ *
+ * @param engine I/O engine.
+ * @param h      Device handle, it must stay open until the operation completes.
+ * @param buf    Data buffer.
+ * @param size   Size of the buffer.
+ * @param udata  Pointer to user-defined arbitrary data, returned with the completion.
+ * @return This function returns 1 if the operation was queued, 0 if too many operations
+ *     are in flight, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_io_engine_queue_write(hs_io_engine *engine, struct hs_handle *h,
+                                       const uint8_t *buf, size_t size, void *udata);
+
+/**
+ * @ingroup io
+ * @brief Submit queued operations.
+ *
+ * With io_uring, all the queued operations are submitted with a single system call.
+ *
+ * @param engine I/O engine.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_io_engine_submit(hs_io_engine *engine);
+/**
+ * @ingroup io
+ * @brief Submit queued operations and get the completed ones.
+ *
+ * If no operation has completed, the function waits for up to @p timeout milliseconds.
+ *
+ * @param      engine      I/O engine.
+ * @param[out] completions Array that receives the completions.
+ * @param      count       Maximum number of completions to reap.
+ * @param      timeout     Timeout in milliseconds, or -1 to block indefinitely.
+ * @return This function returns the number of completions, 0 on timeout, or a negative
+ *     @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_io_engine_reap(hs_io_engine *engine, hs_io_completion *completions,
+                                unsigned int count, int timeout);
+
+#endif
+
+HS_END_C
+
+#endif
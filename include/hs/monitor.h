@@ -35,6 +35,7 @@ HS_BEGIN_C
  */
 
 struct hs_device;
+struct hs_handle;
 
 /**
  * @ingroup monitor
@@ -159,6 +160,50 @@ HS_PUBLIC int hs_monitor_register_callback(hs_monitor *monitor, hs_monitor_callb
  */
 HS_PUBLIC void hs_monitor_deregister_callback(hs_monitor *monitor, int id);
 
+/**
+ * @ingroup monitor
+ * @brief Keep a device handle open across disconnections.
+ *
+ * When the device behind a registered handle disappears, the handle stays valid: the descriptor
+ * number returned by hs_handle_get_descriptor() does not change but never becomes ready, reads
+ * time out and writes fail with @ref HS_ERROR_IO. When a matching device reappears (same serial
+ * number if the device has one, same location otherwise), hs_monitor_refresh() reopens it in
+ * place before calling the event callbacks, and hs_handle_get_device() returns the new device.
+ *
+ * @warning The descriptor number is reused but it refers to a different file after the device
+ * is reopened, so the kernel drops it from epoll and kqueue sets. hs_poller and hs_io_engine
+ * add it back automatically. If you monitor it with your own epoll or kqueue set, remove and
+ * add the descriptor again after each reconnection (for example from a monitor callback).
+ * hs_poll() and hs_descriptor_set are not affected.
+ *
+ * Serial settings (including custom baud rates, batching and low-latency mode) are reapplied
+ * automatically. The modem line watcher (hs_serial_watch_lines()) is stopped on disconnection
+ * and is not restarted. Buffered receive data is preserved.
+ *
+ * Reconnection happens inside hs_monitor_refresh(), you must not use the handle from another
+ * thread at the same time.
+ *
+ * Handles are deregistered automatically when they are closed.
+ *
+ * @param monitor Device monitor.
+ * @param h       Device handle.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value. Only
+ *     Linux devices and POSIX serial devices support this for now.
+ *
+ * @sa hs_monitor_deregister_handle()
+ */
+HS_PUBLIC int hs_monitor_register_handle(hs_monitor *monitor, struct hs_handle *h);
+/**
+ * @ingroup monitor
+ * @brief Stop reconnecting a device handle.
+ *
+ * @param monitor Device monitor.
+ * @param h       Device handle, registered with hs_monitor_register_handle().
+ *
+ * @sa hs_monitor_register_handle()
+ */
+HS_PUBLIC void hs_monitor_deregister_handle(hs_monitor *monitor, struct hs_handle *h);
+
 /**
  * @ingroup monitor
  * @brief Refresh the device list and fire device change events.
@@ -168,6 +213,10 @@ HS_PUBLIC void hs_monitor_deregister_callback(hs_monitor *monitor, int id);
  *
  * This function is non-blocking.
  *
+ * Events for devices the monitor already knows about (such as spurious add or change events)
+ * are dropped before any allocation takes place. On Linux, libudev still allocates memory to
+ * receive each event, this does not apply to monitors replaying a trace.
+ *
  * @param monitor Device monitor.
  * @return This function returns 0 on success, or a negative @ref hs_error_code value. If a
  *     callback returns a non-zero value, the refresh is interrupted and the value is returned.
@@ -177,6 +226,56 @@ HS_PUBLIC void hs_monitor_deregister_callback(hs_monitor *monitor, int id);
  */
 HS_PUBLIC int hs_monitor_refresh(hs_monitor *monitor);
 
+/**
+ * @ingroup monitor
+ * @brief Device monitor statistics.
+ *
+ * Event counters and timers are only collected when libhs is built with the
+ * LIBHS_MONITOR_STATS option, they stay at 0 otherwise. Times are in nanoseconds. The receive
+ * and inspection timers are only implemented on Linux for now.
+ *
+ * Device table statistics are computed when you call hs_monitor_get_stats() and are always
+ * available.
+ *
+ * @sa hs_monitor_get_stats()
+ */
+typedef struct hs_monitor_stats {
+    /** Device events received from the system. */
+    uint64_t events;
+    /** Events ignored because of their type, or because the device is not supported. */
+    uint64_t events_ignored;
+    /** Time spent receiving events (udev_monitor_receive_device() on Linux). */
+    uint64_t receive_time;
+    /** Time spent collecting device information. */
+    uint64_t inspect_time;
+    /** Time spent in the event callbacks. */
+    uint64_t callback_time;
+    /** Memory allocations made by libhs for device objects. */
+    uint64_t allocations;
+
+    /** Number of devices in the device table. */
+    unsigned int devices;
+    /** Number of buckets in the device table. */
+    unsigned int buckets;
+    /** Number of non-empty buckets. */
+    unsigned int used_buckets;
+    /** Length of the longest bucket chain. */
+    unsigned int max_chain;
+} hs_monitor_stats;
+
+/**
+ * @ingroup monitor
+ * @brief Get device monitor statistics.
+ *
+ * @param      monitor Device monitor.
+ * @param[out] rstats  Statistics.
+ * @return This function returns 1 if event statistics are collected (LIBHS_MONITOR_STATS
+ *     build option), or 0 if only the device table statistics are available.
+ *
+ * @sa hs_monitor_stats
+ */
+HS_PUBLIC int hs_monitor_get_stats(const hs_monitor *monitor, hs_monitor_stats *rstats);
+
 /**
  * @ingroup monitor
  * @brief Enumerate the currently known devices.
@@ -197,6 +296,64 @@ HS_PUBLIC int hs_monitor_refresh(hs_monitor *monitor);
  */
 HS_PUBLIC int hs_monitor_list(hs_monitor *monitor, hs_monitor_callback_func *f, void *udata);
 
+#ifdef __linux__
+
+/**
+ * @ingroup monitor
+ * @brief Record the device events processed by a monitor to a trace file.
+ *
+ * The trace starts with the devices present when you call this function, followed by each
+ * event read by hs_monitor_refresh() and the udev and sysfs attributes libhs looked at to
+ * handle it. Replay it with hs_monitor_new_from_trace() to reproduce hotplug storms (hub power
+ * cycles, mass flashing) without the hardware.
+ *
+ * Monitors created with hs_monitor_new_from_trace() cannot be traced.
+ *
+ * @param monitor  Device monitor.
+ * @param filename Path of the trace file, it is truncated if it exists.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_monitor_stop_trace()
+ */
+HS_PUBLIC int hs_monitor_start_trace(hs_monitor *monitor, const char *filename);
+/**
+ * @ingroup monitor
+ * @brief Stop recording device events and close the trace file.
+ *
+ * Write errors do not interrupt the monitor, they are reported here instead.
+ *
+ * @param monitor Device monitor.
+ * @return This function returns 0 on success (or if no trace was running), or a negative
+ *     @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_monitor_stop_trace(hs_monitor *monitor);
+
+/**
+ * @ingroup monitor
+ * @brief Open a device monitor that replays a trace file.
+ *
+ * The monitor behaves like a normal device monitor, but its events come from the trace
+ * recorded by hs_monitor_start_trace() instead of udev, and device information comes from the
+ * attributes saved in the trace instead of sysfs. The devices present when the trace was
+ * started are listed right away.
+ *
+ * The descriptor returned by hs_monitor_get_descriptor() becomes ready when recorded events
+ * are due, and hs_monitor_refresh() processes all the due events at once. Device paths point
+ * to the recorded device nodes, which may not exist anymore.
+ *
+ * @param      filename Path of the trace file.
+ * @param      speed    Time scale relative to the trace (2.0 replays twice as fast), or 0 to
+ *     make all the events due immediately.
+ * @param[out] rmonitor A pointer to the variable that receives the device monitor, it will stay
+ *     unchanged if the function fails.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *     HS_ERROR_INVALID is returned if the file is not a valid trace file.
+ */
+HS_PUBLIC int hs_monitor_new_from_trace(const char *filename, double speed,
+                                        hs_monitor **rmonitor);
+
+#endif
+
 HS_END_C
 
 #endif
@@ -65,6 +65,8 @@ enum hs_win32_release {
  * You can manipulate this structure directly but helper functions are also provided. It is
  * required to set hs->count to 0 initially.
  *
+ * On Linux, use @ref hs_poller instead if you need more than 64 descriptors.
+ *
  * @sa hs_descriptor
  * @sa hs_descriptor_set_clear()
  * @sa hs_descriptor_set_add()
@@ -81,6 +83,22 @@ typedef struct hs_descriptor_set {
     int id[64];
 } hs_descriptor_set;
 
+#ifdef __linux__
+/**
+ * @ingroup misc
+ * @brief Opaque structure representing a persistent descriptor poller.
+ *
+ * Unlike @ref hs_descriptor_set, the poller keeps its descriptors registered with the kernel
+ * (it uses epoll) between calls. It has no limit on the number of descriptors, adding and
+ * removing descriptors does not depend on how many are registered, and hs_poller_wait()
+ * returns all the ready descriptors at once. Handles registered with
+ * hs_monitor_register_handle() stay in the poller when their device is reopened.
+ *
+ * @sa hs_poller_new()
+ */
+typedef struct hs_poller hs_poller;
+#endif
+
 /**
  * @{
  * @name System Functions
@@ -99,6 +117,19 @@ typedef struct hs_descriptor_set {
  * @return This function returns a mononotic time value in milliseconds.
  */
 HS_PUBLIC uint64_t hs_millis(void);
+/**
+ * @ingroup misc
+ * @brief Get time from a monotonic clock, in nanoseconds.
+ *
+ * This uses CLOCK_MONOTONIC on POSIX systems (mach_absolute_time() on OSX), and
+ * QueryPerformanceCounter() on Windows. It is the time source used for read timestamps, see
+ * hs_handle_set_timestamping(), so you can compare them with values returned by this function.
+ *
+ * Unlike hs_millis(), the resolution is usually under a microsecond on all platforms.
+ *
+ * @return This function returns a mononotic time value in nanoseconds.
+ */
+HS_PUBLIC uint64_t hs_nanos(void);
 
 /**
  * @ingroup misc
@@ -243,6 +274,91 @@ HS_PUBLIC void hs_descriptor_set_remove(hs_descriptor_set *set, int id);
  */
 HS_PUBLIC int hs_poll(const hs_descriptor_set *set, int timeout);
 
+#ifdef __linux__
+/**
+ * @ingroup misc
+ * @brief Create a new descriptor poller.
+ *
+ * @param[out] rpoller A pointer to the variable that receives the poller, it will stay
+ *     unchanged if the function fails.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_poller
+ * @sa hs_poller_free()
+ */
+HS_PUBLIC int hs_poller_new(hs_poller **rpoller);
+/**
+ * @ingroup misc
+ * @brief Free a descriptor poller.
+ *
+ * The descriptors themselves are not closed.
+ *
+ * @param poller Descriptor poller.
+ */
+HS_PUBLIC void hs_poller_free(hs_poller *poller);
+
+/**
+ * @ingroup misc
+ * @brief Get a pollable descriptor for the poller itself.
+ *
+ * This descriptor becomes readable when one of the registered descriptors is readable, so
+ * you can nest the poller in another event loop.
+ *
+ * @param poller Descriptor poller.
+ * @return This function returns a pollable descriptor.
+ */
+HS_PUBLIC hs_descriptor hs_poller_get_descriptor(const hs_poller *poller);
+
+/**
+ * @ingroup misc
+ * @brief Register a descriptor with the poller.
+ *
+ * Each descriptor can only be registered once. Remove descriptors from the poller before you
+ * close them.
+ *
+ * @param poller Descriptor poller.
+ * @param desc   Descriptor.
+ * @param id     Value returned by hs_poller_wait() when this descriptor becomes readable. This
+ *     value does not need to be unique.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_poller_remove()
+ */
+HS_PUBLIC int hs_poller_add(hs_poller *poller, hs_descriptor desc, int id);
+/**
+ * @ingroup misc
+ * @brief Remove a descriptor from the poller.
+ *
+ * Removing a descriptor that is not registered does nothing.
+ *
+ * @param poller Descriptor poller.
+ * @param desc   Descriptor to remove.
+ *
+ * @sa hs_poller_add()
+ */
+HS_PUBLIC void hs_poller_remove(hs_poller *poller, hs_descriptor desc);
+
+/**
+ * @ingroup misc
+ * @brief Wait for readable descriptors.
+ *
+ * The IDs of all the readable descriptors are stored in @p ids, up to @p count of them.
+ * Descriptors that become readable or hang up are reported until the condition is cleared.
+ *
+ * When more than @p count descriptors are ready, the remaining ones are reported first by the
+ * next call, and the ones that are still readable after that come last. This way a busy
+ * descriptor cannot starve the others, whatever its position in the poller.
+ *
+ * @param      poller  Descriptor poller.
+ * @param[out] ids     Array that receives the IDs of the readable descriptors.
+ * @param      count   Size of the @p ids array.
+ * @param      timeout Timeout in milliseconds, or -1 to block indefinitely.
+ * @return This function returns the number of readable descriptors, 0 on timeout, or a
+ *     negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_poller_wait(hs_poller *poller, int *ids, unsigned int count, int timeout);
+#endif
+
 HS_END_C
 
 #endif
@@ -38,7 +38,22 @@ struct hs_handle;
 
 /**
  * @ingroup serial
- * @brief Supported serial baud rates.
+ * @brief Buffer descriptor for hs_serial_writev().
+ */
+typedef struct hs_serial_iovec {
+    /** Data buffer. */
+    const uint8_t *buf;
+    /** Size of the buffer. */
+    size_t size;
+} hs_serial_iovec;
+
+/**
+ * @ingroup serial
+ * @brief Common serial baud rates.
+ *
+ * These rates are supported on all platforms, except for the ones above 115200 which depend
+ * on the device and driver. On Linux and OSX, hs_serial_set_attributes() also accepts any other
+ * integer rate.
  *
  * @sa hs_serial_set_attributes()
  */
@@ -72,7 +87,21 @@ enum hs_serial_rate {
     /** 57600 bps. */
     HS_SERIAL_RATE_57600  = 57600,
     /** 115200 bps. */
-    HS_SERIAL_RATE_115200 = 115200
+    HS_SERIAL_RATE_115200 = 115200,
+    /** 230400 bps. */
+    HS_SERIAL_RATE_230400 = 230400,
+    /** 460800 bps. */
+    HS_SERIAL_RATE_460800 = 460800,
+    /** 921600 bps. */
+    HS_SERIAL_RATE_921600 = 921600,
+    /** 1 Mbps. */
+    HS_SERIAL_RATE_1000000 = 1000000,
+    /** 2 Mbps. */
+    HS_SERIAL_RATE_2000000 = 2000000,
+    /** 3 Mbps. */
+    HS_SERIAL_RATE_3000000 = 3000000,
+    /** 12 Mbps. */
+    HS_SERIAL_RATE_12000000 = 12000000
 };
 
 /**
@@ -124,6 +153,10 @@ enum hs_serial_flag {
  *
  * The change is carried out immediately, before the buffers are emptied.
  *
+ * Rates that have no standard termios constant are set with termios2 (BOTHER) on Linux and
+ * IOSSIOSPEED on OSX. On Windows, the rate is passed to the driver as is. If the device or the
+ * platform cannot use the rate, the function fails with @ref HS_ERROR_INVALID.
+ *
  * @param h     Open serial device handle.
  * @param rate  Serial baud rate, see @ref hs_serial_rate.
  * @param flags Serial connection settings, see @ref hs_serial_flag.
@@ -134,6 +167,56 @@ enum hs_serial_flag {
  */
 HS_PUBLIC int hs_serial_set_attributes(struct hs_handle *h, uint32_t rate, int flags);
 
+#if defined(__linux__) || defined(__APPLE__)
+
+/**
+ * @ingroup serial
+ * @brief Enable or disable the driver low-latency mode.
+ *
+ * On Linux, this toggles ASYNC_LOW_LATENCY with TIOCSSERIAL. Drivers that honour it (e.g.
+ * ftdi_sio, which drops its latency timer to 1 ms) push received bytes to the TTY layer
+ * immediately instead of batching them. Drivers that do not support the ioctls are silently
+ * ignored. This function does nothing on OSX.
+ *
+ * @param h      Open serial device handle.
+ * @param enable Non-zero to enable low-latency mode, 0 to disable it.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_serial_set_low_latency(struct hs_handle *h, int enable);
+/**
+ * @ingroup serial
+ * @brief Change the VMIN and VTIME termios settings.
+ *
+ * By default, libhs uses VMIN = 1 and VTIME = 0, so reads complete as soon as one byte is
+ * available. Throughput-oriented code can raise VMIN (with VTIME = 0): the device descriptor
+ * only becomes readable once VMIN bytes are buffered, which reduces wakeups. VTIME is the
+ * inter-byte timer, in tenths of seconds, used by the terminal layer. On Linux, a non-zero
+ * VTIME makes the descriptor readable as soon as one byte is available.
+ *
+ * The values are kept and reapplied by hs_serial_set_attributes().
+ *
+ * @param h     Open serial device handle.
+ * @param vmin  VMIN value, between 0 and 255.
+ * @param vtime VTIME value, between 0 and 255.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_serial_set_batching(struct hs_handle *h, unsigned int vmin, unsigned int vtime);
+/**
+ * @ingroup serial
+ * @brief Spin with non-blocking reads before blocking in poll().
+ *
+ * When a read function would wait for data, it first retries non-blocking reads for up to
+ * @p budget microseconds. This trades CPU time for latency on request/response links, where
+ * the answer usually comes back in less time than it takes to wake up a sleeping thread. The
+ * spin time counts against the read timeout. Use 0 (the default) to disable spinning.
+ *
+ * @param h      Open serial device handle.
+ * @param budget Maximum spin time per read call, in microseconds.
+ */
+HS_PUBLIC void hs_serial_set_spin_budget(struct hs_handle *h, unsigned int budget);
+
+#endif
+
 /**
  * @ingroup serial
  * @brief Read bytes from a serial device.
@@ -141,6 +224,9 @@ HS_PUBLIC int hs_serial_set_attributes(struct hs_handle *h, uint32_t rate, int f
  * Read up to @p size bytes from the serial device. If no data is available, the function
  * waits for up to @p timeout milliseconds. Use a negative value to wait indefinitely.
  *
+ * The receive buffer is allocated by the first read, subsequent calls (and hs_serial_write())
+ * do not touch the heap.
+ *
  * @param      h       Device handle.
  * @param[out] buf     Data buffer.
  * @param      size    Size of the buffer.
@@ -148,12 +234,363 @@ HS_PUBLIC int hs_serial_set_attributes(struct hs_handle *h, uint32_t rate, int f
  * @return This function returns the number of bytes read, or a negative @ref hs_error_code value.
  */
 HS_PUBLIC ssize_t hs_serial_read(struct hs_handle *h, uint8_t *buf, size_t size, int timeout);
+
+#if defined(__linux__) || defined(__APPLE__)
+
+/**
+ * @ingroup serial
+ * @brief Read bytes up to and including a delimiter.
+ *
+ * The buffered read functions (this one, hs_serial_read_exact() and hs_serial_borrow()) pull
+ * data from the device in large chunks into a receive buffer attached to the handle (16 kiB,
+ * allocated on first use). When a device sends many small frames, most calls are served
+ * without any system call. Buffered data is returned first by all read functions, including
+ * hs_serial_read(), but the device descriptor does not signal it: drain the buffer before you
+ * poll the descriptor.
+ *
+ * This function behaves like fgets(): it copies bytes up to and including the first
+ * occurrence of @p delim, unless @p size bytes (or the size of the receive buffer) come first,
+ * in which case the data is returned without a delimiter. If no delimiter shows up before the
+ * timeout expires, the function returns 0 and the pending bytes stay in the buffer.
+ *
+ * @param      h       Device handle.
+ * @param[out] buf     Data buffer.
+ * @param      size    Size of the buffer.
+ * @param      delim   Delimiter byte, e.g. '\n'.
+ * @param      timeout Timeout in milliseconds, or -1 to block indefinitely.
+ * @return This function returns the number of bytes copied to @p buf, 0 on timeout, or a
+ *     negative @ref hs_error_code value.
+ */
+HS_PUBLIC ssize_t hs_serial_read_until(struct hs_handle *h, uint8_t *buf, size_t size,
+                                       uint8_t delim, int timeout);
+/**
+ * @ingroup serial
+ * @brief Read exactly @p size bytes.
+ *
+ * Keep reading until @p size bytes are received or the timeout expires. Once the receive
+ * buffer is drained, data is read directly into @p buf.
+ *
+ * @param      h       Device handle.
+ * @param[out] buf     Data buffer.
+ * @param      size    Number of bytes to read.
+ * @param      timeout Timeout in milliseconds, or -1 to block indefinitely.
+ * @return This function returns the number of bytes read, which is less than @p size if the
+ *     timeout expired, the device reached end of stream or an error occurred after a partial
+ *     read, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC ssize_t hs_serial_read_exact(struct hs_handle *h, uint8_t *buf, size_t size,
+                                       int timeout);
+
+/**
+ * @ingroup serial
+ * @brief Access buffered data without copying it.
+ *
+ * If the receive buffer is empty, the function waits for data for up to @p timeout
+ * milliseconds. The pointer stays valid until the next read call on this handle. Consume
+ * bytes with hs_serial_release(); bytes you do not release are returned again by the next
+ * read call.
+ *
+ * @param      h       Device handle.
+ * @param[out] rbuf    A pointer to the variable that receives the buffered data.
+ * @param      timeout Timeout in milliseconds, or -1 to block indefinitely.
+ * @return This function returns the number of bytes available at @p rbuf, 0 on timeout, or a
+ *     negative @ref hs_error_code value.
+ *
+ * @sa hs_serial_release()
+ */
+HS_PUBLIC ssize_t hs_serial_borrow(struct hs_handle *h, const uint8_t **rbuf, int timeout);
+/**
+ * @ingroup serial
+ * @brief Consume bytes obtained with hs_serial_borrow().
+ *
+ * @param h    Device handle.
+ * @param size Number of bytes to consume, it must not exceed the value returned by
+ *     hs_serial_borrow().
+ */
+HS_PUBLIC void hs_serial_release(struct hs_handle *h, size_t size);
+
+/**
+ * @ingroup serial
+ * @brief Serial modem control and status lines.
+ *
+ * @sa hs_serial_get_lines(), hs_serial_set_lines()
+ */
+enum hs_serial_line {
+    /** Data Terminal Ready (output). */
+    HS_SERIAL_LINE_DTR = 0x1,
+    /** Request To Send (output). */
+    HS_SERIAL_LINE_RTS = 0x2,
+    /** Clear To Send (input). */
+    HS_SERIAL_LINE_CTS = 0x4,
+    /** Data Set Ready (input). */
+    HS_SERIAL_LINE_DSR = 0x8,
+    /** Data Carrier Detect (input). */
+    HS_SERIAL_LINE_DCD = 0x10,
+    /** Ring Indicator (input). */
+    HS_SERIAL_LINE_RI  = 0x20
+};
+
+/**
+ * @ingroup serial
+ * @brief Get the state of the modem lines.
+ *
+ * @param h Device handle.
+ * @return This function returns a combination of @ref hs_serial_line flags for the lines
+ *     that are asserted, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_serial_get_lines(struct hs_handle *h);
+/**
+ * @ingroup serial
+ * @brief Change the state of the DTR and RTS lines.
+ *
+ * Only the lines in @p mask are changed: they are asserted if they are also set in @p values,
+ * and deasserted otherwise. This does not touch any other serial setting.
+ *
+ * @code{.c}
+ * // Pulse DTR low while keeping RTS untouched
+ * hs_serial_set_lines(h, HS_SERIAL_LINE_DTR, 0);
+ * hs_serial_set_lines(h, HS_SERIAL_LINE_DTR, HS_SERIAL_LINE_DTR);
+ * @endcode
+ *
+ * @param h      Device handle.
+ * @param mask   Lines to change, HS_SERIAL_LINE_DTR and/or HS_SERIAL_LINE_RTS.
+ * @param values New state of the lines in @p mask.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_serial_set_lines(struct hs_handle *h, int mask, int values);
+
+#ifdef __linux__
+
+/**
+ * @ingroup serial
+ * @brief Watch modem input lines for transitions.
+ *
+ * A helper thread waits in TIOCMIWAIT and signals an event descriptor each time one of the
+ * lines in @p mask changes. Add the descriptor returned by hs_serial_get_line_descriptor() to
+ * your hs_descriptor_set (or any poll loop), and call hs_serial_read_line_event() when it
+ * becomes readable. Events are coalesced: always act on the current line state.
+ *
+ * Only drivers that implement TIOCMIWAIT (most UART and USB-serial drivers, but not
+ * CDC-ACM or ptys) are supported. Call again with a different mask to change the watched lines,
+ * or with 0 to stop watching. The watcher is also stopped when the handle is closed.
+ *
+ * The watcher is interrupted with the real-time signal SIGRTMIN + 4. libhs installs an empty
+ * handler for it on first use, and fails if the application already handles that signal.
+ *
+ * @param h    Device handle.
+ * @param mask Input lines to watch, see @ref hs_serial_line.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_serial_watch_lines(struct hs_handle *h, int mask);
+/**
+ * @ingroup serial
+ * @brief Get the pollable descriptor signalled on modem line changes.
+ *
+ * The descriptor stays the same for the lifetime of the handle, even if you restart the
+ * watcher with a different mask.
+ *
+ * @param h Device handle, hs_serial_watch_lines() must have been called first.
+ * @return This function returns a pollable descriptor.
+ */
+HS_PUBLIC hs_descriptor hs_serial_get_line_descriptor(const struct hs_handle *h);
+/**
+ * @ingroup serial
+ * @brief Acknowledge a modem line event and get the current line state.
+ *
+ * @param h Device handle.
+ * @return This function returns the current state of the lines (see hs_serial_get_lines()),
+ *     or a negative @ref hs_error_code value if the watcher failed, for example because the
+ *     device was disconnected.
+ */
+HS_PUBLIC int hs_serial_read_line_event(struct hs_handle *h);
+
+#endif
+
+/**
+ * @ingroup serial
+ * @brief Transmit ring watermark callback.
+ *
+ * @param h     Device handle.
+ * @param above 1 when the queued data reaches the high watermark, 0 when it drops back to the
+ *     low watermark.
+ * @param udata Pointer to user-defined arbitrary data.
+ *
+ * @sa hs_serial_set_tx_watermarks()
+ */
+typedef void hs_serial_tx_watermark_func(struct hs_handle *h, int above, void *udata);
+
+/**
+ * @ingroup serial
+ * @brief Attach a non-blocking transmit ring to a serial handle.
+ *
+ * With a transmit ring, hs_serial_enqueue() never blocks: data that the kernel cannot take
+ * right away is copied to the ring, and your event loop sends it with hs_serial_flush_tx()
+ * once the device descriptor becomes writable (POLLOUT). Do not mix queued and blocking writes
+ * (e.g. hs_serial_write()) while data is queued, or it will be sent out of order.
+ *
+ * Pass 0 to free the ring. The ring cannot be made smaller than the amount of queued data.
+ *
+ * @param h    Device handle.
+ * @param size Ring size in bytes.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_serial_set_tx_ring(struct hs_handle *h, size_t size);
+/**
+ * @ingroup serial
+ * @brief Get notified when the transmit ring fills up and drains.
+ *
+ * The callback is called with @p above = 1 from hs_serial_enqueue() when the queued data
+ * reaches @p high bytes, and then with @p above = 0 from hs_serial_flush_tx() when it drops
+ * to @p low bytes or less. Producers can use it to stop and resume instead of stalling.
+ *
+ * @param h     Device handle.
+ * @param low   Low watermark, in bytes.
+ * @param high  High watermark, in bytes. Use 0 to disable notifications.
+ * @param f     Watermark callback, or NULL.
+ * @param udata Pointer to user-defined arbitrary data for the callback.
+ */
+HS_PUBLIC void hs_serial_set_tx_watermarks(struct hs_handle *h, size_t low, size_t high,
+                                           hs_serial_tx_watermark_func *f, void *udata);
+/**
+ * @ingroup serial
+ * @brief Queue bytes for transmission without blocking.
+ *
+ * If nothing is queued yet, the function first tries to write directly to the device. What
+ * the kernel does not accept is copied to the transmit ring, as long as there is room.
+ *
+ * @param h    Device handle with a transmit ring.
+ * @param buf  Data buffer.
+ * @param size Size of the buffer.
+ * @return This function returns the number of bytes accepted (written or queued), which is
+ *     less than @p size when the ring is full, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC ssize_t hs_serial_enqueue(struct hs_handle *h, const uint8_t *buf, size_t size);
+/**
+ * @ingroup serial
+ * @brief Send as much queued data as the device accepts, without blocking.
+ *
+ * @param h Device handle.
+ * @return This function returns 1 if the ring is empty, 0 if data remains (poll the device
+ *     descriptor for POLLOUT and call it again), or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC int hs_serial_flush_tx(struct hs_handle *h);
+/**
+ * @ingroup serial
+ * @brief Get the number of bytes waiting in the transmit ring.
+ *
+ * @param h Device handle.
+ * @return This function returns the number of queued bytes.
+ */
+HS_PUBLIC size_t hs_serial_get_tx_queued(const struct hs_handle *h);
+/**
+ * @ingroup serial
+ * @brief Get the number of bytes waiting in the kernel output queue (TIOCOUTQ).
+ *
+ * This does not include data held in the transmit ring, see hs_serial_get_tx_queued().
+ *
+ * @param h Device handle.
+ * @return This function returns the number of bytes not yet sent by the driver, or a negative
+ *     @ref hs_error_code value.
+ */
+HS_PUBLIC ssize_t hs_serial_get_output_queue(const struct hs_handle *h);
+
+#ifdef __linux__
+
+/**
+ * @ingroup serial
+ * @brief Move received bytes to another descriptor without copying them to userspace.
+ *
+ * Wait up to @p timeout milliseconds for data, then transfer up to @p size bytes from the
+ * device to @p fd with splice(). Pipes are targeted directly, other descriptors (files,
+ * sockets) go through an intermediate pipe owned by the handle. This is meant for capturing
+ * raw streams to disk or to another process.
+ *
+ * Ttys only support splice() since Linux 6.5. On older kernels, the function detects it and
+ * falls back to a read()/write() copy loop. Bytes already held in the receive buffer (see
+ * hs_serial_read_until()) are written out first to preserve ordering.
+ *
+ * If @p fd is not ready for writing, the function waits for it within the same timeout. Bytes
+ * already taken from the device are kept by the handle and written out first by the next call.
+ *
+ * @param h       Device handle.
+ * @param fd      Destination descriptor.
+ * @param size    Maximum number of bytes to move.
+ * @param timeout Timeout in milliseconds, or -1 to block indefinitely.
+ * @return This function returns the number of bytes moved, 0 on timeout, or a negative
+ *     @ref hs_error_code value.
+ */
+HS_PUBLIC ssize_t hs_serial_splice_to(struct hs_handle *h, int fd, size_t size, int timeout);
+
+#endif
+
+/**
+ * @ingroup serial
+ * @brief Framing protocols supported by hs_serial_read_frame() and hs_serial_write_frame().
+ */
+typedef enum hs_serial_framing {
+    /** No framing layer (default). */
+    HS_SERIAL_FRAMING_NONE,
+    /** Consistent Overhead Byte Stuffing, frames are terminated by a 0 byte. */
+    HS_SERIAL_FRAMING_COBS,
+    /** SLIP (RFC 1055), frames are delimited by END (0xC0) bytes. */
+    HS_SERIAL_FRAMING_SLIP
+} hs_serial_framing;
+
+/**
+ * @ingroup serial
+ * @brief Attach a framing layer to a serial handle.
+ *
+ * Once set, use hs_serial_read_frame() and hs_serial_write_frame() to exchange whole frames.
+ * Incoming data goes through the same receive buffer as hs_serial_read_until(), and frame
+ * delimiters are located with memchr(), so decoding costs a few bulk copies per frame instead
+ * of a branch per byte.
+ *
+ * @param h       Device handle.
+ * @param framing Framing protocol.
+ */
+HS_PUBLIC void hs_serial_set_framing(struct hs_handle *h, hs_serial_framing framing);
+
+/**
+ * @ingroup serial
+ * @brief Read and decode a frame.
+ *
+ * Empty frames are skipped. Malformed frames, and frames that do not fit in @p buf or in the
+ * receive buffer, are dropped silently (a debug message is logged).
+ *
+ * @param      h       Device handle.
+ * @param[out] buf     Buffer for the decoded frame.
+ * @param      size    Size of the buffer.
+ * @param      timeout Timeout in milliseconds, or -1 to block indefinitely.
+ * @return This function returns the size of the decoded frame, 0 if no complete frame was
+ *     received before the timeout expired, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC ssize_t hs_serial_read_frame(struct hs_handle *h, uint8_t *buf, size_t size,
+                                       int timeout);
+/**
+ * @ingroup serial
+ * @brief Encode and send a frame.
+ *
+ * The frame is encoded into a buffer owned by the handle, and sent with a single call to
+ * hs_serial_write_all(). If the timeout expires in the middle of the frame, the next frame
+ * starts with a delimiter so that the receiver can discard the truncated one.
+ *
+ * @param h       Device handle.
+ * @param buf     Frame payload.
+ * @param size    Size of the payload.
+ * @param timeout Timeout in milliseconds, or -1 to block until the frame is sent.
+ * @return This function returns @p size once the frame is sent, 0 if the timeout expired, or
+ *     a negative @ref hs_error_code value.
+ */
+HS_PUBLIC ssize_t hs_serial_write_frame(struct hs_handle *h, const uint8_t *buf, size_t size,
+                                        int timeout);
+
+#endif
 /**
  * @ingroup serial
  * @brief Send bytes to a serial device.
  *
  * Write up to @p size bytes to the device. This is a blocking function, but it may not write
- * all the data passed in.
+ * all the data passed in. Use hs_serial_write_all() if you need everything written.
  *
  * @param h    Device handle.
  * @param buf  Data buffer.
@@ -162,6 +599,43 @@ HS_PUBLIC ssize_t hs_serial_read(struct hs_handle *h, uint8_t *buf, size_t size,
  *     value.
  */
 HS_PUBLIC ssize_t hs_serial_write(struct hs_handle *h, const uint8_t *buf, ssize_t size);
+/**
+ * @ingroup serial
+ * @brief Send all bytes to a serial device.
+ *
+ * Keep writing until @p size bytes have been sent, the timeout expires or an error occurs.
+ * The device is only polled when its output buffer is full, so a write that fits in the
+ * buffer costs a single system call.
+ *
+ * @param h       Device handle.
+ * @param buf     Data buffer.
+ * @param size    Size of the buffer.
+ * @param timeout Timeout in milliseconds, or -1 to block until everything is written.
+ * @return This function returns the number of bytes written, which is less than @p size if
+ *     the timeout expired (or the handle was cancelled after a partial write), or a negative
+ *     @ref hs_error_code value.
+ *
+ * @sa hs_serial_writev()
+ */
+HS_PUBLIC ssize_t hs_serial_write_all(struct hs_handle *h, const uint8_t *buf, size_t size,
+                                      int timeout);
+/**
+ * @ingroup serial
+ * @brief Send multiple buffers to a serial device.
+ *
+ * Behaves like hs_serial_write_all(), but gathers the data from @p count buffers. On POSIX
+ * systems the buffers are written with writev(), which avoids copying small headers and
+ * payloads to a temporary buffer.
+ *
+ * @param h       Device handle.
+ * @param iov     Array of buffer descriptors.
+ * @param count   Number of buffer descriptors.
+ * @param timeout Timeout in milliseconds, or -1 to block until everything is written.
+ * @return This function returns the total number of bytes written, which is less than the
+ *     sum of the buffer sizes if the timeout expired, or a negative @ref hs_error_code value.
+ */
+HS_PUBLIC ssize_t hs_serial_writev(struct hs_handle *h, const hs_serial_iovec *iov,
+                                   unsigned int count, int timeout);
 
 HS_END_C
 
@@ -0,0 +1,206 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef HS_VIRTUAL_H
+#define HS_VIRTUAL_H
+
+#include "common.h"
+#include "device.h"
+
+HS_BEGIN_C
+
+#ifdef __linux__
+
+/**
+ * @defgroup virtual Virtual devices
+ * @brief Create in-process devices to test and benchmark code without USB hardware.
+ *
+ * A virtual device is an @ref hs_device backed by a local endpoint instead of a kernel driver,
+ * which you can plug into a device monitor. Handles opened on it behave like real handles:
+ * they work with hs_hid_read(), hs_serial_read(), the I/O engine and hs_handle_get_descriptor().
+ *
+ * The other side of the device, the peer, is a file descriptor you drive yourself:
+ * - Serial devices are backed by a pseudo-terminal, the peer is the master side.
+ * - HID devices are backed by a SOCK_SEQPACKET socket pair, each message is one report. Send
+ *   input reports in hidraw format (report ID first only if the device uses numbered reports),
+ *   and output reports written with hs_hid_write() arrive with the report ID first. Feature
+ *   reports are answered synchronously by a callback, see hs_virtual_device_set_feature_func().
+ */
+
+/**
+ * @ingroup virtual
+ * @brief Opaque structure representing a virtual device.
+ */
+typedef struct hs_virtual_device hs_virtual_device;
+
+/**
+ * @ingroup virtual
+ * @brief Virtual device description.
+ *
+ * @sa hs_virtual_device_new()
+ */
+typedef struct hs_virtual_device_info {
+    /** Device type. */
+    hs_device_type type;
+
+    /** Vendor ID. */
+    uint16_t vid;
+    /** Product ID. */
+    uint16_t pid;
+    /** Interface number. */
+    uint8_t iface;
+
+    /** Manufacturer string, or NULL. */
+    const char *manufacturer;
+    /** Product string, or NULL. */
+    const char *product;
+    /** Serial number string, or NULL. */
+    const char *serial;
+    /** Device location, or NULL to generate a unique one. */
+    const char *location;
+
+    /** HID report descriptor, used by hs_hid_parse_descriptor() and to detect numbered reports. */
+    const uint8_t *report_descriptor;
+    /** Size of the HID report descriptor in bytes. */
+    size_t report_descriptor_size;
+} hs_virtual_device_info;
+
+/**
+ * @ingroup virtual
+ * @brief Virtual HID feature report callback.
+ *
+ * For get requests, buf[0] contains the report ID and the callback must fill the buffer (report
+ * ID included) and return the report size. For set requests, buf contains the report sent by
+ * hs_hid_send_feature_report() and the callback should return size.
+ *
+ * @param vdev  Virtual device.
+ * @param set   Non-zero for hs_hid_send_feature_report(), 0 for hs_hid_get_feature_report().
+ * @param buf   Report buffer.
+ * @param size  Size of the buffer (get) or of the report (set).
+ * @param udata Pointer to user-defined arbitrary data.
+ * @return Return the number of bytes transferred, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_virtual_device_set_feature_func()
+ */
+typedef ssize_t hs_virtual_feature_func(hs_virtual_device *vdev, int set, uint8_t *buf,
+                                        size_t size, void *udata);
+
+/**
+ * @ingroup virtual
+ * @brief Create a virtual device.
+ *
+ * The device is not visible until you plug it into a monitor with hs_virtual_device_plug(),
+ * but you can open it right away with hs_device_open().
+ *
+ * @param      info  Device description.
+ * @param[out] rvdev A pointer to the variable that receives the virtual device, it will stay
+ *     unchanged if the function fails.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_virtual_device_free()
+ */
+HS_PUBLIC int hs_virtual_device_new(const hs_virtual_device_info *info, hs_virtual_device **rvdev);
+/**
+ * @ingroup virtual
+ * @brief Unplug and destroy a virtual device.
+ *
+ * The peer descriptor is closed. Handles that are still open see the device go away: HID reads
+ * and writes fail with @ref HS_ERROR_IO, serial handles get a hangup (reads return 0
+ * immediately and writes fail). You still need to close them.
+ *
+ * @param vdev Virtual device.
+ */
+HS_PUBLIC void hs_virtual_device_free(hs_virtual_device *vdev);
+
+/**
+ * @ingroup virtual
+ * @brief Get the device object of a virtual device.
+ *
+ * @param vdev Virtual device.
+ * @return This function returns the device object, use hs_device_ref() to keep it around after
+ *     the virtual device is destroyed.
+ */
+HS_PUBLIC hs_device *hs_virtual_device_get_device(const hs_virtual_device *vdev);
+/**
+ * @ingroup virtual
+ * @brief Get the peer side of a virtual device.
+ *
+ * Read what the handles write and write what they should read on this descriptor. It is
+ * non-blocking, and owned by the virtual device.
+ *
+ * @param vdev Virtual device.
+ * @return This function returns a pollable file descriptor.
+ */
+HS_PUBLIC hs_descriptor hs_virtual_device_get_peer(const hs_virtual_device *vdev);
+
+/**
+ * @ingroup virtual
+ * @brief Set the HID feature report callback.
+ *
+ * Without a callback, feature report requests fail with @ref HS_ERROR_IO.
+ *
+ * @param vdev  Virtual HID device.
+ * @param f     Feature report callback, or NULL.
+ * @param udata Pointer to user-defined arbitrary data for the callback.
+ *
+ * @sa hs_virtual_feature_func()
+ */
+HS_PUBLIC void hs_virtual_device_set_feature_func(hs_virtual_device *vdev,
+                                                  hs_virtual_feature_func *f, void *udata);
+
+/**
+ * @ingroup virtual
+ * @brief Plug a virtual device into a device monitor.
+ *
+ * The device is added to the monitor and the monitor callbacks are called immediately, as if
+ * hs_monitor_refresh() had received an add event. A virtual device can only be plugged into
+ * one monitor at a time.
+ *
+ * @param vdev    Virtual device.
+ * @param monitor Device monitor.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value. If a
+ *     callback returns a non-zero value, the value is returned.
+ *
+ * @sa hs_virtual_device_unplug()
+ */
+HS_PUBLIC int hs_virtual_device_plug(hs_virtual_device *vdev, struct hs_monitor *monitor);
+/**
+ * @ingroup virtual
+ * @brief Unplug a virtual device from its monitor.
+ *
+ * The monitor callbacks are called immediately with the device in the
+ * @ref HS_DEVICE_STATUS_DISCONNECTED state. Open handles keep working, so that you can
+ * simulate a device coming back with hs_virtual_device_plug().
+ *
+ * @param vdev Virtual device.
+ *
+ * @sa hs_virtual_device_plug()
+ */
+HS_PUBLIC void hs_virtual_device_unplug(hs_virtual_device *vdev);
+
+#endif
+
+HS_END_C
+
+#endif
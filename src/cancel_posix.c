@@ -0,0 +1,180 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include <fcntl.h>
+#include <poll.h>
+#ifdef __linux__
+    #include <sys/eventfd.h>
+#endif
+#include <unistd.h>
+#include "cancel_posix_priv.h"
+#include "device_priv.h"
+#include "hs/device.h"
+#include "hs/platform.h"
+
+struct hs_handle {
+    _HS_HANDLE
+};
+
+struct hs_cancel_token {
+    bool triggered;
+
+    // On Linux, an eventfd is used and both descriptors are the same
+    int fds[2];
+};
+
+int hs_cancel_token_new(hs_cancel_token **rtoken)
+{
+    assert(rtoken);
+
+    hs_cancel_token *token;
+    int r;
+
+    token = _hs_calloc(1, sizeof(*token));
+    if (!token)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+#ifdef __linux__
+    token->fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (token->fds[0] < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "eventfd() failed: %s", strerror(errno));
+        goto error;
+    }
+    token->fds[1] = token->fds[0];
+#else
+    r = pipe(token->fds);
+    if (r < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "pipe() failed: %s", strerror(errno));
+        goto error;
+    }
+    for (unsigned int i = 0; i < 2; i++) {
+        fcntl(token->fds[i], F_SETFD, FD_CLOEXEC);
+        fcntl(token->fds[i], F_SETFL, fcntl(token->fds[i], F_GETFL, 0) | O_NONBLOCK);
+    }
+#endif
+
+    *rtoken = token;
+    return 0;
+
+error:
+    _hs_free(token);
+    return r;
+}
+
+void hs_cancel_token_free(hs_cancel_token *token)
+{
+    if (token) {
+        close(token->fds[0]);
+        if (token->fds[1] != token->fds[0])
+            close(token->fds[1]);
+    }
+
+    _hs_free(token);
+}
+
+hs_descriptor hs_cancel_token_get_descriptor(const hs_cancel_token *token)
+{
+    assert(token);
+    return token->fds[0];
+}
+
+void hs_cancel_token_trigger(hs_cancel_token *token)
+{
+    assert(token);
+
+    if (!__atomic_exchange_n(&token->triggered, true, __ATOMIC_SEQ_CST)) {
+        uint64_t value = 1;
+        ssize_t r;
+
+        // Eventfd counters need 8 bytes, pipes don't care
+        do {
+            r = write(token->fds[1], &value, sizeof(value));
+        } while (r < 0 && errno == EINTR);
+    }
+}
+
+void hs_cancel_token_reset(hs_cancel_token *token)
+{
+    assert(token);
+
+    if (__atomic_exchange_n(&token->triggered, false, __ATOMIC_SEQ_CST)) {
+        uint64_t value;
+        ssize_t r;
+
+        do {
+            r = read(token->fds[0], &value, sizeof(value));
+        } while (r < 0 && errno == EINTR);
+    }
+}
+
+int hs_cancel_token_is_triggered(const hs_cancel_token *token)
+{
+    assert(token);
+    return _hs_cancel_token_is_triggered(token);
+}
+
+void hs_handle_set_cancel_token(hs_handle *h, hs_cancel_token *token)
+{
+    assert(h);
+    h->cancel = token;
+}
+
+bool _hs_cancel_token_is_triggered(const hs_cancel_token *token)
+{
+    return token && __atomic_load_n(&token->triggered, __ATOMIC_ACQUIRE);
+}
+
+int _hs_cancel_poll(const hs_cancel_token *token, int fd, short events, int timeout,
+                    const char *path)
+{
+    struct pollfd pfd[2];
+    nfds_t count = 1;
+    uint64_t start;
+    int r;
+
+    pfd[0].events = events;
+    pfd[0].fd = fd;
+    if (token) {
+        pfd[1].events = POLLIN;
+        pfd[1].fd = token->fds[0];
+        count++;
+    }
+
+    start = hs_millis();
+restart:
+    r = poll(pfd, count, hs_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+        return hs_error(HS_ERROR_SYSTEM, "poll('%s') failed: %s", path, strerror(errno));
+    }
+    if (!r)
+        return 0;
+
+    if (count > 1 && pfd[1].revents)
+        return HS_ERROR_CANCELLED;
+
+    return 1;
+}
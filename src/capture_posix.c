@@ -0,0 +1,326 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture_priv.h"
+#include "hs/hid.h"
+#include "hs/platform.h"
+
+#define CAPTURE_BUFFER_SIZE 65536
+
+struct hs_capture {
+    int fd;
+    char *filename;
+    uint64_t start;
+
+    pthread_mutex_t mutex;
+    bool mutex_init;
+
+    uint8_t *buf;
+    size_t buf_len;
+    // Set once a write fails, recording stops and hs_capture_flush() reports it
+    int error;
+
+    // Devices already described in the file, the index in this array is the device index
+    hs_device **devices;
+    unsigned int devices_count;
+    unsigned int devices_size;
+};
+
+struct hs_handle {
+    _HS_HANDLE
+};
+
+static int write_all(hs_capture *capture, const uint8_t *buf, size_t size)
+{
+    while (size) {
+        ssize_t r = write(capture->fd, buf, size);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return hs_error(HS_ERROR_IO, "I/O error while writing to '%s': %s",
+                            capture->filename, strerror(errno));
+        }
+
+        buf += r;
+        size -= (size_t)r;
+    }
+
+    return 0;
+}
+
+static int flush_buffer(hs_capture *capture)
+{
+    int r;
+
+    if (capture->error)
+        return capture->error;
+
+    r = write_all(capture, capture->buf, capture->buf_len);
+    capture->buf_len = 0;
+    if (r < 0)
+        capture->error = r;
+
+    return r;
+}
+
+// Call with the mutex locked, parts are concatenated into the payload of a single record
+static void append_record(hs_capture *capture, _hs_capture_record_type type, uint16_t device,
+                          const void *const *parts, const size_t *sizes, unsigned int count)
+{
+    static const uint8_t padding[8];
+
+    _hs_capture_record record = {0};
+    size_t size = 0;
+
+    if (capture->error)
+        return;
+
+    for (unsigned int i = 0; i < count; i++)
+        size += sizes[i];
+
+    record.time = hs_nanos() - capture->start;
+    record.size = (uint32_t)size;
+    record.device = device;
+    record.type = (uint8_t)type;
+
+    size = sizeof(record) + _HS_CAPTURE_ALIGN(size);
+    if (capture->buf_len + size > CAPTURE_BUFFER_SIZE && flush_buffer(capture) < 0)
+        return;
+
+    if (size <= CAPTURE_BUFFER_SIZE) {
+        uint8_t *ptr = capture->buf + capture->buf_len;
+
+        memcpy(ptr, &record, sizeof(record));
+        ptr += sizeof(record);
+        for (unsigned int i = 0; i < count; i++) {
+            memcpy(ptr, parts[i], sizes[i]);
+            ptr += sizes[i];
+        }
+        memset(ptr, 0, (size_t)(capture->buf + capture->buf_len + size - ptr));
+
+        capture->buf_len += size;
+    } else {
+        // Huge report, bypass the buffer (which is empty at this point)
+        int r = write_all(capture, (const uint8_t *)&record, sizeof(record));
+        for (unsigned int i = 0; !r && i < count; i++)
+            r = write_all(capture, parts[i], sizes[i]);
+        if (!r)
+            r = write_all(capture, padding, _HS_CAPTURE_ALIGN(record.size) - record.size);
+
+        if (r < 0)
+            capture->error = r;
+    }
+}
+
+int hs_capture_new(const char *filename, hs_capture **rcapture)
+{
+    assert(filename);
+    assert(rcapture);
+
+    hs_capture *capture;
+    _hs_capture_header header = {{0}};
+    struct timespec ts;
+    int r;
+
+    capture = _hs_calloc(1, sizeof(*capture));
+    if (!capture) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    capture->fd = -1;
+
+    capture->filename = _hs_strdup(filename);
+    capture->buf = _hs_malloc(CAPTURE_BUFFER_SIZE);
+    if (!capture->filename || !capture->buf) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    r = pthread_mutex_init(&capture->mutex, NULL);
+    if (r) {
+        r = hs_error(HS_ERROR_SYSTEM, "pthread_mutex_init() failed: %s", strerror(r));
+        goto error;
+    }
+    capture->mutex_init = true;
+
+restart:
+    capture->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (capture->fd < 0) {
+        switch (errno) {
+        case EINTR:
+            goto restart;
+        case EACCES:
+            r = hs_error(HS_ERROR_ACCESS, "Permission denied for '%s'", filename);
+            break;
+        case ENOENT:
+            r = hs_error(HS_ERROR_NOT_FOUND, "Directory for '%s' does not exist", filename);
+            break;
+        default:
+            r = hs_error(HS_ERROR_SYSTEM, "open('%s') failed: %s", filename, strerror(errno));
+            break;
+        }
+        goto error;
+    }
+
+    memcpy(header.magic, _HS_CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = _HS_CAPTURE_VERSION;
+    header.header_size = sizeof(header);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header.start_time = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+
+    memcpy(capture->buf, &header, sizeof(header));
+    capture->buf_len = sizeof(header);
+    capture->start = hs_nanos();
+
+    *rcapture = capture;
+    return 0;
+
+error:
+    hs_capture_free(capture);
+    return r;
+}
+
+void hs_capture_free(hs_capture *capture)
+{
+    if (capture) {
+        if (capture->fd >= 0) {
+            flush_buffer(capture);
+            close(capture->fd);
+        }
+
+        for (unsigned int i = 0; i < capture->devices_count; i++)
+            hs_device_unref(capture->devices[i]);
+        _hs_free(capture->devices);
+
+        if (capture->mutex_init)
+            pthread_mutex_destroy(&capture->mutex);
+        _hs_free(capture->buf);
+        _hs_free(capture->filename);
+    }
+
+    _hs_free(capture);
+}
+
+int hs_capture_flush(hs_capture *capture)
+{
+    assert(capture);
+
+    int r;
+
+    pthread_mutex_lock(&capture->mutex);
+    r = flush_buffer(capture);
+    pthread_mutex_unlock(&capture->mutex);
+
+    return r;
+}
+
+static int add_device(hs_capture *capture, hs_handle *h)
+{
+    hs_device *dev = h->dev;
+    _hs_capture_device info = {0};
+    hs_hid_descriptor desc;
+    const void *parts[5];
+    size_t sizes[5];
+
+    for (unsigned int i = 0; i < capture->devices_count; i++) {
+        if (capture->devices[i] == dev)
+            return (int)i;
+    }
+
+    if (capture->devices_count == UINT16_MAX + 1)
+        return hs_error(HS_ERROR_MEMORY, "Too many devices in capture '%s'", capture->filename);
+    if (capture->devices_count == capture->devices_size) {
+        hs_device **tmp;
+        unsigned int new_size;
+
+        new_size = capture->devices_size ? capture->devices_size * 2 : 8;
+        tmp = _hs_realloc(capture->devices, new_size * sizeof(*capture->devices));
+        if (!tmp)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+        capture->devices = tmp;
+        capture->devices_size = new_size;
+    }
+
+    info.vid = dev->vid;
+    info.pid = dev->pid;
+    info.iface = dev->iface;
+    if (hs_hid_parse_descriptor(h, &desc) >= 0) {
+        info.usage_page = desc.usage_page;
+        info.usage = desc.usage;
+    }
+
+    parts[0] = &info;
+    sizes[0] = sizeof(info);
+    parts[1] = dev->location ? dev->location : "";
+    parts[2] = dev->manufacturer ? dev->manufacturer : "";
+    parts[3] = dev->product ? dev->product : "";
+    parts[4] = dev->serial ? dev->serial : "";
+    for (unsigned int i = 1; i < 5; i++)
+        sizes[i] = strlen(parts[i]) + 1;
+
+    append_record(capture, _HS_CAPTURE_DEVICE, (uint16_t)capture->devices_count, parts, sizes, 5);
+    capture->devices[capture->devices_count] = hs_device_ref(dev);
+
+    return (int)capture->devices_count++;
+}
+
+int hs_handle_set_capture(hs_handle *h, hs_capture *capture)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_HID);
+
+    int r;
+
+    if (!capture) {
+        h->capture = NULL;
+        return 0;
+    }
+
+    pthread_mutex_lock(&capture->mutex);
+    r = add_device(capture, h);
+    pthread_mutex_unlock(&capture->mutex);
+    if (r < 0)
+        return r;
+
+    h->capture = capture;
+    h->capture_device = (uint16_t)r;
+
+    return 0;
+}
+
+void _hs_capture_report(hs_handle *h, _hs_capture_record_type type, const uint8_t *buf,
+                        size_t size)
+{
+    hs_capture *capture = h->capture;
+    const void *parts[1] = {buf};
+
+    pthread_mutex_lock(&capture->mutex);
+    append_record(capture, type, h->capture_device, parts, &size, 1);
+    pthread_mutex_unlock(&capture->mutex);
+}
@@ -0,0 +1,75 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _HS_CAPTURE_PRIV_H
+#define _HS_CAPTURE_PRIV_H
+
+#include "util.h"
+#include "device_priv.h"
+#include "hs/capture.h"
+
+// See the capture group in hs/capture.h for a description of the format
+#define _HS_CAPTURE_MAGIC "HSCP"
+#define _HS_CAPTURE_VERSION 1
+
+typedef enum _hs_capture_record_type {
+    _HS_CAPTURE_DEVICE,
+    _HS_CAPTURE_INPUT,
+    _HS_CAPTURE_OUTPUT,
+    _HS_CAPTURE_GET_FEATURE,
+    _HS_CAPTURE_SEND_FEATURE
+} _hs_capture_record_type;
+
+typedef struct _hs_capture_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t start_time;
+} _hs_capture_header;
+
+typedef struct _hs_capture_record {
+    uint64_t time;
+    uint32_t size;
+    uint16_t device;
+    uint8_t type;
+    uint8_t reserved;
+} _hs_capture_record;
+
+// Payload of _HS_CAPTURE_DEVICE records, followed by the four strings
+typedef struct _hs_capture_device {
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t usage_page;
+    uint16_t usage;
+    uint8_t iface;
+    uint8_t reserved[3];
+} _hs_capture_device;
+
+#define _HS_CAPTURE_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+// Called by the HID backends for each report transferred while h->capture is set
+void _hs_capture_report(hs_handle *h, _hs_capture_record_type type, const uint8_t *buf,
+                        size_t size);
+
+#endif
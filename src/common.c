@@ -24,14 +24,34 @@
 
 #include "util.h"
 #include <stdarg.h>
+#include "log_priv.h"
+#include "pool.h"
+#include "hs/platform.h"
 
 static void default_handler(hs_log_level level, const char *msg, void *udata);
 
 static hs_log_func *handler = default_handler;
 static void *handler_udata = NULL;
 
-static hs_error_code mask[32];
-static unsigned int mask_count = 0;
+// Messages below log_threshold are dropped before they get formatted
+static bool debug_env;
+static bool log_level_set;
+static hs_log_level log_level;
+static hs_log_level log_threshold = HS_LOG_WARNING;
+
+// Masks are per-thread, 0 masks everything (see hs_error_mask_all)
+static _HS_THREAD_LOCAL int mask[32];
+static _HS_THREAD_LOCAL unsigned int mask_count;
+
+static _HS_THREAD_LOCAL int last_code;
+static _HS_THREAD_LOCAL const char *last_message;
+static _HS_THREAD_LOCAL char last_message_buf[_HS_LOG_MESSAGE_SIZE];
+
+static void *default_alloc(size_t size, void *udata);
+static void *default_realloc(void *ptr, size_t size, void *udata);
+static void default_free(void *ptr, void *udata);
+
+static hs_allocator allocator = {default_alloc, default_realloc, default_free, NULL};
 
 uint32_t hs_version(void)
 {
@@ -43,6 +63,109 @@ const char *hs_version_string(void)
     return HS_VERSION_STRING;
 }
 
+static void *default_alloc(size_t size, void *udata)
+{
+    _HS_UNUSED(udata);
+    return malloc(size);
+}
+
+static void *default_realloc(void *ptr, size_t size, void *udata)
+{
+    _HS_UNUSED(udata);
+    return realloc(ptr, size);
+}
+
+static void default_free(void *ptr, void *udata)
+{
+    _HS_UNUSED(udata);
+    free(ptr);
+}
+
+void hs_set_allocator(const hs_allocator *new_allocator)
+{
+    // Pooled objects come from the current allocator, don't hand them out after the switch
+    _hs_pool_release_all();
+
+    if (new_allocator) {
+        assert(new_allocator->alloc && new_allocator->realloc && new_allocator->free);
+        allocator = *new_allocator;
+    } else {
+        allocator.alloc = default_alloc;
+        allocator.realloc = default_realloc;
+        allocator.free = default_free;
+        allocator.udata = NULL;
+    }
+}
+
+void *_hs_malloc(size_t size)
+{
+    return (*allocator.alloc)(size, allocator.udata);
+}
+
+void *_hs_calloc(size_t count, size_t size)
+{
+    void *ptr;
+
+    if (size && count > SIZE_MAX / size)
+        return NULL;
+
+    ptr = (*allocator.alloc)(count * size, allocator.udata);
+    if (ptr)
+        memset(ptr, 0, count * size);
+
+    return ptr;
+}
+
+void *_hs_realloc(void *ptr, size_t size)
+{
+    return (*allocator.realloc)(ptr, size, allocator.udata);
+}
+
+void _hs_free(void *ptr)
+{
+    (*allocator.free)(ptr, allocator.udata);
+}
+
+char *_hs_strdup(const char *s)
+{
+    size_t len = strlen(s);
+    char *copy;
+
+    copy = _hs_malloc(len + 1);
+    if (!copy)
+        return NULL;
+    memcpy(copy, s, len + 1);
+
+    return copy;
+}
+
+int _hs_asprintf(char **strp, const char *fmt, ...)
+{
+    va_list ap, ap2;
+    char *s;
+    int r;
+
+    va_start(ap, fmt);
+    va_copy(ap2, ap);
+
+    r = vsnprintf(NULL, 0, fmt, ap);
+    if (r < 0)
+        goto cleanup;
+
+    s = _hs_malloc((size_t)r + 1);
+    if (!s) {
+        r = -1;
+        goto cleanup;
+    }
+    vsnprintf(s, (size_t)r + 1, fmt, ap2);
+
+    *strp = s;
+cleanup:
+    va_end(ap2);
+    va_end(ap);
+    return r;
+}
+
 static const char *generic_message(int err)
 {
     if (err >= 0)
@@ -61,6 +184,8 @@ static const char *generic_message(int err)
         return "System error";
     case HS_ERROR_INVALID:
         return "Invalid data error";
+    case HS_ERROR_CANCELLED:
+        return "Operation cancelled";
     }
 
     return "Unknown error";
@@ -71,13 +196,28 @@ static void default_handler(hs_log_level level, const char *msg, void *udata)
     _HS_UNUSED(level);
     _HS_UNUSED(udata);
 
-    if (level == HS_LOG_DEBUG && !getenv("LIBHS_DEBUG"))
-        return;
-
     fputs(msg, stderr);
     fputc('\n', stderr);
 }
 
+static void update_log_threshold(void)
+{
+    if (log_level_set) {
+        log_threshold = log_level;
+    } else if (debug_env || handler != default_handler) {
+        // Custom handlers have always received debug messages
+        log_threshold = HS_LOG_DEBUG;
+    } else {
+        log_threshold = HS_LOG_WARNING;
+    }
+}
+
+_HS_INIT()
+{
+    debug_env = getenv("LIBHS_DEBUG");
+    update_log_threshold();
+}
+
 void hs_log_redirect(hs_log_func *f, void *udata)
 {
     if (f) {
@@ -87,6 +227,58 @@ void hs_log_redirect(hs_log_func *f, void *udata)
         handler = default_handler;
         handler_udata = NULL;
     }
+
+    update_log_threshold();
+}
+
+void hs_log_set_level(hs_log_level level)
+{
+    log_level = level;
+    log_level_set = true;
+
+    update_log_threshold();
+}
+
+hs_log_level hs_log_get_level(void)
+{
+    return log_threshold;
+}
+
+void _hs_log_write(hs_log_level level, const char *msg)
+{
+    (*handler)(level, msg, handler_udata);
+}
+
+static void dispatch(hs_log_level level, const char *msg)
+{
+#ifndef _WIN32
+    if (_hs_log_push_async(level, msg))
+        return;
+#endif
+
+    (*handler)(level, msg, handler_udata);
+}
+
+bool _hs_log_ratelimit(_hs_log_ratelimit_state *state, hs_log_level level)
+{
+    uint64_t now = hs_millis();
+
+    if (now - state->start >= _HS_LOG_RATELIMIT_INTERVAL) {
+        if (state->suppressed)
+            hs_log(level, "%u similar messages suppressed", state->suppressed);
+
+        state->start = now;
+        state->count = 0;
+        state->suppressed = 0;
+    }
+
+    if (state->count >= _HS_LOG_RATELIMIT_BURST) {
+        state->suppressed++;
+        return false;
+    }
+    state->count++;
+
+    return true;
 }
 
 void hs_error_mask(hs_error_code err)
@@ -96,6 +288,13 @@ void hs_error_mask(hs_error_code err)
     mask[mask_count++] = err;
 }
 
+void hs_error_mask_all(void)
+{
+    assert(mask_count < _HS_COUNTOF(mask));
+
+    mask[mask_count++] = 0;
+}
+
 void hs_error_unmask(void)
 {
     assert(mask_count);
@@ -106,10 +305,13 @@ void hs_error_unmask(void)
 HS_PRINTF_FORMAT(2, 0)
 static void logv(hs_log_level level, const char *fmt, va_list ap)
 {
-    char buf[512];
+    char buf[_HS_LOG_MESSAGE_SIZE];
+
+    if (level < log_threshold)
+        return;
 
     vsnprintf(buf, sizeof(buf), fmt, ap);
-    (*handler)(level, buf, handler_udata);
+    dispatch(level, buf);
 }
 
 void hs_log(hs_log_level level, const char *fmt, ...)
@@ -123,22 +325,41 @@ void hs_log(hs_log_level level, const char *fmt, ...)
     va_end(ap);
 }
 
+int hs_error_last_code(void)
+{
+    return last_code;
+}
+
+const char *hs_error_last_message(void)
+{
+    return last_message ? last_message : "";
+}
+
 int hs_error(hs_error_code err, const char *fmt, ...)
 {
     va_list ap;
 
+    last_code = err;
+
+    // Masked errors are recorded, but we don't spend any time formatting them
     for (unsigned int i = 0; i < mask_count; i++) {
-        if (mask[i] == err)
+        if (!mask[i] || mask[i] == (int)err) {
+            last_message = generic_message(err);
             return err;
+        }
     }
 
     if (fmt) {
         va_start(ap, fmt);
-        logv(HS_LOG_ERROR, fmt, ap);
+        vsnprintf(last_message_buf, sizeof(last_message_buf), fmt, ap);
         va_end(ap);
+
+        last_message = last_message_buf;
     } else {
-        hs_log(HS_LOG_ERROR, "%s", generic_message(err));
+        last_message = generic_message(err);
     }
+    if (HS_LOG_ERROR >= log_threshold)
+        dispatch(HS_LOG_ERROR, last_message);
 
     return err;
 }
@@ -45,6 +45,7 @@
     #elif defined(__linux__)
         #define HAVE_STPCPY
         #define HAVE_ASPRINTF
+        /* #undef HAVE_LINUX_IO_URING_H */
     #else
         #error "Unknown platform, build with CMake instead"
     #endif
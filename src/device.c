@@ -27,6 +27,7 @@
     #include <windows.h>
 #endif
 #include "device_priv.h"
+#include "pool.h"
 #include "hs/monitor.h"
 #include "hs/platform.h"
 
@@ -34,6 +35,41 @@ struct hs_handle {
     _HS_HANDLE
 };
 
+static _hs_pool device_pool = _HS_POOL_INIT(sizeof(hs_device), 64);
+
+hs_device *_hs_device_new(void)
+{
+    hs_device *dev;
+
+    dev = _hs_pool_alloc(&device_pool);
+    if (!dev)
+        return NULL;
+    dev->refcount = 1;
+
+    return dev;
+}
+
+char *_hs_device_strdup(hs_device *dev, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy;
+
+    if (len > sizeof(dev->strings) - dev->strings_len)
+        return _hs_strdup(s);
+
+    copy = dev->strings + dev->strings_len;
+    memcpy(copy, s, len);
+    dev->strings_len += len;
+
+    return copy;
+}
+
+static void free_string(hs_device *dev, char *s)
+{
+    if (s < dev->strings || s >= dev->strings + sizeof(dev->strings))
+        _hs_free(s);
+}
+
 hs_device *hs_device_ref(hs_device *dev)
 {
     assert(dev);
@@ -58,16 +94,16 @@ void hs_device_unref(hs_device *dev)
         __atomic_thread_fence(__ATOMIC_ACQUIRE);
 #endif
 
-        free(dev->key);
-        free(dev->location);
-        free(dev->path);
+        free_string(dev, dev->key);
+        free_string(dev, dev->location);
+        free_string(dev, dev->path);
 
-        free(dev->manufacturer);
-        free(dev->product);
-        free(dev->serial);
+        free_string(dev, dev->manufacturer);
+        free_string(dev, dev->product);
+        free_string(dev, dev->serial);
     }
 
-    free(dev);
+    _hs_pool_free(&device_pool, dev);
 }
 
 hs_device_status hs_device_get_status(const hs_device *dev)
@@ -152,6 +188,10 @@ void hs_handle_close(hs_handle *h)
     if (!h)
         return;
 
+    if (h->reconnect_monitor)
+        _hs_list_remove(&h->reconnect_node);
+    _hs_free(h->stats);
+
     (*h->dev->vtable->close)(h);
 }
 
@@ -166,3 +206,114 @@ hs_descriptor hs_handle_get_descriptor(const hs_handle *h)
     assert(h);
     return (*h->dev->vtable->get_descriptor)(h);
 }
+
+void hs_handle_set_timestamping(hs_handle *h, int enable)
+{
+    assert(h);
+
+    h->timestamping = enable;
+    if (!enable)
+        h->read_timestamp = 0;
+}
+
+uint64_t hs_handle_get_read_timestamp(const hs_handle *h)
+{
+    assert(h);
+    return h->read_timestamp;
+}
+
+int hs_handle_set_stats(hs_handle *h, int enable)
+{
+    assert(h);
+
+    if (enable) {
+        if (!h->stats) {
+            h->stats = _hs_calloc(1, sizeof(*h->stats));
+            if (!h->stats)
+                return hs_error(HS_ERROR_MEMORY, NULL);
+        }
+    } else {
+        _hs_free(h->stats);
+        h->stats = NULL;
+    }
+
+    return 0;
+}
+
+void hs_handle_get_stats(const hs_handle *h, hs_handle_stats *rstats)
+{
+    assert(h);
+    assert(rstats);
+
+    if (h->stats) {
+#ifdef _MSC_VER
+        *rstats = *h->stats;
+#else
+        // The structure only contains counters, load them one by one so they can't tear
+        const uint64_t *src = (const uint64_t *)h->stats;
+        uint64_t *dest = (uint64_t *)rstats;
+
+        for (size_t i = 0; i < sizeof(*rstats) / sizeof(uint64_t); i++)
+            dest[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+#endif
+    } else {
+        memset(rstats, 0, sizeof(*rstats));
+    }
+}
+
+void hs_handle_reset_stats(hs_handle *h)
+{
+    assert(h);
+
+    if (h->stats) {
+        // I/O threads may be updating the counters, clear them one by one
+        uint64_t *counters = (uint64_t *)h->stats;
+
+        for (size_t i = 0; i < sizeof(*h->stats) / sizeof(uint64_t); i++) {
+#ifdef _MSC_VER
+            InterlockedExchange64((volatile LONG64 *)&counters[i], 0);
+#else
+            __atomic_store_n(&counters[i], 0, __ATOMIC_RELAXED);
+#endif
+        }
+    }
+}
+
+static unsigned int stats_bucket(uint64_t start)
+{
+    uint64_t us = (hs_nanos() - start) / 1000;
+    unsigned int bucket = 0;
+
+    while (us && bucket < HS_HANDLE_STATS_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+void _hs_handle_stats_read(hs_handle_stats *stats, ssize_t r, uint64_t start)
+{
+    if (r > 0) {
+        _HS_STATS_INC(stats->reads);
+        _HS_STATS_ADD(stats->read_bytes, r);
+        _HS_STATS_INC(stats->read_wait[stats_bucket(start)]);
+    } else if (r < 0 && r != HS_ERROR_CANCELLED) {
+        _HS_STATS_INC(stats->errors);
+    }
+}
+
+void _hs_handle_stats_write(hs_handle_stats *stats, ssize_t r, size_t size, uint64_t start)
+{
+    if (r > 0) {
+        _HS_STATS_INC(stats->writes);
+        _HS_STATS_ADD(stats->written_bytes, r);
+        if ((size_t)r < size)
+            _HS_STATS_INC(stats->partial_writes);
+        _HS_STATS_INC(stats->write_time[stats_bucket(start)]);
+    } else if (!r && size) {
+        _HS_STATS_INC(stats->eagain);
+    } else if (r < 0 && r != HS_ERROR_CANCELLED) {
+        _HS_STATS_INC(stats->errors);
+    }
+}
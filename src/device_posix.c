@@ -24,47 +24,43 @@
 
 #include "util.h"
 #include <fcntl.h>
+#include <pthread.h>
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "device_posix_priv.h"
+#include "pool.h"
 #include "hs/platform.h"
 
-static int open_posix_device(hs_device *dev, hs_handle **rh)
+static _hs_pool handle_pool = _HS_POOL_INIT(sizeof(hs_handle), 16);
+
+static pthread_mutex_t fd_watches_lock = PTHREAD_MUTEX_INITIALIZER;
+static _HS_LIST(fd_watches);
+
+static int open_device_fd(hs_device *dev)
 {
-    hs_handle *h;
 #ifdef __APPLE__
     unsigned int retry = 4;
 #endif
-    int r;
-
-    h = calloc(1, sizeof(*h));
-    if (!h) {
-        r = hs_error(HS_ERROR_MEMORY, NULL);
-        goto error;
-    }
-    h->dev = hs_device_ref(dev);
+    int fd;
 
 restart:
-    h->fd = open(dev->path, O_RDWR | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
-    if (h->fd < 0) {
+    fd = open(dev->path, O_RDWR | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
         switch (errno) {
         case EINTR:
             goto restart;
         case EACCES:
-            r = hs_error(HS_ERROR_ACCESS, "Permission denied for device '%s'", dev->path);
-            break;
+            return hs_error(HS_ERROR_ACCESS, "Permission denied for device '%s'", dev->path);
         case EIO:
         case ENXIO:
         case ENODEV:
-            r = hs_error(HS_ERROR_IO, "I/O error while opening device '%s'", dev->path);
-            break;
+            return hs_error(HS_ERROR_IO, "I/O error while opening device '%s'", dev->path);
         case ENOENT:
         case ENOTDIR:
-            r = hs_error(HS_ERROR_NOT_FOUND, "Device '%s' not found", dev->path);
-            break;
+            return hs_error(HS_ERROR_NOT_FOUND, "Device '%s' not found", dev->path);
 
 #ifdef __APPLE__
         /* On El Capitan (and maybe before), the open fails for some time (around 40 - 50 ms on my
@@ -76,17 +72,37 @@ restart:
             }
 #endif
         default:
-            r = hs_error(HS_ERROR_SYSTEM, "open('%s') failed: %s", dev->path, strerror(errno));
-            break;
+            return hs_error(HS_ERROR_SYSTEM, "open('%s') failed: %s", dev->path, strerror(errno));
         }
-        goto error;
     }
 
 #ifdef __APPLE__
     if (dev->type == HS_DEVICE_TYPE_SERIAL)
-        ioctl(h->fd, TIOCSDTR);
+        ioctl(fd, TIOCSDTR);
 #endif
 
+    return fd;
+}
+
+static int open_posix_device(hs_device *dev, hs_handle **rh)
+{
+    hs_handle *h;
+    int r;
+
+    h = _hs_pool_alloc(&handle_pool);
+    if (!h) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    h->dev = hs_device_ref(dev);
+    h->vmin = 1;
+
+    h->fd = open_device_fd(dev);
+    if (h->fd < 0) {
+        r = h->fd;
+        goto error;
+    }
+
     *rh = h;
     return 0;
 
@@ -98,11 +114,26 @@ error:
 static void close_posix_device(hs_handle *h)
 {
     if (h) {
+#ifdef __linux__
+        _hs_serial_stop_line_watch(h);
+        if (h->line_event_init)
+            close(h->line_event);
+        if (h->splice_pipe_init) {
+            close(h->splice_pipe[0]);
+            close(h->splice_pipe[1]);
+        }
+#endif
         close(h->fd);
+        if (h->detached)
+            close(h->detach_fd);
+        _hs_free(h->tio_cache);
+        _hs_free(h->tx_ring);
+        _hs_free(h->frame_buf);
+        _hs_free(h->rx_buf);
         hs_device_unref(h->dev);
     }
 
-    free(h);
+    _hs_pool_free(&handle_pool, h);
 }
 
 static hs_descriptor get_posix_descriptor(const hs_handle *h)
@@ -110,9 +141,140 @@ static hs_descriptor get_posix_descriptor(const hs_handle *h)
     return h->fd;
 }
 
+static int reopen_posix_device(hs_handle *h, hs_device *dev)
+{
+    int fd, r;
+
+    fd = open_device_fd(dev);
+    if (fd < 0)
+        return fd;
+
+    // Configure the new descriptor first, the handle stays detached if this fails
+    if (dev->type == HS_DEVICE_TYPE_SERIAL) {
+        r = _hs_serial_restore_attributes(h, fd);
+        if (r < 0) {
+            close(fd);
+            return r;
+        }
+    }
+
+    r = _hs_posix_reattach_fd(h->fd, fd, h->detached ? h->detach_fd : -1);
+    if (r < 0)
+        return r;
+    h->detached = false;
+
+    return 0;
+}
+
+static void detach_posix_device(hs_handle *h)
+{
+#ifdef __linux__
+    // The watcher thread would spin on the placeholder descriptor
+    _hs_serial_stop_line_watch(h);
+#endif
+
+    if (!h->detached && _hs_posix_detach_fd(h->fd, &h->detach_fd) == 0)
+        h->detached = true;
+}
+
 const struct _hs_device_vtable _hs_posix_device_vtable = {
     .open = open_posix_device,
     .close = close_posix_device,
 
-    .get_descriptor = get_posix_descriptor
+    .get_descriptor = get_posix_descriptor,
+
+    .reopen = reopen_posix_device,
+    .detach = detach_posix_device
 };
+
+int _hs_posix_detach_fd(int fd, int *rplaceholder)
+{
+    int pfd[2], r;
+
+    /* Swap in the read end of an empty pipe, so the descriptor number given out by
+       hs_handle_get_descriptor() stays valid and never becomes ready. Keeping the write end
+       open avoids the EOF condition. */
+#ifdef __linux__
+    r = pipe2(pfd, O_CLOEXEC | O_NONBLOCK);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "pipe2() failed: %s", strerror(errno));
+
+    r = dup3(pfd[0], fd, O_CLOEXEC);
+    close(pfd[0]);
+    if (r < 0) {
+        close(pfd[1]);
+        return hs_error(HS_ERROR_SYSTEM, "dup3() failed: %s", strerror(errno));
+    }
+#else
+    r = pipe(pfd);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "pipe() failed: %s", strerror(errno));
+    fcntl(pfd[0], F_SETFL, fcntl(pfd[0], F_GETFL) | O_NONBLOCK);
+
+    r = dup2(pfd[0], fd);
+    close(pfd[0]);
+    if (r < 0) {
+        close(pfd[1]);
+        return hs_error(HS_ERROR_SYSTEM, "dup2() failed: %s", strerror(errno));
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(pfd[1], F_SETFD, FD_CLOEXEC);
+#endif
+
+    *rplaceholder = pfd[1];
+    return 0;
+}
+
+int _hs_posix_reattach_fd(int fd, int new_fd, int placeholder)
+{
+    int r;
+
+    // dup2() closes the old descriptor (placeholder pipe or dead device) atomically
+#ifdef __linux__
+    r = dup3(new_fd, fd, O_CLOEXEC);
+    close(new_fd);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "dup3() failed: %s", strerror(errno));
+#else
+    r = dup2(new_fd, fd);
+    close(new_fd);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "dup2() failed: %s", strerror(errno));
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+
+    if (placeholder >= 0)
+        close(placeholder);
+
+    pthread_mutex_lock(&fd_watches_lock);
+    _hs_list_foreach(cur, &fd_watches) {
+        _hs_fd_watch *watch = _hs_container_of(cur, _hs_fd_watch, node);
+        if (watch->fd == fd)
+            (*watch->f)(watch);
+    }
+    pthread_mutex_unlock(&fd_watches_lock);
+
+    return 0;
+}
+
+void _hs_fd_watch_add(_hs_fd_watch *watch, int fd, void (*f)(_hs_fd_watch *watch))
+{
+    assert(watch);
+    assert(f);
+
+    watch->fd = fd;
+    watch->f = f;
+
+    pthread_mutex_lock(&fd_watches_lock);
+    _hs_list_add_tail(&fd_watches, &watch->node);
+    pthread_mutex_unlock(&fd_watches_lock);
+}
+
+void _hs_fd_watch_remove(_hs_fd_watch *watch)
+{
+    assert(watch);
+
+    pthread_mutex_lock(&fd_watches_lock);
+    _hs_list_remove(&watch->node);
+    pthread_mutex_unlock(&fd_watches_lock);
+}
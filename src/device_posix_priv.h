@@ -26,12 +26,86 @@
 #define _HS_DEVICE_POSIX_PRIV_H
 
 #include "util.h"
+#ifdef __linux__
+    #include <pthread.h>
+#endif
 #include "device_priv.h"
+#include "hs/serial.h"
+
+#define _HS_SERIAL_RX_BUFFER_SIZE 16384
+
+struct termios;
 
 struct hs_handle {
     _HS_HANDLE
 
     int fd;
+
+    // While detached, fd points to a pipe kept open by detach_fd
+    int detach_fd;
+
+    // Last serial settings applied successfully, restored by the reopen function
+    struct termios *tio_cache;
+    uint32_t custom_rate;
+
+    // Receive buffer used by the buffered serial functions, allocated on first use
+    uint8_t *rx_buf;
+    size_t rx_start;
+    size_t rx_end;
+
+    // Serial read tuning (see hs_serial_set_batching and hs_serial_set_spin_budget)
+    uint8_t vmin;
+    uint8_t vtime;
+    unsigned int spin_budget;
+
+    // Non-blocking transmit ring (see hs_serial_set_tx_ring)
+    uint8_t *tx_ring;
+    size_t tx_ring_size;
+    size_t tx_start;
+    size_t tx_len;
+    size_t tx_low;
+    size_t tx_high;
+    bool tx_above_high;
+    hs_serial_tx_watermark_func *tx_watermark_func;
+    void *tx_watermark_udata;
+
+#ifdef __linux__
+    // Intermediate pipe for hs_serial_splice_to() when the target is not a pipe
+    int splice_pipe[2];
+    bool splice_pipe_init;
+    size_t splice_pending;
+    bool splice_unsupported;
+
+    // Modem line watcher (see hs_serial_watch_lines)
+    pthread_t line_thread;
+    bool line_thread_running;
+    bool line_stop;
+    int line_event;
+    bool line_event_init;
+    int line_mask;
+    int line_error;
+
+    // Reapplied after reconnection, like tio_cache
+    bool low_latency;
+#endif
+
+    // Serial framing layer (see hs_serial_set_framing)
+    int framing;
+    bool frame_overflow;
+    bool frame_truncated;
+    uint8_t *frame_buf;
+    size_t frame_buf_size;
 };
 
+// Pull as much as possible from the device into the receive buffer
+ssize_t _hs_serial_fill_rx_buffer(hs_handle *h, int timeout);
+// Reapply the cached serial settings to fd, the descriptor that will replace h->fd
+int _hs_serial_restore_attributes(hs_handle *h, int fd);
+
+#ifdef __linux__
+int _hs_linux_set_serial_rate(hs_handle *h, int fd, uint32_t rate);
+int _hs_linux_set_serial_low_latency(hs_handle *h, int fd, bool enable);
+void _hs_serial_stop_line_watch(hs_handle *h);
+#endif
+
 #endif
@@ -28,15 +28,23 @@
 #include "util.h"
 #include "hs/device.h"
 #include "htable.h"
+#include "list.h"
 
 struct hs_descriptor_set;
 struct hs_monitor;
 
+// Room for the key, path and location of typical devices, see _hs_device_strdup()
+#define _HS_DEVICE_STRINGS_SIZE 320
+
 struct _hs_device_vtable {
     int (*open)(hs_device *dev, hs_handle **rh);
     void (*close)(hs_handle *h);
 
     hs_descriptor (*get_descriptor)(const hs_handle *h);
+
+    // Optional, needed by hs_monitor_register_handle()
+    int (*reopen)(hs_handle *h, hs_device *dev);
+    void (*detach)(hs_handle *h);
 };
 
 struct hs_device {
@@ -63,9 +71,66 @@ struct hs_device {
     char *serial;
 
     uint8_t iface;
+
+    // Set for devices created by hs_virtual_device_new()
+    struct hs_virtual_device *vdev;
+
+    size_t strings_len;
+    char strings[_HS_DEVICE_STRINGS_SIZE];
 };
 
 #define _HS_HANDLE \
-    hs_device *dev;
+    hs_device *dev; \
+    struct hs_cancel_token *cancel; \
+    \
+    bool timestamping; \
+    uint64_t read_timestamp; \
+    hs_handle_stats *stats; \
+    \
+    struct hs_monitor *reconnect_monitor; \
+    _hs_list_head reconnect_node; \
+    /* Set by the detach function while the device is gone */ \
+    bool detached; \
+    \
+    struct hs_capture *capture; \
+    uint16_t capture_device;
+
+/* Devices come from a recycling pool, because they tend to churn. Strings copied with
+   _hs_device_strdup() use the inline storage when they fit, the heap otherwise. */
+hs_device *_hs_device_new(void);
+char *_hs_device_strdup(hs_device *dev, const char *s);
+
+/* A handle can be read from one thread and written from another, and hs_handle_get_stats()
+   can run at any time, so counters are updated atomically. */
+#ifdef _MSC_VER
+    #define _HS_STATS_ADD(counter, value) \
+        InterlockedExchangeAdd64((volatile LONG64 *)&(counter), (LONG64)(value))
+#else
+    #define _HS_STATS_ADD(counter, value) \
+        __atomic_fetch_add(&(counter), (uint64_t)(value), __ATOMIC_RELAXED)
+#endif
+#define _HS_STATS_INC(counter) _HS_STATS_ADD(counter, 1)
+
+// Account for a completed read or write, start is the hs_nanos() value at the start of the call
+void _hs_handle_stats_read(hs_handle_stats *stats, ssize_t r, uint64_t start);
+void _hs_handle_stats_write(hs_handle_stats *stats, ssize_t r, size_t size, uint64_t start);
+
+#ifndef _WIN32
+int _hs_posix_detach_fd(int fd, int *rplaceholder);
+int _hs_posix_reattach_fd(int fd, int new_fd, int placeholder);
+
+/* The reattached descriptor keeps its number but refers to a new file, which drops it from
+   any epoll set. Watches let hs_poller and hs_io_engine add it back, the callback runs in the
+   thread calling _hs_posix_reattach_fd() (usually hs_monitor_refresh()). */
+typedef struct _hs_fd_watch {
+    _hs_list_head node;
+
+    int fd;
+    void (*f)(struct _hs_fd_watch *watch);
+} _hs_fd_watch;
+
+void _hs_fd_watch_add(_hs_fd_watch *watch, int fd, void (*f)(_hs_fd_watch *watch));
+void _hs_fd_watch_remove(_hs_fd_watch *watch);
+#endif
 
 #endif
@@ -51,7 +51,7 @@ static int open_win32_device(hs_device *dev, hs_handle **rh)
     COMMTIMEOUTS timeouts;
     int r;
 
-    h = calloc(1, sizeof(*h));
+    h = _hs_calloc(1, sizeof(*h));
     if (!h) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
@@ -82,7 +82,7 @@ static int open_win32_device(hs_device *dev, hs_handle **rh)
         goto error;
     }
 
-    h->ov = calloc(1, sizeof(*h->ov));
+    h->ov = _hs_calloc(1, sizeof(*h->ov));
     if (!h->ov) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
@@ -94,7 +94,7 @@ static int open_win32_device(hs_device *dev, hs_handle **rh)
         goto error;
     }
 
-    h->buf = malloc(READ_BUFFER_SIZE);
+    h->buf = _hs_malloc(READ_BUFFER_SIZE);
     if (!h->buf) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
@@ -169,13 +169,13 @@ static void close_win32_device(hs_handle *h)
         if (h->handle)
             CloseHandle(h->handle);
 
-        free(h->buf);
+        _hs_free(h->buf);
         if (h->ov && h->ov->hEvent)
             CloseHandle(h->ov->hEvent);
-        free(h->ov);
+        _hs_free(h->ov);
     }
 
-    free(h);
+    _hs_free(h);
 }
 
 static hs_descriptor get_win32_descriptor(const hs_handle *h)
@@ -207,6 +207,11 @@ int _hs_win32_start_async_read(hs_handle *h)
 ssize_t _hs_win32_finalize_async_read(hs_handle *h, int timeout)
 {
     DWORD len, ret;
+    uint64_t start = 0;
+    ssize_t r;
+
+    if (h->stats)
+        start = hs_nanos();
 
     if (timeout > 0)
         WaitForSingleObject(h->ov->hEvent, (DWORD)timeout);
@@ -217,9 +222,42 @@ ssize_t _hs_win32_finalize_async_read(hs_handle *h, int timeout)
             return 0;
 
         h->pending_thread = 0;
-        return hs_error(HS_ERROR_IO, "I/O error while reading from '%s'", h->dev->path);
+        r = hs_error(HS_ERROR_IO, "I/O error while reading from '%s'", h->dev->path);
+        if (h->stats)
+            _hs_handle_stats_read(h->stats, r, start);
+        return r;
     }
     h->pending_thread = 0;
+    if (h->timestamping && len)
+        h->read_timestamp = hs_nanos();
+    if (h->stats)
+        _hs_handle_stats_read(h->stats, (ssize_t)len, start);
 
     return (ssize_t)len;
 }
+
+ssize_t _hs_win32_write_sync(hs_handle *h, const uint8_t *buf, size_t size)
+{
+    OVERLAPPED ov = {0};
+    DWORD len;
+    BOOL success;
+    uint64_t start = 0;
+    ssize_t r;
+
+    if (h->stats)
+        start = hs_nanos();
+
+    success = WriteFile(h->handle, buf, (DWORD)size, NULL, &ov);
+    if (!success && GetLastError() != ERROR_IO_PENDING) {
+        CancelIo(h->handle);
+        r = hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
+    } else if (!GetOverlappedResult(h->handle, &ov, &len, TRUE)) {
+        r = hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
+    } else {
+        r = (ssize_t)len;
+    }
+
+    if (h->stats)
+        _hs_handle_stats_write(h->stats, r, size, start);
+    return r;
+}
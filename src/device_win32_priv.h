@@ -43,6 +43,7 @@ struct hs_handle {
 #ifdef _WIN32
 int _hs_win32_start_async_read(hs_handle *h);
 ssize_t _hs_win32_finalize_async_read(hs_handle *h, int timeout);
+ssize_t _hs_win32_write_sync(hs_handle *h, const uint8_t *buf, size_t size);
 #endif
 
 #endif
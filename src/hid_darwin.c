@@ -29,6 +29,8 @@
 #include <poll.h>
 #include <pthread.h>
 #include <unistd.h>
+#include "cancel_posix_priv.h"
+#include "capture_priv.h"
 #include "device_priv.h"
 #include "hs/hid.h"
 #include "list.h"
@@ -98,6 +100,7 @@ static void hid_removal_callback(void *ctx, IOReturn result, void *sender)
 struct hid_report {
     _hs_list_head list;
 
+    uint64_t timestamp;
     size_t size;
     uint8_t data[];
 };
@@ -132,7 +135,7 @@ static void hid_report_callback(void *ctx, IOReturn result, void *sender,
         }
 
         // Don't forget the leading report ID
-        report = calloc(1, sizeof(struct hid_report) + h->size + 1);
+        report = _hs_calloc(1, sizeof(struct hid_report) + h->size + 1);
         if (!report) {
             r = hs_error(HS_ERROR_MEMORY, NULL);
             goto cleanup;
@@ -144,6 +147,7 @@ static void hid_report_callback(void *ctx, IOReturn result, void *sender,
     if (report_size > (CFIndex)h->size)
         report_size = (CFIndex)h->size;
 
+    report->timestamp = hs_nanos();
     report->data[0] = (uint8_t)report_id;
     memcpy(report->data + 1, report_data, report_size);
     report->size = (size_t)report_size + 1;
@@ -223,7 +227,7 @@ static int open_hid_device(hs_device *dev, hs_handle **rh)
     kern_return_t kret;
     int r;
 
-    h = calloc(1, sizeof(*h));
+    h = _hs_calloc(1, sizeof(*h));
     if (!h) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
@@ -260,7 +264,7 @@ static int open_hid_device(hs_device *dev, hs_handle **rh)
         r = hs_error(HS_ERROR_SYSTEM, "HID device '%s' has no valid report size key", dev->path);
         goto error;
     }
-    h->buf = malloc(h->size);
+    h->buf = _hs_malloc(h->size);
     if (!h->buf) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
@@ -342,13 +346,13 @@ static void close_hid_device(hs_handle *h)
         _hs_list_splice(&h->free_reports, &h->reports);
         _hs_list_foreach(cur, &h->free_reports) {
             struct hid_report *report = _hs_container_of(cur, struct hid_report, list);
-            free(report);
+            _hs_free(report);
         }
 
         close(h->pipe[0]);
         close(h->pipe[1]);
 
-        free(h->buf);
+        _hs_free(h->buf);
 
         if (h->hid) {
             IOHIDDeviceClose(h->hid, 0);
@@ -360,7 +364,7 @@ static void close_hid_device(hs_handle *h)
         hs_device_unref(h->dev);
     }
 
-    free(h);
+    _hs_free(h);
 }
 
 static hs_descriptor get_hid_descriptor(const hs_handle *h)
@@ -398,29 +402,21 @@ ssize_t hs_hid_read(hs_handle *h, uint8_t *buf, size_t size, int timeout)
     assert(size);
 
     struct hid_report *report;
+    uint64_t start = 0;
     ssize_t r;
 
     if (!h->hid)
         return hs_error(HS_ERROR_IO, "Device '%s' was removed", h->dev->path);
 
-    if (timeout) {
-        struct pollfd pfd;
-        uint64_t start;
-
-        pfd.events = POLLIN;
-        pfd.fd = h->pipe[0];
+    if (h->stats)
+        start = hs_nanos();
 
-        start = hs_millis();
-restart:
-        r = poll(&pfd, 1, hs_adjust_timeout(timeout, start));
-        if (r < 0) {
-            if (errno == EINTR)
-                goto restart;
-
-            return hs_error(HS_ERROR_SYSTEM, "poll('%s') failed: %s", h->dev->path, strerror(errno));
-        }
-        if (!r)
-            return 0;
+    if (timeout) {
+        r = _hs_cancel_poll(h->cancel, h->pipe[0], POLLIN, timeout, h->dev->path);
+        if (r <= 0)
+            return r;
+    } else if (_hs_cancel_token_is_triggered(h->cancel)) {
+        return HS_ERROR_CANCELLED;
     }
 
     pthread_mutex_lock(&h->mutex);
@@ -434,6 +430,8 @@ restart:
 
     report = _hs_list_get_first(&h->reports, struct hid_report, list);
     if (!report) {
+        if (h->stats && timeout)
+            _HS_STATS_INC(h->stats->empty_wakeups);
         r = 0;
         goto cleanup;
     }
@@ -442,6 +440,8 @@ restart:
         size = report->size;
     memcpy(buf, report->data, size);
     r = (ssize_t)size;
+    if (h->timestamping)
+        h->read_timestamp = report->timestamp;
 
     _hs_list_remove(&report->list);
     _hs_list_add(&h->free_reports, &report->list);
@@ -452,6 +452,10 @@ reset:
 
 cleanup:
     pthread_mutex_unlock(&h->mutex);
+    if (h->stats)
+        _hs_handle_stats_read(h->stats, r, start);
+    if (h->capture && r > 0)
+        _hs_capture_report(h, _HS_CAPTURE_INPUT, buf, (size_t)r);
     return r;
 }
 
@@ -486,7 +490,18 @@ ssize_t hs_hid_write(hs_handle *h, const uint8_t *buf, size_t size)
     assert(h->dev->type == HS_DEVICE_TYPE_HID);
     assert(buf);
 
-    return send_report(h, kIOHIDReportTypeOutput, buf, size);
+    uint64_t start = 0;
+    ssize_t r;
+
+    if (h->stats)
+        start = hs_nanos();
+    r = send_report(h, kIOHIDReportTypeOutput, buf, size);
+    if (h->stats)
+        _hs_handle_stats_write(h->stats, r, size, start);
+    if (h->capture && r > 0)
+        _hs_capture_report(h, _HS_CAPTURE_OUTPUT, buf, (size_t)r);
+
+    return r;
 }
 
 ssize_t hs_hid_get_feature_report(hs_handle *h, uint8_t report_id, uint8_t *buf, size_t size)
@@ -506,6 +521,9 @@ ssize_t hs_hid_get_feature_report(hs_handle *h, uint8_t report_id, uint8_t *buf,
         return hs_error(HS_ERROR_SYSTEM, "IOHIDDeviceSetReport() failed");
 
     buf[0] = report_id;
+    if (h->capture && len > 0)
+        _hs_capture_report(h, _HS_CAPTURE_GET_FEATURE, buf, (size_t)len);
+
     return (ssize_t)len;
 }
 
@@ -515,5 +533,11 @@ ssize_t hs_hid_send_feature_report(hs_handle *h, const uint8_t *buf, size_t size
     assert(h->dev->type == HS_DEVICE_TYPE_HID);
     assert(buf);
 
-    return send_report(h, kIOHIDReportTypeFeature, buf, size);
+    ssize_t r;
+
+    r = send_report(h, kIOHIDReportTypeFeature, buf, size);
+    if (h->capture && r > 0)
+        _hs_capture_report(h, _HS_CAPTURE_SEND_FEATURE, buf, (size_t)r);
+
+    return r;
 }
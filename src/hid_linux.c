@@ -27,18 +27,30 @@
 #include <linux/hidraw.h>
 #include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include "cancel_posix_priv.h"
+#include "capture_priv.h"
 #include "device_priv.h"
+#include "log_priv.h"
+#include "pool.h"
 #include "hs/hid.h"
 #include "hs/platform.h"
+#include "virtual_priv.h"
 
 struct hs_handle {
     _HS_HANDLE
 
     int fd;
 
+    // While detached, fd points to a pipe kept open by detach_fd
+    int detach_fd;
+
+    // Backed by hs_virtual_device, see virtual_linux.c
+    bool virtual_device;
+
     bool numbered_reports;
     uint16_t usage_page;
     uint16_t usage;
@@ -48,6 +60,8 @@ struct hs_handle {
     size_t buf_size;
 };
 
+static _hs_pool handle_pool = _HS_POOL_INIT(sizeof(hs_handle), 16);
+
 static bool detect_kernel26_byte_bug()
 {
     static bool init, bug;
@@ -64,6 +78,9 @@ static void parse_descriptor(hs_handle *h, struct hidraw_report_descriptor *repo
 {
     unsigned int collection_depth = 0;
 
+    // Reopened handles can get a different descriptor
+    h->numbered_reports = false;
+
     unsigned int size = 0;
     for (size_t i = 0; i < report->size; i += size + 1) {
         unsigned int type;
@@ -84,7 +101,8 @@ static void parse_descriptor(hs_handle *h, struct hidraw_report_descriptor *repo
         type &= 0xFC;
 
         if (i + size >= report->size) {
-            hs_log(HS_LOG_WARNING, "Invalid HID descriptor for device '%s'", h->dev->path);
+            _hs_log_ratelimited(HS_LOG_WARNING, "Invalid HID descriptor for device '%s'",
+                                h->dev->path);
             return;
         }
 
@@ -137,61 +155,100 @@ static void parse_descriptor(hs_handle *h, struct hidraw_report_descriptor *repo
     }
 }
 
-static int open_hidraw_device(hs_device *dev, hs_handle **rh)
+static int open_device_fd(hs_device *dev)
 {
-    hs_handle *h;
-    struct hidraw_report_descriptor report;
-    int size, r;
-
-    h = calloc(1, sizeof(*h));
-    if (!h) {
-        r = hs_error(HS_ERROR_MEMORY, NULL);
-        goto error;
-    }
-    h->dev = hs_device_ref(dev);
+    int fd;
 
 restart:
-    h->fd = open(dev->path, O_RDWR | O_CLOEXEC | O_NONBLOCK);
-    if (h->fd < 0) {
+    fd = open(dev->path, O_RDWR | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
         switch (errno) {
         case EINTR:
             goto restart;
         case EACCES:
-            r = hs_error(HS_ERROR_ACCESS, "Permission denied for device '%s'", dev->path);
-            break;
+            return hs_error(HS_ERROR_ACCESS, "Permission denied for device '%s'", dev->path);
         case EIO:
         case ENXIO:
         case ENODEV:
-            r = hs_error(HS_ERROR_IO, "I/O error while opening device '%s'", dev->path);
-            break;
+            return hs_error(HS_ERROR_IO, "I/O error while opening device '%s'", dev->path);
         case ENOENT:
         case ENOTDIR:
-            r = hs_error(HS_ERROR_NOT_FOUND, "Device '%s' not found", dev->path);
-            break;
+            return hs_error(HS_ERROR_NOT_FOUND, "Device '%s' not found", dev->path);
 
         default:
-            r = hs_error(HS_ERROR_SYSTEM, "open('%s') failed: %s", dev->path, strerror(errno));
-            break;
+            return hs_error(HS_ERROR_SYSTEM, "open('%s') failed: %s", dev->path, strerror(errno));
         }
-        goto error;
     }
 
-    r = ioctl(h->fd, HIDIOCGRDESCSIZE, &size);
-    if (r < 0) {
-        r = hs_error(HS_ERROR_SYSTEM, "ioctl('%s', HIDIOCGRDESCSIZE) failed: %s", h->dev->path,
-                     strerror(errno));
+    return fd;
+}
+
+static int read_descriptor(hs_handle *h, hs_device *dev, int fd)
+{
+    struct hidraw_report_descriptor report;
+    int size, r;
+
+    r = ioctl(fd, HIDIOCGRDESCSIZE, &size);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "ioctl('%s', HIDIOCGRDESCSIZE) failed: %s", dev->path,
+                        strerror(errno));
+    report.size = (uint32_t)size;
+
+    r = ioctl(fd, HIDIOCGRDESC, &report);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "ioctl('%s', HIDIOCGRDESC) failed: %s", dev->path,
+                        strerror(errno));
+
+    h->numbered_reports = false;
+    h->usage_page = 0;
+    h->usage = 0;
+    parse_descriptor(h, &report);
+
+    return 0;
+}
+
+// Reports never exceed HID_MAX_BUFFER_SIZE (4096 bytes), plus the report ID byte
+#define KERNEL26_BUFFER_SIZE (4096 + 1)
+
+static int prepare_kernel26_buffer(hs_handle *h)
+{
+    /* Allocate the bounce buffer for the Linux 2.6.28 hidraw bug here and not in
+       hs_hid_read(), reads are not supposed to touch the heap. */
+    if (!h->numbered_reports || h->buf || !detect_kernel26_byte_bug())
+        return 0;
+
+    h->buf = _hs_malloc(KERNEL26_BUFFER_SIZE);
+    if (!h->buf)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    h->buf_size = KERNEL26_BUFFER_SIZE;
+
+    return 0;
+}
+
+static int open_hidraw_device(hs_device *dev, hs_handle **rh)
+{
+    hs_handle *h;
+    int r;
+
+    h = _hs_pool_alloc(&handle_pool);
+    if (!h) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
     }
-    report.size = (uint32_t)size;
+    h->dev = hs_device_ref(dev);
 
-    r = ioctl(h->fd, HIDIOCGRDESC, &report);
-    if (r < 0) {
-        r = hs_error(HS_ERROR_SYSTEM, "ioctl('%s', HIDIOCGRDESC) failed: %s", h->dev->path,
-                     strerror(errno));
+    h->fd = open_device_fd(dev);
+    if (h->fd < 0) {
+        r = h->fd;
         goto error;
     }
 
-    parse_descriptor(h, &report);
+    r = read_descriptor(h, dev, h->fd);
+    if (r < 0)
+        goto error;
+    r = prepare_kernel26_buffer(h);
+    if (r < 0)
+        goto error;
 
     *rh = h;
     return 0;
@@ -204,13 +261,15 @@ error:
 static void close_hidraw_device(hs_handle *h)
 {
     if (h) {
-        free(h->buf);
+        _hs_free(h->buf);
 
         close(h->fd);
+        if (h->detached)
+            close(h->detach_fd);
         hs_device_unref(h->dev);
     }
 
-    free(h);
+    _hs_pool_free(&handle_pool, h);
 }
 
 static hs_descriptor get_hidraw_descriptor(const hs_handle *h)
@@ -218,13 +277,130 @@ static hs_descriptor get_hidraw_descriptor(const hs_handle *h)
     return h->fd;
 }
 
+static int reopen_hidraw_device(hs_handle *h, hs_device *dev)
+{
+    int fd, r;
+
+    fd = open_device_fd(dev);
+    if (fd < 0)
+        return fd;
+
+    // A firmware update can change the report layout without changing VID/PID
+    r = read_descriptor(h, dev, fd);
+    if (r >= 0)
+        r = prepare_kernel26_buffer(h);
+    if (r < 0) {
+        close(fd);
+        return r;
+    }
+
+    r = _hs_posix_reattach_fd(h->fd, fd, h->detached ? h->detach_fd : -1);
+    if (r < 0)
+        return r;
+    h->detached = false;
+
+    return 0;
+}
+
+static void detach_hidraw_device(hs_handle *h)
+{
+    if (!h->detached && _hs_posix_detach_fd(h->fd, &h->detach_fd) == 0)
+        h->detached = true;
+}
+
 const struct _hs_device_vtable _hs_linux_hid_vtable = {
     .open = open_hidraw_device,
     .close = close_hidraw_device,
 
-    .get_descriptor = get_hidraw_descriptor
+    .get_descriptor = get_hidraw_descriptor,
+
+    .reopen = reopen_hidraw_device,
+    .detach = detach_hidraw_device
 };
 
+static void parse_virtual_descriptor(hs_handle *h, hs_device *dev)
+{
+    struct hidraw_report_descriptor report;
+
+    report.size = (uint32_t)dev->vdev->report_descriptor_size;
+    if (report.size > sizeof(report.value))
+        report.size = sizeof(report.value);
+    if (report.size)
+        memcpy(report.value, dev->vdev->report_descriptor, report.size);
+    parse_descriptor(h, &report);
+}
+
+static int open_virtual_hid_device(hs_device *dev, hs_handle **rh)
+{
+    hs_handle *h;
+    int r;
+
+    h = _hs_pool_alloc(&handle_pool);
+    if (!h) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    h->dev = hs_device_ref(dev);
+    h->virtual_device = true;
+
+    if (!dev->vdev) {
+        h->fd = -1;
+        r = hs_error(HS_ERROR_NOT_FOUND, "Device '%s' not found", dev->path);
+        goto error;
+    }
+
+    h->fd = fcntl(dev->vdev->host_fd, F_DUPFD_CLOEXEC, 0);
+    if (h->fd < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "fcntl(F_DUPFD_CLOEXEC) failed: %s", strerror(errno));
+        goto error;
+    }
+    parse_virtual_descriptor(h, dev);
+
+    *rh = h;
+    return 0;
+
+error:
+    hs_handle_close(h);
+    return r;
+}
+
+static int reopen_virtual_hid_device(hs_handle *h, hs_device *dev)
+{
+    int fd, r;
+
+    if (!dev->vdev)
+        return hs_error(HS_ERROR_NOT_FOUND, "Device '%s' not found", dev->path);
+
+    fd = fcntl(dev->vdev->host_fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0)
+        return hs_error(HS_ERROR_SYSTEM, "fcntl(F_DUPFD_CLOEXEC) failed: %s", strerror(errno));
+
+    r = _hs_posix_reattach_fd(h->fd, fd, h->detached ? h->detach_fd : -1);
+    if (r < 0)
+        return r;
+    h->detached = false;
+
+    // The matching device may come from another virtual device, with its own descriptor
+    parse_virtual_descriptor(h, dev);
+
+    return 0;
+}
+
+const struct _hs_device_vtable _hs_linux_virtual_hid_vtable = {
+    .open = open_virtual_hid_device,
+    .close = close_hidraw_device,
+
+    .get_descriptor = get_hidraw_descriptor,
+
+    .reopen = reopen_virtual_hid_device,
+    .detach = detach_hidraw_device
+};
+
+bool _hs_linux_hid_has_numbered_reports(const hs_handle *h)
+{
+    return h->numbered_reports;
+}
+
 int hs_hid_parse_descriptor(hs_handle *h, hs_hid_descriptor *desc)
 {
     assert(h);
@@ -244,42 +420,27 @@ ssize_t hs_hid_read(hs_handle *h, uint8_t *buf, size_t size, int timeout)
     assert(buf);
     assert(size);
 
+    uint64_t start = 0;
     ssize_t r;
 
-    if (timeout) {
-        struct pollfd pfd;
-        uint64_t start;
-
-        pfd.events = POLLIN;
-        pfd.fd = h->fd;
-
-        start = hs_millis();
-restart:
-        r = poll(&pfd, 1, hs_adjust_timeout(timeout, start));
-        if (r < 0) {
-            if (errno == EINTR)
-                goto restart;
+    if (h->stats)
+        start = hs_nanos();
 
-            return hs_error(HS_ERROR_SYSTEM, "poll('%s') failed: %s", h->dev->path,
-                            strerror(errno));
-        }
-        if (!r)
-            return 0;
+    if (timeout) {
+        r = _hs_cancel_poll(h->cancel, h->fd, POLLIN, timeout, h->dev->path);
+        if (r <= 0)
+            return r;
+    } else if (_hs_cancel_token_is_triggered(h->cancel)) {
+        return HS_ERROR_CANCELLED;
     }
 
     if (h->numbered_reports) {
         /* Work around a hidraw bug introduced in Linux 2.6.28 and fixed in Linux 2.6.34, see
            https://git.kernel.org/cgit/linux/kernel/git/torvalds/linux.git/commit/?id=5a38f2c7c4dd53d5be097930902c108e362584a3 */
-        if (detect_kernel26_byte_bug()) {
-            if (size + 1 > h->buf_size) {
-                free(h->buf);
-                h->buf_size = 0;
-
-                h->buf = malloc(size + 1);
-                if (!h->buf)
-                    return hs_error(HS_ERROR_MEMORY, NULL);
-                h->buf_size = size + 1;
-            }
+        if (!h->virtual_device && detect_kernel26_byte_bug()) {
+            // Preallocated at open, no report can be bigger
+            if (size + 1 > h->buf_size)
+                size = h->buf_size - 1;
 
             r = read(h->fd, h->buf, size + 1);
             if (r > 0)
@@ -294,20 +455,37 @@ restart:
             r++;
         }
     }
-    if (r < 0) {
+    if (h->timestamping && r > 0)
+        h->read_timestamp = hs_nanos();
+    if (!r && h->virtual_device) {
+        // The peer side of the virtual device was closed
+        r = hs_error(HS_ERROR_IO, "Device '%s' was removed", h->dev->path);
+    } else if (r < 0) {
         switch (errno) {
         case EAGAIN:
 #if defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
         case EWOULDBLOCK:
 #endif
+            if (h->stats) {
+                _HS_STATS_INC(h->stats->eagain);
+                if (timeout)
+                    _HS_STATS_INC(h->stats->empty_wakeups);
+            }
             return 0;
         case EIO:
         case ENXIO:
-            return hs_error(HS_ERROR_IO, "I/O error while reading from '%s'", h->dev->path);
+            r = hs_error(HS_ERROR_IO, "I/O error while reading from '%s'", h->dev->path);
+            break;
+        default:
+            r = hs_error(HS_ERROR_SYSTEM, "read('%s') failed: %s", h->dev->path, strerror(errno));
+            break;
         }
-        return hs_error(HS_ERROR_SYSTEM, "read('%s') failed: %s", h->dev->path, strerror(errno));
     }
 
+    if (h->stats)
+        _hs_handle_stats_read(h->stats, r, start);
+    if (h->capture && r > 0)
+        _hs_capture_report(h, _HS_CAPTURE_INPUT, buf, (size_t)r);
     return r;
 }
 
@@ -319,23 +497,57 @@ ssize_t hs_hid_write(hs_handle *h, const uint8_t *buf, size_t size)
 
     if (size < 2)
         return 0;
+    if (_hs_cancel_token_is_triggered(h->cancel))
+        return HS_ERROR_CANCELLED;
+    if (h->detached)
+        return hs_error(HS_ERROR_IO, "Device '%s' is disconnected", h->dev->path);
 
+    uint64_t start = 0;
     ssize_t r;
 
+    if (h->stats)
+        start = hs_nanos();
+
 restart:
-    // On linux, USB requests timeout after 5000ms and O_NONBLOCK isn't honoured for write
-    r = write(h->fd, (const char *)buf, size);
+    if (h->virtual_device) {
+        // The peer may be gone, which must not raise SIGPIPE
+        r = send(h->fd, buf, size, MSG_NOSIGNAL);
+    } else {
+        // On linux, USB requests timeout after 5000ms and O_NONBLOCK isn't honoured for write
+        r = write(h->fd, (const char *)buf, size);
+    }
     if (r < 0) {
         switch (errno) {
         case EINTR:
             goto restart;
+        case EAGAIN:
+            // Hidraw writes block, make virtual devices behave the same when the peer lags
+            if (h->virtual_device) {
+                r = _hs_cancel_poll(h->cancel, h->fd, POLLOUT, -1, h->dev->path);
+                if (r < 0)
+                    break;
+                goto restart;
+            }
+            r = hs_error(HS_ERROR_SYSTEM, "write('%s') failed: %s", h->dev->path,
+                         strerror(errno));
+            break;
         case EIO:
         case ENXIO:
-            return hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
+        case EPIPE:
+        case ECONNRESET:
+            r = hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
+            break;
+        default:
+            r = hs_error(HS_ERROR_SYSTEM, "write('%s') failed: %s", h->dev->path,
+                         strerror(errno));
+            break;
         }
-        return hs_error(HS_ERROR_SYSTEM, "write('%s') failed: %s", h->dev->path, strerror(errno));
     }
 
+    if (h->stats)
+        _hs_handle_stats_write(h->stats, r, size, start);
+    if (h->capture && r > 0)
+        _hs_capture_report(h, _HS_CAPTURE_OUTPUT, buf, (size_t)r);
     return r;
 }
 
@@ -348,6 +560,15 @@ ssize_t hs_hid_get_feature_report(hs_handle *h, uint8_t report_id, uint8_t *buf,
 
     ssize_t r;
 
+    if (h->detached)
+        return hs_error(HS_ERROR_IO, "Device '%s' is disconnected", h->dev->path);
+
+    if (h->virtual_device) {
+        buf[0] = report_id;
+        r = _hs_virtual_feature_report(h->dev, false, buf, size);
+        goto finish;
+    }
+
     if (size >= 2)
         buf[1] = report_id;
 
@@ -366,7 +587,12 @@ restart:
     }
 
     buf[0] = report_id;
-    return r + 1;
+    r++;
+
+finish:
+    if (h->capture && r > 0)
+        _hs_capture_report(h, _HS_CAPTURE_GET_FEATURE, buf, (size_t)r);
+    return r;
 }
 
 ssize_t hs_hid_send_feature_report(hs_handle *h, const uint8_t *buf, size_t size)
@@ -377,9 +603,16 @@ ssize_t hs_hid_send_feature_report(hs_handle *h, const uint8_t *buf, size_t size
 
     if (size < 2)
         return 0;
+    if (h->detached)
+        return hs_error(HS_ERROR_IO, "Device '%s' is disconnected", h->dev->path);
 
     ssize_t r;
 
+    if (h->virtual_device) {
+        r = _hs_virtual_feature_report(h->dev, true, (uint8_t *)buf, size);
+        goto finish;
+    }
+
 restart:
     r = ioctl(h->fd, HIDIOCSFEATURE(size), (const char *)buf);
     if (r < 0) {
@@ -394,5 +627,8 @@ restart:
                         strerror(errno));
     }
 
+finish:
+    if (h->capture && r > 0)
+        _hs_capture_report(h, _HS_CAPTURE_SEND_FEATURE, buf, (size_t)r);
     return r;
 }
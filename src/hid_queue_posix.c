@@ -0,0 +1,308 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "device_priv.h"
+#include "hs/hid.h"
+#include "hs/platform.h"
+
+struct write_request {
+    uint8_t *buf;
+    size_t buf_size;
+    size_t size;
+
+    uint64_t deadline;
+    void *udata;
+
+    ssize_t r;
+};
+
+struct hs_hid_write_queue {
+    hs_handle *h;
+
+    pthread_mutex_t mutex;
+    bool mutex_init;
+    pthread_cond_t cond;
+    bool cond_init;
+    pthread_t thread;
+    bool thread_init;
+    bool stop;
+
+    int pipe[2];
+    bool notified;
+
+    /* The requests are executed in order by a single thread, so one ring is enough. Slots
+       in [reap, exec) are completed, slots in [exec, push) wait to be executed. */
+    struct write_request *requests;
+    unsigned int depth;
+    uint64_t push;
+    uint64_t exec;
+    uint64_t reap;
+};
+
+static void fire_completion_event(hs_hid_write_queue *queue)
+{
+    char buf = '.';
+
+    if (!queue->notified && write(queue->pipe[1], &buf, 1) == 1)
+        queue->notified = true;
+}
+
+static void reset_completion_event(hs_hid_write_queue *queue)
+{
+    char buf[64];
+
+    if (queue->notified) {
+        while (read(queue->pipe[0], buf, sizeof(buf)) > 0)
+            continue;
+        queue->notified = false;
+    }
+}
+
+static void *writer_thread(void *ptr)
+{
+    hs_hid_write_queue *queue = ptr;
+
+    pthread_mutex_lock(&queue->mutex);
+    while (true) {
+        while (!queue->stop && queue->exec == queue->push)
+            pthread_cond_wait(&queue->cond, &queue->mutex);
+        if (queue->stop)
+            break;
+
+        struct write_request *req = &queue->requests[queue->exec % queue->depth];
+        pthread_mutex_unlock(&queue->mutex);
+
+        // Requests that waited too long behind a stalled one are completed without being sent
+        if (req->deadline && hs_millis() > req->deadline) {
+            req->r = 0;
+        } else {
+            req->r = hs_hid_write(queue->h, req->buf, req->size);
+        }
+
+        pthread_mutex_lock(&queue->mutex);
+        queue->exec++;
+        fire_completion_event(queue);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return NULL;
+}
+
+int hs_hid_write_queue_new(hs_handle *h, unsigned int depth, hs_hid_write_queue **rqueue)
+{
+    assert(h);
+    assert(hs_device_get_type(hs_handle_get_device(h)) == HS_DEVICE_TYPE_HID);
+    assert(depth);
+    assert(rqueue);
+
+    hs_hid_write_queue *queue;
+    int r;
+
+    queue = _hs_calloc(1, sizeof(*queue));
+    if (!queue) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    queue->h = h;
+    queue->pipe[0] = -1;
+    queue->pipe[1] = -1;
+
+    queue->requests = _hs_calloc(depth, sizeof(*queue->requests));
+    if (!queue->requests) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    queue->depth = depth;
+
+    // Don't leak the pipe into child processes
+#ifdef __linux__
+    r = pipe2(queue->pipe, O_CLOEXEC | O_NONBLOCK);
+    if (r < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "pipe2() failed: %s", strerror(errno));
+        goto error;
+    }
+#else
+    r = pipe(queue->pipe);
+    if (r < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "pipe() failed: %s", strerror(errno));
+        goto error;
+    }
+    for (unsigned int i = 0; i < 2; i++) {
+        fcntl(queue->pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(queue->pipe[i], F_SETFL, fcntl(queue->pipe[i], F_GETFL, 0) | O_NONBLOCK);
+    }
+#endif
+
+    r = pthread_mutex_init(&queue->mutex, NULL);
+    if (r) {
+        r = hs_error(HS_ERROR_SYSTEM, "pthread_mutex_init() failed: %s", strerror(r));
+        goto error;
+    }
+    queue->mutex_init = true;
+
+    r = pthread_cond_init(&queue->cond, NULL);
+    if (r) {
+        r = hs_error(HS_ERROR_SYSTEM, "pthread_cond_init() failed: %s", strerror(r));
+        goto error;
+    }
+    queue->cond_init = true;
+
+    r = pthread_create(&queue->thread, NULL, writer_thread, queue);
+    if (r) {
+        r = hs_error(HS_ERROR_SYSTEM, "pthread_create() failed: %s", strerror(r));
+        goto error;
+    }
+    queue->thread_init = true;
+
+    *rqueue = queue;
+    return 0;
+
+error:
+    hs_hid_write_queue_free(queue);
+    return r;
+}
+
+void hs_hid_write_queue_free(hs_hid_write_queue *queue)
+{
+    if (queue) {
+        if (queue->thread_init) {
+            pthread_mutex_lock(&queue->mutex);
+            queue->stop = true;
+            pthread_cond_signal(&queue->cond);
+            pthread_mutex_unlock(&queue->mutex);
+
+            pthread_join(queue->thread, NULL);
+        }
+
+        if (queue->cond_init)
+            pthread_cond_destroy(&queue->cond);
+        if (queue->mutex_init)
+            pthread_mutex_destroy(&queue->mutex);
+
+        close(queue->pipe[0]);
+        close(queue->pipe[1]);
+
+        if (queue->requests) {
+            for (unsigned int i = 0; i < queue->depth; i++)
+                _hs_free(queue->requests[i].buf);
+            _hs_free(queue->requests);
+        }
+    }
+
+    _hs_free(queue);
+}
+
+hs_descriptor hs_hid_write_queue_get_descriptor(const hs_hid_write_queue *queue)
+{
+    assert(queue);
+    return queue->pipe[0];
+}
+
+int hs_hid_write_queue_push(hs_hid_write_queue *queue, const uint8_t *buf, size_t size,
+                            int timeout, void *udata)
+{
+    assert(queue);
+    assert(buf);
+
+    struct write_request *req;
+    int r;
+
+    pthread_mutex_lock(&queue->mutex);
+
+    if (queue->push - queue->reap == queue->depth) {
+        r = 0;
+        goto cleanup;
+    }
+
+    /* The slot is not used by the writer thread until push is incremented, and its buffer
+       is kept around to avoid allocations in the steady state. */
+    req = &queue->requests[queue->push % queue->depth];
+    if (size > req->buf_size) {
+        uint8_t *new_buf = _hs_realloc(req->buf, size);
+        if (!new_buf) {
+            r = hs_error(HS_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+        req->buf = new_buf;
+        req->buf_size = size;
+    }
+    if (size)
+        memcpy(req->buf, buf, size);
+    req->size = size;
+    req->deadline = timeout >= 0 ? hs_millis() + (uint64_t)timeout : 0;
+    req->udata = udata;
+    req->r = 0;
+
+    if (queue->push++ == queue->exec)
+        pthread_cond_signal(&queue->cond);
+
+    r = 1;
+cleanup:
+    pthread_mutex_unlock(&queue->mutex);
+    return r;
+}
+
+int hs_hid_write_queue_reap(hs_hid_write_queue *queue, hs_hid_write_completion *completions,
+                            unsigned int count)
+{
+    assert(queue);
+    assert(completions || !count);
+
+    unsigned int reaped = 0;
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (reaped < count && queue->reap != queue->exec) {
+        struct write_request *req = &queue->requests[queue->reap % queue->depth];
+
+        completions[reaped].udata = req->udata;
+        completions[reaped].r = req->r;
+
+        queue->reap++;
+        reaped++;
+    }
+    if (queue->reap == queue->exec)
+        reset_completion_event(queue);
+
+    pthread_mutex_unlock(&queue->mutex);
+
+    return (int)reaped;
+}
+
+unsigned int hs_hid_write_queue_get_pending(hs_hid_write_queue *queue)
+{
+    assert(queue);
+
+    unsigned int pending;
+
+    pthread_mutex_lock(&queue->mutex);
+    pending = (unsigned int)(queue->push - queue->exec);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return pending;
+}
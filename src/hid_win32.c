@@ -114,21 +114,7 @@ ssize_t hs_hid_write(hs_handle *h, const uint8_t *buf, size_t size)
     if (size < 2)
         return 0;
 
-    OVERLAPPED ov = {0};
-    DWORD len;
-    BOOL success;
-
-    success = WriteFile(h->handle, buf, (DWORD)size, NULL, &ov);
-    if (!success && GetLastError() != ERROR_IO_PENDING) {
-        CancelIo(h->handle);
-        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
-    }
-
-    success = GetOverlappedResult(h->handle, &ov, &len, TRUE);
-    if (!success)
-        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
-
-    return (ssize_t)len;
+    return _hs_win32_write_sync(h, buf, size);
 }
 
 ssize_t hs_hid_get_feature_report(hs_handle *h, uint8_t report_id, uint8_t *buf, size_t size)
@@ -27,7 +27,7 @@
 
 int _hs_htable_init(_hs_htable *table, unsigned int size)
 {
-    table->heads = malloc(size * sizeof(*table->heads));
+    table->heads = _hs_malloc(size * sizeof(*table->heads));
     if (!table->heads)
         return hs_error(HS_ERROR_MEMORY, NULL);
     table->size = size;
@@ -39,7 +39,7 @@ int _hs_htable_init(_hs_htable *table, unsigned int size)
 
 void _hs_htable_release(_hs_htable *table)
 {
-    free(table->heads);
+    _hs_free(table->heads);
 }
 
 _hs_htable_head *_hs_htable_get_head(_hs_htable *table, uint32_t key)
@@ -0,0 +1,871 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+    #include <linux/io_uring.h>
+    #define HAVE_IO_URING
+#endif
+#include "device_priv.h"
+#include "list.h"
+#include "hs/io.h"
+#include "hs/platform.h"
+
+struct io_op {
+    _hs_list_head list;
+
+    hs_handle *h;
+    hs_io_op op;
+    void *udata;
+
+    int fd;
+    struct iovec iov;
+    // Set for HID devices without numbered reports, see hs_hid_read()
+    uint8_t *report_id;
+
+    int poll_res;
+    bool inflight;
+    ssize_t r;
+};
+
+struct fd_entry {
+    _hs_fd_watch watch;
+
+    struct hs_io_engine *engine;
+    int fd;
+    uint32_t events;
+    _hs_list_head ops;
+};
+
+struct hs_io_engine {
+    hs_io_backend backend;
+
+    struct io_op *ops;
+    unsigned int ops_count;
+    _hs_list_head free_ops;
+    _hs_list_head completed_ops;
+
+    // epoll backend
+    int epfd;
+    // Indexed by descriptor, which the kernel keeps small and dense
+    struct fd_entry **fds;
+    unsigned int fds_size;
+    _hs_list_head queued_ops;
+
+#ifdef HAVE_IO_URING
+    int ring_fd;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    unsigned int sq_local_tail;
+    unsigned int sq_pending;
+    // Operations the kernel may still be using, their iovec lives in ops
+    unsigned int uring_inflight;
+#endif
+};
+
+bool _hs_linux_hid_has_numbered_reports(const hs_handle *h);
+
+static ssize_t finalize_op(struct io_op *op, ssize_t res)
+{
+    if (res < 0) {
+        const char *path = hs_device_get_path(hs_handle_get_device(op->h));
+
+        switch (-res) {
+        case EIO:
+        case ENXIO:
+            if (op->op == HS_IO_READ)
+                return hs_error(HS_ERROR_IO, "I/O error while reading from '%s'", path);
+            return hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", path);
+        }
+        if (op->op == HS_IO_READ)
+            return hs_error(HS_ERROR_SYSTEM, "read('%s') failed: %s", path, strerror((int)-res));
+        return hs_error(HS_ERROR_SYSTEM, "write('%s') failed: %s", path, strerror((int)-res));
+    }
+
+    if (op->report_id && res > 0) {
+        *op->report_id = 0;
+        res++;
+    }
+
+    return res;
+}
+
+static unsigned int reap_completed_ops(hs_io_engine *engine, hs_io_completion *completions,
+                                       unsigned int count)
+{
+    unsigned int reaped = 0;
+
+    _hs_list_foreach(cur, &engine->completed_ops) {
+        struct io_op *op = _hs_container_of(cur, struct io_op, list);
+
+        if (reaped == count)
+            break;
+
+        completions[reaped].h = op->h;
+        completions[reaped].op = op->op;
+        completions[reaped].udata = op->udata;
+        completions[reaped].r = op->r;
+        reaped++;
+
+        _hs_list_remove(&op->list);
+        _hs_list_add(&engine->free_ops, &op->list);
+    }
+
+    return reaped;
+}
+
+static void complete_op(hs_io_engine *engine, struct io_op *op, ssize_t res)
+{
+    op->r = finalize_op(op, res);
+    _hs_list_add_tail(&engine->completed_ops, &op->list);
+}
+
+static uint32_t compute_fd_events(struct fd_entry *entry)
+{
+    uint32_t events = 0;
+
+    _hs_list_foreach(cur, &entry->ops) {
+        struct io_op *op = _hs_container_of(cur, struct io_op, list);
+        events |= (op->op == HS_IO_READ) ? EPOLLIN : EPOLLOUT;
+    }
+
+    return events;
+}
+
+static int update_fd_entry(hs_io_engine *engine, struct fd_entry *entry)
+{
+    uint32_t events = compute_fd_events(entry);
+    int r;
+
+    if (events == entry->events)
+        return 0;
+
+    if (events) {
+        struct epoll_event ev = {0};
+
+        ev.events = events;
+        ev.data.ptr = entry;
+
+        r = epoll_ctl(engine->epfd, entry->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, entry->fd, &ev);
+        // The kernel drops the registration when a monitored handle gets detached
+        if (r < 0 && errno == ENOENT && entry->events)
+            r = epoll_ctl(engine->epfd, EPOLL_CTL_ADD, entry->fd, &ev);
+    } else {
+        r = epoll_ctl(engine->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+        if (r < 0 && errno == ENOENT)
+            r = 0;
+    }
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "epoll_ctl() failed: %s", strerror(errno));
+    entry->events = events;
+
+    return 0;
+}
+
+static void reregister_fd_entry(_hs_fd_watch *watch)
+{
+    struct fd_entry *entry = _hs_container_of(watch, struct fd_entry, watch);
+    struct epoll_event ev = {0};
+    int r;
+
+    if (!entry->events)
+        return;
+
+    ev.events = entry->events;
+    ev.data.ptr = entry;
+
+    r = epoll_ctl(entry->engine->epfd, EPOLL_CTL_ADD, entry->fd, &ev);
+    if (r < 0 && errno == EEXIST)
+        r = epoll_ctl(entry->engine->epfd, EPOLL_CTL_MOD, entry->fd, &ev);
+    if (r < 0)
+        hs_log(HS_LOG_WARNING, "Failed to add descriptor %d back to I/O engine: %s", entry->fd,
+               strerror(errno));
+}
+
+static int grow_fd_entries(hs_io_engine *engine, int fd)
+{
+    struct fd_entry **fds;
+    unsigned int size;
+
+    if ((unsigned int)fd < engine->fds_size)
+        return 0;
+
+    size = engine->fds_size ? engine->fds_size : 64;
+    while (size <= (unsigned int)fd)
+        size *= 2;
+
+    fds = _hs_realloc(engine->fds, size * sizeof(*fds));
+    if (!fds)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    memset(fds + engine->fds_size, 0, (size - engine->fds_size) * sizeof(*fds));
+    engine->fds = fds;
+    engine->fds_size = size;
+
+    return 0;
+}
+
+static int epoll_submit(hs_io_engine *engine)
+{
+    int r;
+
+    _hs_list_foreach(cur, &engine->queued_ops) {
+        struct io_op *op = _hs_container_of(cur, struct io_op, list);
+        struct fd_entry *entry;
+
+        r = grow_fd_entries(engine, op->fd);
+        if (r < 0)
+            return r;
+
+        entry = engine->fds[op->fd];
+        if (!entry) {
+            entry = _hs_calloc(1, sizeof(*entry));
+            if (!entry)
+                return hs_error(HS_ERROR_MEMORY, NULL);
+            entry->engine = engine;
+            entry->fd = op->fd;
+            _hs_list_init(&entry->ops);
+
+            engine->fds[op->fd] = entry;
+            _hs_fd_watch_add(&entry->watch, op->fd, reregister_fd_entry);
+        }
+
+        _hs_list_remove(&op->list);
+        _hs_list_add_tail(&entry->ops, &op->list);
+
+        r = update_fd_entry(engine, entry);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+static int process_fd_entry(hs_io_engine *engine, struct fd_entry *entry, uint32_t events)
+{
+    _hs_list_foreach(cur, &entry->ops) {
+        struct io_op *op = _hs_container_of(cur, struct io_op, list);
+        ssize_t res;
+
+        if (op->op == HS_IO_READ) {
+            if (!(events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+                continue;
+            res = readv(op->fd, &op->iov, 1);
+        } else {
+            if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+                continue;
+            res = writev(op->fd, &op->iov, 1);
+        }
+        if (res < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                continue;
+            res = -errno;
+        }
+
+        _hs_list_remove(&op->list);
+        complete_op(engine, op, res);
+    }
+
+    return update_fd_entry(engine, entry);
+}
+
+static int epoll_reap(hs_io_engine *engine, int timeout)
+{
+    struct epoll_event events[64];
+    uint64_t start;
+    int r;
+
+    start = hs_millis();
+restart:
+    r = epoll_wait(engine->epfd, events, _HS_COUNTOF(events), hs_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+        return hs_error(HS_ERROR_SYSTEM, "epoll_wait() failed: %s", strerror(errno));
+    }
+
+    for (int i = 0; i < r; i++) {
+        struct fd_entry *entry = events[i].data.ptr;
+        int r2;
+
+        r2 = process_fd_entry(engine, entry, events[i].events);
+        if (r2 < 0)
+            return r2;
+    }
+
+    // Readiness does not guarantee success, try again if nothing actually completed
+    if (r && _hs_list_is_empty(&engine->completed_ops) && hs_adjust_timeout(timeout, start))
+        goto restart;
+
+    return 0;
+}
+
+#ifdef HAVE_IO_URING
+
+// Completions of IORING_OP_ASYNC_CANCEL requests, ignored by uring_process_completions()
+#define URING_CANCEL_USER_DATA UINT64_MAX
+
+static int uring_init(hs_io_engine *engine, unsigned int depth)
+{
+    struct io_uring_params params = {0};
+    int r;
+
+    // Each operation needs two entries: IORING_OP_POLL_ADD linked to the read or write
+    engine->ring_fd = (int)syscall(__NR_io_uring_setup, depth * 2, &params);
+    if (engine->ring_fd < 0) {
+        hs_log(HS_LOG_DEBUG, "io_uring_setup() failed: %s", strerror(errno));
+        return 0;
+    }
+
+    /* NODROP (Linux 5.5) guarantees that completions are never lost, and also means that the
+       kernel supports everything else we use (linked requests and vectored I/O). */
+    if (!(params.features & IORING_FEAT_NODROP)) {
+        hs_log(HS_LOG_DEBUG, "io_uring does not support IORING_FEAT_NODROP");
+        r = 0;
+        goto error;
+    }
+
+    engine->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    engine->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (engine->cq_ring_size > engine->sq_ring_size)
+            engine->sq_ring_size = engine->cq_ring_size;
+        engine->cq_ring_size = 0;
+    }
+
+    engine->sq_ring = mmap(NULL, engine->sq_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_SQ_RING);
+    if (engine->sq_ring == MAP_FAILED) {
+        engine->sq_ring = NULL;
+        r = hs_error(HS_ERROR_SYSTEM, "mmap() failed: %s", strerror(errno));
+        goto error;
+    }
+    if (engine->cq_ring_size) {
+        engine->cq_ring = mmap(NULL, engine->cq_ring_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_CQ_RING);
+        if (engine->cq_ring == MAP_FAILED) {
+            engine->cq_ring = NULL;
+            r = hs_error(HS_ERROR_SYSTEM, "mmap() failed: %s", strerror(errno));
+            goto error;
+        }
+    } else {
+        engine->cq_ring = engine->sq_ring;
+    }
+
+    engine->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    engine->sqes = mmap(NULL, engine->sqes_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_SQES);
+    if (engine->sqes == MAP_FAILED) {
+        engine->sqes = NULL;
+        r = hs_error(HS_ERROR_SYSTEM, "mmap() failed: %s", strerror(errno));
+        goto error;
+    }
+
+    engine->sq_head = (unsigned int *)((char *)engine->sq_ring + params.sq_off.head);
+    engine->sq_tail = (unsigned int *)((char *)engine->sq_ring + params.sq_off.tail);
+    engine->sq_mask = (unsigned int *)((char *)engine->sq_ring + params.sq_off.ring_mask);
+    engine->sq_array = (unsigned int *)((char *)engine->sq_ring + params.sq_off.array);
+    engine->cq_head = (unsigned int *)((char *)engine->cq_ring + params.cq_off.head);
+    engine->cq_tail = (unsigned int *)((char *)engine->cq_ring + params.cq_off.tail);
+    engine->cq_mask = (unsigned int *)((char *)engine->cq_ring + params.cq_off.ring_mask);
+    engine->cqes = (struct io_uring_cqe *)((char *)engine->cq_ring + params.cq_off.cqes);
+
+    engine->sq_local_tail = *engine->sq_tail;
+
+    return 1;
+
+error:
+    if (engine->sqes)
+        munmap(engine->sqes, engine->sqes_size);
+    if (engine->cq_ring && engine->cq_ring != engine->sq_ring)
+        munmap(engine->cq_ring, engine->cq_ring_size);
+    if (engine->sq_ring)
+        munmap(engine->sq_ring, engine->sq_ring_size);
+    engine->sqes = NULL;
+    engine->cq_ring = NULL;
+    engine->sq_ring = NULL;
+
+    close(engine->ring_fd);
+    engine->ring_fd = -1;
+
+    return r;
+}
+
+static struct io_uring_sqe *uring_get_sqe(hs_io_engine *engine)
+{
+    unsigned int idx = engine->sq_local_tail++ & *engine->sq_mask;
+    struct io_uring_sqe *sqe = &engine->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    engine->sq_array[idx] = idx;
+    engine->sq_pending++;
+
+    return sqe;
+}
+
+static void uring_prepare_op(hs_io_engine *engine, struct io_op *op)
+{
+    uint64_t idx = (uint64_t)(op - engine->ops);
+    struct io_uring_sqe *sqe;
+
+    /* Device descriptors are opened with O_NONBLOCK, which io_uring honours. Link the read
+       or write to a poll request to make sure it only runs when the device is ready. */
+    sqe = uring_get_sqe(engine);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = op->fd;
+    sqe->poll_events = (op->op == HS_IO_READ) ? POLLIN : POLLOUT;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = idx << 1;
+
+    sqe = uring_get_sqe(engine);
+    sqe->opcode = (op->op == HS_IO_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->fd = op->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&op->iov;
+    sqe->len = 1;
+    sqe->user_data = (idx << 1) | 1;
+
+    op->poll_res = 0;
+    op->inflight = true;
+    engine->uring_inflight++;
+}
+
+static int uring_enter(hs_io_engine *engine, unsigned int min_complete)
+{
+    unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int r;
+
+    if (!engine->sq_pending && !min_complete)
+        return 0;
+    __atomic_store_n(engine->sq_tail, engine->sq_local_tail, __ATOMIC_RELEASE);
+
+restart:
+    r = (int)syscall(__NR_io_uring_enter, engine->ring_fd, engine->sq_pending, min_complete,
+                     flags, NULL, 0);
+    if (r < 0) {
+        switch (errno) {
+        case EINTR:
+            goto restart;
+        // The kernel is short on resources, the entries will be submitted next time
+        case EAGAIN:
+        case EBUSY:
+            return 0;
+        }
+        return hs_error(HS_ERROR_SYSTEM, "io_uring_enter() failed: %s", strerror(errno));
+    }
+    engine->sq_pending -= (unsigned int)r;
+
+    return 0;
+}
+
+static int uring_submit(hs_io_engine *engine, unsigned int min_complete)
+{
+    _hs_list_foreach(cur, &engine->queued_ops) {
+        struct io_op *op = _hs_container_of(cur, struct io_op, list);
+
+        _hs_list_remove(&op->list);
+        uring_prepare_op(engine, op);
+    }
+
+    return uring_enter(engine, min_complete);
+}
+
+static void uring_process_completions(hs_io_engine *engine)
+{
+    unsigned int head = *engine->cq_head;
+    unsigned int tail = __atomic_load_n(engine->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &engine->cqes[head & *engine->cq_mask];
+        struct io_op *op;
+
+        if (cqe->user_data == URING_CANCEL_USER_DATA) {
+            head++;
+            continue;
+        }
+        op = &engine->ops[cqe->user_data >> 1];
+
+        if (!(cqe->user_data & 1)) {
+            if (cqe->res < 0)
+                op->poll_res = cqe->res;
+            head++;
+            continue;
+        }
+
+        op->inflight = false;
+        engine->uring_inflight--;
+
+        if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+            // Spurious wake up, try again
+            _hs_list_add_tail(&engine->queued_ops, &op->list);
+        } else if (cqe->res == -ECANCELED && op->poll_res < 0) {
+            complete_op(engine, op, op->poll_res);
+        } else {
+            complete_op(engine, op, cqe->res);
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(engine->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int uring_reap(hs_io_engine *engine, int timeout)
+{
+    struct pollfd pfd;
+    uint64_t start;
+    int r;
+
+    r = uring_submit(engine, 0);
+    if (r < 0)
+        return r;
+    uring_process_completions(engine);
+    if (!_hs_list_is_empty(&engine->completed_ops) || !timeout)
+        return 0;
+
+    pfd.events = POLLIN;
+    pfd.fd = engine->ring_fd;
+
+    start = hs_millis();
+    do {
+restart:
+        r = poll(&pfd, 1, hs_adjust_timeout(timeout, start));
+        if (r < 0) {
+            if (errno == EINTR)
+                goto restart;
+            return hs_error(HS_ERROR_SYSTEM, "poll() failed: %s", strerror(errno));
+        }
+        if (!r)
+            break;
+
+        uring_process_completions(engine);
+        r = uring_submit(engine, 0);
+        if (r < 0)
+            return r;
+    } while (_hs_list_is_empty(&engine->completed_ops) && hs_adjust_timeout(timeout, start));
+
+    return 0;
+}
+
+// Consume completions without reporting them, the engine is going away
+static void uring_discard_completions(hs_io_engine *engine)
+{
+    unsigned int head = *engine->cq_head;
+    unsigned int tail = __atomic_load_n(engine->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &engine->cqes[head & *engine->cq_mask];
+
+        if (cqe->user_data != URING_CANCEL_USER_DATA && (cqe->user_data & 1)) {
+            engine->ops[cqe->user_data >> 1].inflight = false;
+            engine->uring_inflight--;
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(engine->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static int uring_cancel_ops(hs_io_engine *engine)
+{
+    unsigned int sq_entries = *engine->sq_mask + 1;
+    int r;
+
+    for (unsigned int i = 0; i < engine->ops_count; i++) {
+        struct io_op *op = &engine->ops[i];
+
+        if (!op->inflight)
+            continue;
+
+        /* Cancel the poll request, which takes the linked read or write down with it. If the
+           poll has already fired, cancel the read or write itself. */
+        for (uint64_t part = 0; part < 2; part++) {
+            struct io_uring_sqe *sqe;
+
+            while (engine->sq_local_tail - __atomic_load_n(engine->sq_head, __ATOMIC_ACQUIRE) >=
+                   sq_entries) {
+                r = uring_enter(engine, 1);
+                if (r < 0)
+                    return r;
+                uring_discard_completions(engine);
+            }
+
+            sqe = uring_get_sqe(engine);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = ((uint64_t)i << 1) | part;
+            sqe->user_data = URING_CANCEL_USER_DATA;
+        }
+    }
+
+    while (engine->uring_inflight) {
+        r = uring_enter(engine, 1);
+        if (r < 0)
+            return r;
+        uring_discard_completions(engine);
+    }
+
+    return 0;
+}
+
+static void uring_release(hs_io_engine *engine)
+{
+    // The kernel must be done with the ring and the operations before they go away
+    if (uring_cancel_ops(engine) < 0) {
+        hs_log(HS_LOG_WARNING, "Failed to cancel pending io_uring operations, leaking them");
+        engine->ops = NULL;
+        close(engine->ring_fd);
+        return;
+    }
+
+    if (engine->sqes)
+        munmap(engine->sqes, engine->sqes_size);
+    if (engine->cq_ring && engine->cq_ring != engine->sq_ring)
+        munmap(engine->cq_ring, engine->cq_ring_size);
+    if (engine->sq_ring)
+        munmap(engine->sq_ring, engine->sq_ring_size);
+
+    close(engine->ring_fd);
+}
+
+#endif
+
+int hs_io_engine_new(hs_io_backend backend, unsigned int depth, hs_io_engine **rengine)
+{
+    assert(depth);
+    assert(rengine);
+
+    hs_io_engine *engine;
+    int r;
+
+    engine = _hs_calloc(1, sizeof(*engine));
+    if (!engine) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    engine->epfd = -1;
+#ifdef HAVE_IO_URING
+    engine->ring_fd = -1;
+#endif
+    _hs_list_init(&engine->free_ops);
+    _hs_list_init(&engine->completed_ops);
+    _hs_list_init(&engine->queued_ops);
+
+    engine->ops = _hs_calloc(depth, sizeof(*engine->ops));
+    if (!engine->ops) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    engine->ops_count = depth;
+    for (unsigned int i = 0; i < depth; i++)
+        _hs_list_add_tail(&engine->free_ops, &engine->ops[i].list);
+
+    if (backend != HS_IO_BACKEND_EPOLL) {
+#ifdef HAVE_IO_URING
+        r = uring_init(engine, depth);
+        if (r < 0)
+            goto error;
+        if (r)
+            engine->backend = HS_IO_BACKEND_URING;
+#endif
+        if (backend == HS_IO_BACKEND_URING && engine->backend != HS_IO_BACKEND_URING) {
+            r = hs_error(HS_ERROR_SYSTEM, "io_uring is not supported on this system");
+            goto error;
+        }
+    }
+
+    if (engine->backend != HS_IO_BACKEND_URING) {
+        engine->backend = HS_IO_BACKEND_EPOLL;
+
+        engine->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (engine->epfd < 0) {
+            r = hs_error(HS_ERROR_SYSTEM, "epoll_create1() failed: %s", strerror(errno));
+            goto error;
+        }
+    }
+
+    *rengine = engine;
+    return 0;
+
+error:
+    hs_io_engine_free(engine);
+    return r;
+}
+
+void hs_io_engine_free(hs_io_engine *engine)
+{
+    if (engine) {
+#ifdef HAVE_IO_URING
+        if (engine->backend == HS_IO_BACKEND_URING)
+            uring_release(engine);
+#endif
+
+        for (unsigned int i = 0; i < engine->fds_size; i++) {
+            struct fd_entry *entry = engine->fds[i];
+
+            if (entry) {
+                _hs_fd_watch_remove(&entry->watch);
+                _hs_free(entry);
+            }
+        }
+        _hs_free(engine->fds);
+        close(engine->epfd);
+
+        _hs_free(engine->ops);
+    }
+
+    _hs_free(engine);
+}
+
+hs_io_backend hs_io_engine_get_backend(const hs_io_engine *engine)
+{
+    assert(engine);
+    return engine->backend;
+}
+
+hs_descriptor hs_io_engine_get_descriptor(const hs_io_engine *engine)
+{
+    assert(engine);
+
+#ifdef HAVE_IO_URING
+    if (engine->backend == HS_IO_BACKEND_URING)
+        return engine->ring_fd;
+#endif
+    return engine->epfd;
+}
+
+static int queue_op(hs_io_engine *engine, hs_handle *h, hs_io_op type, uint8_t *buf,
+                    size_t size, void *udata)
+{
+    hs_device *dev = hs_handle_get_device(h);
+    struct io_op *op;
+
+    op = _hs_list_get_first(&engine->free_ops, struct io_op, list);
+    if (!op)
+        return 0;
+    _hs_list_remove(&op->list);
+
+    op->h = h;
+    op->op = type;
+    op->udata = udata;
+    op->fd = hs_handle_get_descriptor(h);
+    op->iov.iov_base = buf;
+    op->iov.iov_len = size;
+    op->report_id = NULL;
+
+    if (hs_device_get_type(dev) == HS_DEVICE_TYPE_HID) {
+        if (type == HS_IO_READ) {
+            if (!_hs_linux_hid_has_numbered_reports(h)) {
+                op->iov.iov_base = buf + 1;
+                op->iov.iov_len = size - 1;
+                op->report_id = buf;
+            }
+        } else if (size < 2) {
+            complete_op(engine, op, 0);
+            return 1;
+        }
+    }
+
+    _hs_list_add_tail(&engine->queued_ops, &op->list);
+    return 1;
+}
+
+int hs_io_engine_queue_read(hs_io_engine *engine, hs_handle *h, uint8_t *buf, size_t size,
+                            void *udata)
+{
+    assert(engine);
+    assert(h);
+    assert(buf);
+    assert(size);
+
+    return queue_op(engine, h, HS_IO_READ, buf, size, udata);
+}
+
+int hs_io_engine_queue_write(hs_io_engine *engine, hs_handle *h, const uint8_t *buf,
+                             size_t size, void *udata)
+{
+    assert(engine);
+    assert(h);
+    assert(buf);
+
+    return queue_op(engine, h, HS_IO_WRITE, (uint8_t *)buf, size, udata);
+}
+
+int hs_io_engine_submit(hs_io_engine *engine)
+{
+    assert(engine);
+
+#ifdef HAVE_IO_URING
+    if (engine->backend == HS_IO_BACKEND_URING)
+        return uring_submit(engine, 0);
+#endif
+    return epoll_submit(engine);
+}
+
+int hs_io_engine_reap(hs_io_engine *engine, hs_io_completion *completions, unsigned int count,
+                      int timeout)
+{
+    assert(engine);
+    assert(completions);
+    assert(count);
+
+    int r;
+
+    if (_hs_list_is_empty(&engine->completed_ops)) {
+#ifdef HAVE_IO_URING
+        if (engine->backend == HS_IO_BACKEND_URING) {
+            r = uring_reap(engine, timeout);
+        } else
+#endif
+        {
+            r = epoll_submit(engine);
+            if (r < 0)
+                return r;
+            r = epoll_reap(engine, timeout);
+        }
+        if (r < 0)
+            return r;
+    }
+
+    return (int)reap_completed_ops(engine, completions, count);
+}
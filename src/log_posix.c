@@ -0,0 +1,270 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#ifdef __linux__
+    #include <sys/eventfd.h>
+#endif
+#include <unistd.h>
+#include "log_priv.h"
+
+#define RING_SIZE 256
+
+struct log_record {
+    unsigned int seq;
+    hs_log_level level;
+    char msg[_HS_LOG_MESSAGE_SIZE];
+};
+
+/* Bounded MPSC ring with per-record sequence numbers (Vyukov style): producers claim a slot
+   with a CAS on head and publish it through seq, they never block. When the ring is full,
+   the message is dropped and counted. */
+static struct log_record *ring;
+static unsigned int ring_head;
+static unsigned int ring_tail;
+static unsigned int dropped;
+
+static bool async_enabled;
+static unsigned int pushers;
+
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t writer_thread;
+static bool writer_stop;
+
+/* The writer sets writer_idle before it checks the ring one last time and blocks on the wake
+   descriptors. Producers only signal it when they see the flag, so a busy writer costs them
+   nothing. On Linux, an eventfd is used and both descriptors are the same. */
+static bool writer_idle;
+static int wake_fds[2] = {-1, -1};
+
+static void wake_writer(void)
+{
+    uint64_t value = 1;
+    ssize_t r;
+
+    // Eventfd counters need 8 bytes, pipes don't care
+    do {
+        r = write(wake_fds[1], &value, sizeof(value));
+    } while (r < 0 && errno == EINTR);
+}
+
+bool _hs_log_push_async(hs_log_level level, const char *msg)
+{
+    struct log_record *record;
+    unsigned int pos;
+
+    // hs_log_stop_async() waits for pushers to go away before it frees the ring
+    __atomic_fetch_add(&pushers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&async_enabled, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_sub(&pushers, 1, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+    while (true) {
+        int diff;
+
+        record = &ring[pos % RING_SIZE];
+        diff = (int)(__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (!diff) {
+            if (__atomic_compare_exchange_n(&ring_head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&pushers, 1, __ATOMIC_RELEASE);
+            return true;
+        } else {
+            pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+        }
+    }
+
+    record->level = level;
+    strncpy(record->msg, msg, sizeof(record->msg) - 1);
+    record->msg[sizeof(record->msg) - 1] = 0;
+    __atomic_store_n(&record->seq, pos + 1, __ATOMIC_RELEASE);
+
+    // Pairs with the fence in writer_thread_main(), one of us sees the other's store
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&writer_idle, __ATOMIC_RELAXED) &&
+            __atomic_exchange_n(&writer_idle, false, __ATOMIC_RELAXED))
+        wake_writer();
+
+    __atomic_fetch_sub(&pushers, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static unsigned int drain_ring(void)
+{
+    unsigned int count = 0, lost;
+
+    while (true) {
+        struct log_record *record = &ring[ring_tail % RING_SIZE];
+
+        if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != ring_tail + 1)
+            break;
+
+        _hs_log_write(record->level, record->msg);
+
+        __atomic_store_n(&record->seq, ring_tail + RING_SIZE, __ATOMIC_RELEASE);
+        ring_tail++;
+        count++;
+    }
+
+    lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+    if (lost) {
+        char buf[64];
+
+        snprintf(buf, sizeof(buf), "Log ring full, %u messages dropped", lost);
+        _hs_log_write(HS_LOG_WARNING, buf);
+    }
+
+    return count;
+}
+
+static void *writer_thread_main(void *udata)
+{
+    _HS_UNUSED(udata);
+
+    while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = {wake_fds[0], POLLIN};
+        uint64_t value;
+
+        __atomic_store_n(&writer_idle, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (drain_ring()) {
+            __atomic_store_n(&writer_idle, false, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // A stale wakeup only costs an extra loop
+        if (poll(&pfd, 1, -1) > 0) {
+            ssize_t r = read(wake_fds[0], &value, sizeof(value));
+            _HS_UNUSED(r);
+        }
+    }
+
+    return NULL;
+}
+
+static void close_wake_fds(void)
+{
+    if (wake_fds[0] >= 0)
+        close(wake_fds[0]);
+    if (wake_fds[1] != wake_fds[0])
+        close(wake_fds[1]);
+    wake_fds[0] = -1;
+    wake_fds[1] = -1;
+}
+
+int hs_log_start_async(void)
+{
+    int r;
+
+    pthread_mutex_lock(&async_lock);
+
+    if (ring) {
+        r = 0;
+        goto cleanup;
+    }
+
+    ring = _hs_malloc(RING_SIZE * sizeof(*ring));
+    if (!ring) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    for (unsigned int i = 0; i < RING_SIZE; i++)
+        ring[i].seq = i;
+    ring_head = 0;
+    ring_tail = 0;
+
+#ifdef __linux__
+    wake_fds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fds[0] < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "eventfd() failed: %s", strerror(errno));
+        goto error;
+    }
+    wake_fds[1] = wake_fds[0];
+#else
+    r = pipe(wake_fds);
+    if (r < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "pipe() failed: %s", strerror(errno));
+        goto error;
+    }
+    for (unsigned int i = 0; i < 2; i++) {
+        fcntl(wake_fds[i], F_SETFL, fcntl(wake_fds[i], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(wake_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    writer_stop = false;
+    writer_idle = false;
+    r = pthread_create(&writer_thread, NULL, writer_thread_main, NULL);
+    if (r) {
+        r = hs_error(HS_ERROR_SYSTEM, "pthread_create() failed: %s", strerror(r));
+        goto error;
+    }
+
+    __atomic_store_n(&async_enabled, true, __ATOMIC_SEQ_CST);
+
+    r = 0;
+cleanup:
+    pthread_mutex_unlock(&async_lock);
+    return r;
+
+error:
+    close_wake_fds();
+    _hs_free(ring);
+    ring = NULL;
+    pthread_mutex_unlock(&async_lock);
+    return r;
+}
+
+void hs_log_stop_async(void)
+{
+    pthread_mutex_lock(&async_lock);
+
+    if (ring) {
+        __atomic_store_n(&async_enabled, false, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pushers, __ATOMIC_ACQUIRE))
+            continue;
+
+        __atomic_store_n(&writer_stop, true, __ATOMIC_RELEASE);
+        wake_writer();
+        pthread_join(writer_thread, NULL);
+
+        // Nothing can be pushed anymore, flush what is left
+        drain_ring();
+
+        close_wake_fds();
+        _hs_free(ring);
+        ring = NULL;
+    }
+
+    pthread_mutex_unlock(&async_lock);
+}
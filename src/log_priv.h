@@ -0,0 +1,63 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef _HS_LOG_PRIV_H
+#define _HS_LOG_PRIV_H
+
+#include "util.h"
+
+#define _HS_LOG_MESSAGE_SIZE 512
+
+#define _HS_LOG_RATELIMIT_BURST 10
+#define _HS_LOG_RATELIMIT_INTERVAL 5000
+
+typedef struct _hs_log_ratelimit_state {
+    uint64_t start;
+    unsigned int count;
+    unsigned int suppressed;
+} _hs_log_ratelimit_state;
+
+/* Log at most _HS_LOG_RATELIMIT_BURST messages from this call site every
+   _HS_LOG_RATELIMIT_INTERVAL milliseconds (per thread), for messages triggered by
+   misbehaving devices. The number of dropped messages is logged once the window is over. */
+#define _hs_log_ratelimited(level, ...) \
+    do { \
+        static _HS_THREAD_LOCAL _hs_log_ratelimit_state _HS_UNIQUE_ID(ratelimit_); \
+        if ((level) >= hs_log_get_level() && \
+                _hs_log_ratelimit(&_HS_UNIQUE_ID(ratelimit_), (level))) \
+            hs_log((level), __VA_ARGS__); \
+    } while (0)
+
+bool _hs_log_ratelimit(_hs_log_ratelimit_state *state, hs_log_level level);
+
+// Call the log handler right away, used by the asynchronous writer
+void _hs_log_write(hs_log_level level, const char *msg);
+
+#ifndef _WIN32
+// Returns false if asynchronous logging is disabled and the caller must log the message
+bool _hs_log_push_async(hs_log_level level, const char *msg);
+#endif
+
+#endif
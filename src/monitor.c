@@ -24,12 +24,17 @@
 
 #include "util.h"
 #include "device_priv.h"
+#include "log_priv.h"
 #include "monitor_priv.h"
 
 struct hs_monitor {
     _HS_MONITOR
 };
 
+struct hs_handle {
+    _HS_HANDLE
+};
+
 struct callback {
     _hs_list_head list;
     int id;
@@ -43,7 +48,7 @@ int hs_monitor_register_callback(hs_monitor *monitor, hs_monitor_callback_func *
     assert(monitor);
     assert(f);
 
-    struct callback *callback = calloc(1, sizeof(*callback));
+    struct callback *callback = _hs_calloc(1, sizeof(*callback));
     if (!callback)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
@@ -59,7 +64,7 @@ int hs_monitor_register_callback(hs_monitor *monitor, hs_monitor_callback_func *
 static void drop_callback(struct callback *callback)
 {
     _hs_list_remove(&callback->list);
-    free(callback);
+    _hs_free(callback);
 }
 
 void hs_monitor_deregister_callback(hs_monitor *monitor, int id)
@@ -76,11 +81,43 @@ void hs_monitor_deregister_callback(hs_monitor *monitor, int id)
     }
 }
 
+int hs_monitor_register_handle(hs_monitor *monitor, hs_handle *h)
+{
+    assert(monitor);
+    assert(h);
+    assert(!h->reconnect_monitor || h->reconnect_monitor == monitor);
+
+    if (!h->dev->vtable->reopen)
+        return hs_error(HS_ERROR_SYSTEM, "Reconnection is not supported for device '%s'",
+                        h->dev->path);
+
+    if (!h->reconnect_monitor) {
+        h->reconnect_monitor = monitor;
+        _hs_list_add_tail(&monitor->handles, &h->reconnect_node);
+    }
+
+    return 0;
+}
+
+void hs_monitor_deregister_handle(hs_monitor *monitor, hs_handle *h)
+{
+    assert(monitor);
+    _HS_UNUSED(monitor);
+
+    if (!h || !h->reconnect_monitor)
+        return;
+    assert(h->reconnect_monitor == monitor);
+
+    _hs_list_remove(&h->reconnect_node);
+    h->reconnect_monitor = NULL;
+}
+
 int _hs_monitor_init(hs_monitor *monitor)
 {
     int r;
 
     _hs_list_init(&monitor->callbacks);
+    _hs_list_init(&monitor->handles);
 
     r = _hs_htable_init(&monitor->devices, 64);
     if (r < 0)
@@ -93,7 +130,12 @@ void _hs_monitor_release(hs_monitor *monitor)
 {
     _hs_list_foreach(cur, &monitor->callbacks) {
         struct callback *callback = _hs_container_of(cur, struct callback, list);
-        free(callback);
+        _hs_free(callback);
+    }
+
+    _hs_list_foreach(cur, &monitor->handles) {
+        hs_handle *h = _hs_container_of(cur, hs_handle, reconnect_node);
+        h->reconnect_monitor = NULL;
     }
 
     hs_htable_foreach(cur, &monitor->devices) {
@@ -111,18 +153,79 @@ static int trigger_callbacks(hs_device *dev)
         struct callback *callback = _hs_container_of(cur, struct callback, list);
         int r;
 
+        _HS_MONITOR_TIMER(start);
         r = (*callback->f)(dev, callback->udata);
+        _hs_monitor_stats_time(dev->monitor, callback_time, start);
         if (r < 0)
             return r;
         if (r) {
             _hs_list_remove(&callback->list);
-            free(callback);
+            _hs_free(callback);
         }
     }
 
     return 0;
 }
 
+static bool is_same_device(const hs_device *dev1, const hs_device *dev2)
+{
+    if (dev1->type != dev2->type || dev1->iface != dev2->iface)
+        return false;
+
+    // The serial number follows the device across ports, fall back to the location otherwise
+    if (dev1->serial && dev2->serial)
+        return dev1->vid == dev2->vid && dev1->pid == dev2->pid &&
+               strcmp(dev1->serial, dev2->serial) == 0;
+    return strcmp(dev1->location, dev2->location) == 0;
+}
+
+static void reopen_handles(hs_monitor *monitor, hs_device *dev)
+{
+    _hs_list_foreach(cur, &monitor->handles) {
+        hs_handle *h = _hs_container_of(cur, hs_handle, reconnect_node);
+        int r;
+
+        /* The device object itself can come back (virtual devices do that), so rely on the
+           handle state. A handle that could not be detached still points to a dead device. */
+        if ((!h->detached && h->dev->state == HS_DEVICE_STATUS_ONLINE) ||
+                !is_same_device(h->dev, dev))
+            continue;
+
+        r = (*dev->vtable->reopen)(h, dev);
+        if (r < 0) {
+            _hs_log_ratelimited(HS_LOG_WARNING, "Failed to reopen handle for device '%s'",
+                                dev->path);
+            continue;
+        }
+
+        hs_device_ref(dev);
+        hs_device_unref(h->dev);
+        h->dev = dev;
+    }
+}
+
+static void detach_handles(hs_monitor *monitor, hs_device *dev)
+{
+    _hs_list_foreach(cur, &monitor->handles) {
+        hs_handle *h = _hs_container_of(cur, hs_handle, reconnect_node);
+
+        if (h->dev == dev)
+            (*dev->vtable->detach)(h);
+    }
+}
+
+bool _hs_monitor_has_device(hs_monitor *monitor, const char *key)
+{
+    hs_htable_foreach_hash(cur, &monitor->devices, _hs_htable_hash_str(key)) {
+        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+
+        if (strcmp(dev->key, key) == 0)
+            return true;
+    }
+
+    return false;
+}
+
 int _hs_monitor_add(hs_monitor *monitor, hs_device *dev)
 {
     hs_htable_foreach_hash(cur, &monitor->devices, _hs_htable_hash_str(dev->key)) {
@@ -138,6 +241,9 @@ int _hs_monitor_add(hs_monitor *monitor, hs_device *dev)
     hs_device_ref(dev);
     _hs_htable_add(&monitor->devices, _hs_htable_hash_str(dev->key), &dev->hnode);
 
+    // Reconnect registered handles before anyone gets a chance to notice
+    reopen_handles(monitor, dev);
+
     return trigger_callbacks(dev);
 }
 
@@ -148,6 +254,7 @@ void _hs_monitor_remove(hs_monitor *monitor, const char *key)
 
         if (strcmp(dev->key, key) == 0) {
             dev->state = HS_DEVICE_STATUS_DISCONNECTED;
+            detach_handles(monitor, dev);
 
             trigger_callbacks(dev);
 
@@ -173,3 +280,36 @@ int hs_monitor_list(hs_monitor *monitor, hs_monitor_callback_func *f, void *udat
 
     return 0;
 }
+
+int hs_monitor_get_stats(const hs_monitor *monitor, hs_monitor_stats *rstats)
+{
+    assert(monitor);
+    assert(rstats);
+
+#ifdef LIBHS_MONITOR_STATS
+    *rstats = monitor->stats;
+#else
+    memset(rstats, 0, sizeof(*rstats));
+#endif
+
+    rstats->buckets = monitor->devices.size;
+    for (unsigned int i = 0; i < monitor->devices.size; i++) {
+        const _hs_htable_head *head = (const _hs_htable_head *)&monitor->devices.heads[i];
+        unsigned int chain = 0;
+
+        for (const _hs_htable_head *cur = head->next; cur != head; cur = cur->next)
+            chain++;
+
+        rstats->devices += chain;
+        if (chain)
+            rstats->used_buckets++;
+        if (chain > rstats->max_chain)
+            rstats->max_chain = chain;
+    }
+
+#ifdef LIBHS_MONITOR_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
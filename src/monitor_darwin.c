@@ -78,7 +78,7 @@ _HS_EXIT()
 {
     _hs_list_foreach(cur, &controllers) {
         struct usb_controller *controller = _hs_container_of(cur, struct usb_controller, list);
-        free(controller);
+        _hs_free(controller);
     }
     pthread_mutex_destroy(&controllers_lock);
 }
@@ -115,7 +115,7 @@ static int get_ioregistry_value_string(io_service_t service, CFStringRef prop, c
 
     size = CFStringGetMaximumSizeForEncoding(CFStringGetLength(data), kCFStringEncodingUTF8) + 1;
 
-    s = malloc((size_t)size);
+    s = _hs_malloc((size_t)size);
     if (!s) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto cleanup;
@@ -186,7 +186,7 @@ static int get_ioregistry_entry_path(io_service_t service, char **rpath)
     if (kret != kIOReturnSuccess)
         return hs_error(HS_ERROR_SYSTEM, "IORegistryEntryGetPath() failed");
 
-    path = strdup(buf);
+    path = _hs_strdup(buf);
     if (!path)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
@@ -250,7 +250,7 @@ static int build_location_string(uint8_t ports[], unsigned int depth, char **rpa
         size -= (size_t)r;
     }
 
-    path = strdup(buf);
+    path = _hs_strdup(buf);
     if (!path)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
@@ -378,12 +378,11 @@ static int process_darwin_device(io_service_t service, hs_device **rdev)
         goto cleanup;
     }
 
-    dev = calloc(1, sizeof(*dev));
+    dev = _hs_device_new();
     if (!dev) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto cleanup;
     }
-    dev->refcount = 1;
 
 #define GET_PROPERTY_NUMBER(service, key, type, var) \
         r = get_ioregistry_value_number(service, CFSTR(key), type, var); \
@@ -399,7 +398,7 @@ static int process_darwin_device(io_service_t service, hs_device **rdev)
 
 #undef GET_PROPERTY_NUMBER
 
-    r = asprintf(&dev->key, "%"PRIx64, session);
+    r = _hs_asprintf(&dev->key, "%"PRIx64, session);
     if (r < 0) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto cleanup;
@@ -510,7 +509,7 @@ static int add_controller(io_service_t service, uint8_t index)
         return 0;
     }
 
-    controller = calloc(1, sizeof(*controller));
+    controller = _hs_calloc(1, sizeof(*controller));
     if (!controller)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
@@ -638,7 +637,7 @@ int hs_monitor_new(hs_monitor **rmonitor)
     if (r < 0)
         goto error;
 
-    monitor = calloc(1, sizeof(*monitor));
+    monitor = _hs_calloc(1, sizeof(*monitor));
     if (!monitor) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
@@ -725,7 +724,7 @@ void hs_monitor_free(hs_monitor *monitor)
             IONotificationPortDestroy(monitor->notify_port);
     }
 
-    free(monitor);
+    _hs_free(monitor);
 }
 
 hs_descriptor hs_monitor_get_descriptor(const hs_monitor *monitor)
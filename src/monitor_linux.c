@@ -26,23 +26,30 @@
 #include <fcntl.h>
 #include <libudev.h>
 #include <pthread.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include "device_priv.h"
 #include "monitor_priv.h"
+#include "uevent_trace_priv.h"
 #include "hs/platform.h"
 
 struct hs_monitor {
     _HS_MONITOR
 
     struct udev_monitor *monitor;
-};
 
-struct udev_aggregate {
-    struct udev_device *dev;
-    struct udev_device *usb;
-    struct udev_device *iface;
+    // Set by hs_monitor_start_trace()
+    _hs_uevent_writer *writer;
+
+    // Replay monitors read events from a trace instead of udev, see hs_monitor_new_from_trace()
+    _hs_uevent_trace *replay;
+    int replay_timer;
+    double replay_speed;
+    uint64_t replay_start;
 };
 
+typedef int enumerate_func(const _hs_uevent *event, void *udata);
+
 extern const struct _hs_device_vtable _hs_posix_device_vtable;
 extern const struct _hs_device_vtable _hs_linux_hid_vtable;
 
@@ -62,37 +69,79 @@ _HS_EXIT()
     pthread_mutex_destroy(&udev_lock);
 }
 
-static int compute_device_location(struct udev_device *dev, char **rlocation)
+static int compute_device_location(hs_device *dev, const char *busnum, const char *devpath)
 {
-    const char *busnum, *devpath;
-    char *location;
+    char location[64];
     int r;
 
-    busnum = udev_device_get_sysattr_value(dev, "busnum");
-    devpath = udev_device_get_sysattr_value(dev, "devpath");
-
     if (!busnum || !devpath)
         return 0;
 
-    r = asprintf(&location, "usb-%s-%s", busnum, devpath);
-    if (r < 0)
-        return hs_error(HS_ERROR_MEMORY, NULL);
+    // USB topologies are at most 7 tiers deep, anything longer is bogus
+    r = snprintf(location, sizeof(location), "usb-%s-%s", busnum, devpath);
+    if (r < 0 || (size_t)r >= sizeof(location))
+        return 0;
 
     for (char *ptr = location; *ptr; ptr++) {
         if (*ptr == '.')
             *ptr = '-';
     }
 
-    *rlocation = location;
+    dev->location = _hs_device_strdup(dev, location);
+    if (!dev->location)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
     return 1;
 }
 
-static int fill_device_details(hs_device *dev, struct udev_aggregate *agg)
+// Everything the monitor needs from udev and sysfs, which is also what traces record
+static void collect_attributes(struct udev_device *udev_dev, _hs_uevent *event)
+{
+    struct udev_device *usb, *iface;
+    const char *devnode;
+
+    memset(event->attributes, 0, sizeof(event->attributes));
+
+    event->attributes[_HS_UEVENT_SUBSYSTEM] = udev_device_get_subsystem(udev_dev);
+    event->attributes[_HS_UEVENT_DEVPATH] = udev_device_get_devpath(udev_dev);
+    devnode = udev_device_get_devnode(udev_dev);
+    if (devnode && access(devnode, F_OK) == 0)
+        event->attributes[_HS_UEVENT_DEVNODE] = devnode;
+
+    usb = udev_device_get_parent_with_subsystem_devtype(udev_dev, "usb", "usb_device");
+    iface = udev_device_get_parent_with_subsystem_devtype(udev_dev, "usb", "usb_interface");
+    if (!usb || !iface)
+        return;
+
+    event->attributes[_HS_UEVENT_USB_BUSNUM] = udev_device_get_sysattr_value(usb, "busnum");
+    event->attributes[_HS_UEVENT_USB_DEVPATH] = udev_device_get_sysattr_value(usb, "devpath");
+    event->attributes[_HS_UEVENT_USB_VID] = udev_device_get_sysattr_value(usb, "idVendor");
+    event->attributes[_HS_UEVENT_USB_PID] = udev_device_get_sysattr_value(usb, "idProduct");
+    event->attributes[_HS_UEVENT_USB_MANUFACTURER] =
+        udev_device_get_sysattr_value(usb, "manufacturer");
+    event->attributes[_HS_UEVENT_USB_PRODUCT] = udev_device_get_sysattr_value(usb, "product");
+    event->attributes[_HS_UEVENT_USB_SERIAL] = udev_device_get_sysattr_value(usb, "serial");
+    event->attributes[_HS_UEVENT_IFACE_DEVPATH] = udev_device_get_devpath(iface);
+}
+
+static int copy_attribute(hs_device *dev, char **rdest, const char *value)
 {
+    if (value) {
+        *rdest = _hs_device_strdup(dev, value);
+        if (!*rdest)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+
+    return 0;
+}
+
+static int fill_device_details(hs_device *dev, const _hs_uevent *event)
+{
+    const char *const *attributes = event->attributes;
     const char *buf;
     int r;
 
-    buf = udev_device_get_subsystem(agg->dev);
+    buf = attributes[_HS_UEVENT_SUBSYSTEM];
     if (!buf)
         return 0;
 
@@ -106,23 +155,24 @@ static int fill_device_details(hs_device *dev, struct udev_aggregate *agg)
         return 0;
     }
 
-    buf = udev_device_get_devnode(agg->dev);
-    if (!buf || access(buf, F_OK) != 0)
+    if (!attributes[_HS_UEVENT_DEVNODE] || !attributes[_HS_UEVENT_DEVPATH] ||
+            !attributes[_HS_UEVENT_IFACE_DEVPATH])
         return 0;
-    dev->path = strdup(buf);
+    dev->path = _hs_device_strdup(dev, attributes[_HS_UEVENT_DEVNODE]);
     if (!dev->path)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
-    dev->key = strdup(udev_device_get_devpath(agg->dev));
+    dev->key = _hs_device_strdup(dev, attributes[_HS_UEVENT_DEVPATH]);
     if (!dev->key)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
-    r = compute_device_location(agg->usb, &dev->location);
+    r = compute_device_location(dev, attributes[_HS_UEVENT_USB_BUSNUM],
+                                attributes[_HS_UEVENT_USB_DEVPATH]);
     if (r <= 0)
         return r;
 
     errno = 0;
-    buf = udev_device_get_sysattr_value(agg->usb, "idVendor");
+    buf = attributes[_HS_UEVENT_USB_VID];
     if (!buf)
         return 0;
     dev->vid = (uint16_t)strtoul(buf, NULL, 16);
@@ -130,36 +180,29 @@ static int fill_device_details(hs_device *dev, struct udev_aggregate *agg)
         return 0;
 
     errno = 0;
-    buf = udev_device_get_sysattr_value(agg->usb, "idProduct");
+    buf = attributes[_HS_UEVENT_USB_PID];
     if (!buf)
         return 0;
     dev->pid = (uint16_t)strtoul(buf, NULL, 16);
     if (errno)
         return 0;
 
-    buf = udev_device_get_sysattr_value(agg->usb, "manufacturer");
-    if (buf) {
-        dev->manufacturer = strdup(buf);
-        if (!dev->manufacturer)
-            return hs_error(HS_ERROR_MEMORY, NULL);
-    }
-
-    buf = udev_device_get_sysattr_value(agg->usb, "product");
-    if (buf) {
-        dev->product = strdup(buf);
-        if (!dev->product)
-            return hs_error(HS_ERROR_MEMORY, NULL);
-    }
+    r = copy_attribute(dev, &dev->manufacturer, attributes[_HS_UEVENT_USB_MANUFACTURER]);
+    if (r < 0)
+        return r;
+    r = copy_attribute(dev, &dev->product, attributes[_HS_UEVENT_USB_PRODUCT]);
+    if (r < 0)
+        return r;
+    r = copy_attribute(dev, &dev->serial, attributes[_HS_UEVENT_USB_SERIAL]);
+    if (r < 0)
+        return r;
 
-    buf = udev_device_get_sysattr_value(agg->usb, "serial");
-    if (buf) {
-        dev->serial = strdup(buf);
-        if (!dev->serial)
-            return hs_error(HS_ERROR_MEMORY, NULL);
-    }
+    // Live events never have an empty DEVPATH, but replayed traces can have anything
+    buf = attributes[_HS_UEVENT_IFACE_DEVPATH];
+    if (!*buf)
+        return 0;
 
     errno = 0;
-    buf = udev_device_get_devpath(agg->iface);
     buf += strlen(buf) - 1;
     dev->iface = (uint8_t)strtoul(buf, NULL, 10);
     if (errno)
@@ -168,28 +211,23 @@ static int fill_device_details(hs_device *dev, struct udev_aggregate *agg)
     return 1;
 }
 
-static int read_device_information(struct udev_device *udev_dev, hs_device **rdev)
+static int read_device_information(const _hs_uevent *event, hs_device **rdev)
 {
-    struct udev_aggregate agg;
     hs_device *dev = NULL;
     int r;
 
-    agg.dev = udev_dev;
-    agg.usb = udev_device_get_parent_with_subsystem_devtype(agg.dev, "usb", "usb_device");
-    agg.iface = udev_device_get_parent_with_subsystem_devtype(agg.dev, "usb", "usb_interface");
-    if (!agg.usb || !agg.iface) {
+    if (!event->attributes[_HS_UEVENT_IFACE_DEVPATH]) {
         r = 0;
         goto cleanup;
     }
 
-    dev = calloc(1, sizeof(*dev));
+    dev = _hs_device_new();
     if (!dev) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto cleanup;
     }
-    dev->refcount = 1;
 
-    r = fill_device_details(dev, &agg);
+    r = fill_device_details(dev, event);
     if (r <= 0)
         goto cleanup;
 
@@ -217,10 +255,8 @@ static int init_udev(void)
     return 0;
 }
 
-int hs_enumerate(hs_monitor_callback_func *f, void *udata)
+static int enumerate_devices(enumerate_func *f, void *udata)
 {
-    assert(f);
-
     struct udev_enumerate *enumerate = NULL;
     int r;
 
@@ -253,7 +289,7 @@ int hs_enumerate(hs_monitor_callback_func *f, void *udata)
     struct udev_list_entry *cur;
     udev_list_entry_foreach(cur, udev_enumerate_get_list_entry(enumerate)) {
         struct udev_device *udev_dev;
-        hs_device *dev;
+        _hs_uevent event;
 
         udev_dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(cur));
         if (!udev_dev) {
@@ -264,15 +300,11 @@ int hs_enumerate(hs_monitor_callback_func *f, void *udata)
             continue;
         }
 
-        r = read_device_information(udev_dev, &dev);
-        udev_device_unref(udev_dev);
-        if (r < 0)
-            goto cleanup;
-        if (!r)
-            continue;
+        event.action = _HS_UEVENT_SNAPSHOT;
+        collect_attributes(udev_dev, &event);
 
-        r = (*f)(dev, udata);
-        hs_device_unref(dev);
+        r = (*f)(&event, udata);
+        udev_device_unref(udev_dev);
         if (r)
             goto cleanup;
     }
@@ -283,6 +315,39 @@ cleanup:
     return r;
 }
 
+struct enumerate_context {
+    hs_monitor_callback_func *f;
+    void *udata;
+};
+
+static int enumerate_callback(const _hs_uevent *event, void *udata)
+{
+    struct enumerate_context *ctx = udata;
+    hs_device *dev;
+    int r;
+
+    r = read_device_information(event, &dev);
+    if (r <= 0)
+        return r;
+
+    r = (*ctx->f)(dev, ctx->udata);
+    hs_device_unref(dev);
+
+    return r;
+}
+
+int hs_enumerate(hs_monitor_callback_func *f, void *udata)
+{
+    assert(f);
+
+    struct enumerate_context ctx;
+
+    ctx.f = f;
+    ctx.udata = udata;
+
+    return enumerate_devices(enumerate_callback, &ctx);
+}
+
 static int monitor_enumerate_callback(hs_device *dev, void *udata)
 {
     return _hs_monitor_add(udata, dev);
@@ -299,11 +364,12 @@ int hs_monitor_new(hs_monitor **rmonitor)
     if (r < 0)
         goto error;
 
-    monitor = calloc(1, sizeof(*monitor));
+    monitor = _hs_calloc(1, sizeof(*monitor));
     if (!monitor) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
     }
+    monitor->replay_timer = -1;
 
     monitor->monitor = udev_monitor_new_from_netlink(udev, "udev");
     if (!monitor->monitor) {
@@ -341,22 +407,261 @@ error:
     return r;
 }
 
+#ifdef LIBHS_MONITOR_STATS
+static unsigned int count_device_allocations(const hs_device *dev)
+{
+    const char *strings[] = {dev->key, dev->location, dev->path,
+                             dev->manufacturer, dev->product, dev->serial};
+    // The device object (even when it is recycled), plus the strings that overflowed
+    unsigned int count = 1;
+
+    for (size_t i = 0; i < _HS_COUNTOF(strings); i++) {
+        if (strings[i] && (strings[i] < dev->strings ||
+                           strings[i] >= dev->strings + sizeof(dev->strings)))
+            count++;
+    }
+
+    return count;
+}
+#endif
+
+static int add_device(hs_monitor *monitor, const _hs_uevent *event)
+{
+    hs_device *dev = NULL;
+    int r;
+
+    // Known devices are ignored before anything gets allocated for them
+    if (event->attributes[_HS_UEVENT_DEVPATH] &&
+            _hs_monitor_has_device(monitor, event->attributes[_HS_UEVENT_DEVPATH])) {
+        _hs_monitor_stats_add(monitor, events_ignored, 1);
+        return 0;
+    }
+
+    _HS_MONITOR_TIMER(start);
+    r = read_device_information(event, &dev);
+    _hs_monitor_stats_time(monitor, inspect_time, start);
+    if (r > 0) {
+        _hs_monitor_stats_add(monitor, allocations, count_device_allocations(dev));
+        r = _hs_monitor_add(monitor, dev);
+    } else if (!r) {
+        _hs_monitor_stats_add(monitor, events_ignored, 1);
+    }
+
+    hs_device_unref(dev);
+    return r;
+}
+
+static int process_event(hs_monitor *monitor, const _hs_uevent *event)
+{
+    if (monitor->writer)
+        _hs_uevent_writer_append(monitor->writer, event);
+
+    switch (event->action) {
+    case _HS_UEVENT_SNAPSHOT:
+    case _HS_UEVENT_ADD:
+        return add_device(monitor, event);
+
+    case _HS_UEVENT_REMOVE:
+        if (event->attributes[_HS_UEVENT_DEVPATH])
+            _hs_monitor_remove(monitor, event->attributes[_HS_UEVENT_DEVPATH]);
+        break;
+
+    case _HS_UEVENT_OTHER:
+        _hs_monitor_stats_add(monitor, events_ignored, 1);
+        break;
+    }
+
+    return 0;
+}
+
+static void arm_replay_timer(hs_monitor *monitor)
+{
+    struct itimerspec spec = {{0}};
+    uint64_t next;
+
+    next = _hs_uevent_trace_peek(monitor->replay, NULL);
+    if (next != UINT64_MAX) {
+        if (monitor->replay_speed > 0.0) {
+            next = monitor->replay_start + (uint64_t)((double)next / monitor->replay_speed);
+        } else {
+            next = 0;
+        }
+
+        // A zero it_value disarms the timer, use the smallest value to fire right away
+        if (next) {
+            spec.it_value.tv_sec = (time_t)(next / 1000000000);
+            spec.it_value.tv_nsec = (long)(next % 1000000000);
+        } else {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+
+    timerfd_settime(monitor->replay_timer, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+int hs_monitor_new_from_trace(const char *filename, double speed, hs_monitor **rmonitor)
+{
+    assert(filename);
+    assert(rmonitor);
+
+    hs_monitor *monitor = NULL;
+    _hs_uevent_action action;
+    _hs_uevent event;
+    int r;
+
+    monitor = _hs_calloc(1, sizeof(*monitor));
+    if (!monitor) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    monitor->replay_speed = speed;
+
+    // hs_nanos() uses CLOCK_MONOTONIC too, so the timer can be armed with absolute times
+    monitor->replay_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (monitor->replay_timer < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "timerfd_create() failed: %s", strerror(errno));
+        goto error;
+    }
+
+    r = _hs_uevent_trace_load(filename, &monitor->replay);
+    if (r < 0)
+        goto error;
+
+    r = _hs_monitor_init(monitor);
+    if (r < 0)
+        goto error;
+
+    // Devices present when the trace was started play the role of the initial enumeration
+    while (_hs_uevent_trace_peek(monitor->replay, &action) != UINT64_MAX &&
+            action == _HS_UEVENT_SNAPSHOT) {
+        _hs_uevent_trace_next(monitor->replay, &event);
+
+        r = process_event(monitor, &event);
+        if (r < 0)
+            goto error;
+    }
+
+    monitor->replay_start = hs_nanos();
+    arm_replay_timer(monitor);
+
+    *rmonitor = monitor;
+    return 0;
+
+error:
+    hs_monitor_free(monitor);
+    return r;
+}
+
 void hs_monitor_free(hs_monitor *monitor)
 {
     if (monitor) {
         _hs_monitor_release(monitor);
         udev_monitor_unref(monitor->monitor);
+
+        _hs_uevent_writer_close(monitor->writer);
+        _hs_uevent_trace_free(monitor->replay);
+        if (monitor->replay_timer >= 0)
+            close(monitor->replay_timer);
     }
 
-    free(monitor);
+    _hs_free(monitor);
 }
 
 hs_descriptor hs_monitor_get_descriptor(const hs_monitor *monitor)
 {
     assert(monitor);
+
+    if (monitor->replay)
+        return monitor->replay_timer;
     return udev_monitor_get_fd(monitor->monitor);
 }
 
+static int snapshot_callback(const _hs_uevent *event, void *udata)
+{
+    _hs_uevent_writer_append(udata, event);
+    return 0;
+}
+
+int hs_monitor_start_trace(hs_monitor *monitor, const char *filename)
+{
+    assert(monitor);
+    assert(!monitor->replay);
+    assert(!monitor->writer);
+    assert(filename);
+
+    _hs_uevent_writer *writer;
+    int r;
+
+    r = _hs_uevent_writer_open(filename, &writer);
+    if (r < 0)
+        return r;
+
+    r = enumerate_devices(snapshot_callback, writer);
+    if (r < 0) {
+        _hs_uevent_writer_close(writer);
+        return r;
+    }
+
+    monitor->writer = writer;
+    return 0;
+}
+
+int hs_monitor_stop_trace(hs_monitor *monitor)
+{
+    assert(monitor);
+
+    int r;
+
+    r = _hs_uevent_writer_close(monitor->writer);
+    monitor->writer = NULL;
+
+    return r;
+}
+
+static struct udev_device *receive_device(hs_monitor *monitor)
+{
+    struct udev_device *udev_dev;
+
+    _HS_MONITOR_TIMER(start);
+    udev_dev = udev_monitor_receive_device(monitor->monitor);
+    _hs_monitor_stats_time(monitor, receive_time, start);
+
+    return udev_dev;
+}
+
+static int refresh_replay(hs_monitor *monitor)
+{
+    uint64_t expirations, now;
+    int r;
+
+    if (read(monitor->replay_timer, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        return hs_error(HS_ERROR_SYSTEM, "read() on timerfd failed: %s", strerror(errno));
+
+    now = hs_nanos();
+    while (true) {
+        uint64_t next = _hs_uevent_trace_peek(monitor->replay, NULL);
+        _hs_uevent event;
+
+        if (next == UINT64_MAX)
+            break;
+        if (monitor->replay_speed > 0.0 &&
+                monitor->replay_start + (uint64_t)((double)next / monitor->replay_speed) > now)
+            break;
+
+        _hs_uevent_trace_next(monitor->replay, &event);
+        _hs_monitor_stats_add(monitor, events, 1);
+
+        r = process_event(monitor, &event);
+        if (r < 0) {
+            arm_replay_timer(monitor);
+            return r;
+        }
+    }
+
+    arm_replay_timer(monitor);
+    return 0;
+}
+
 int hs_monitor_refresh(hs_monitor *monitor)
 {
     assert(monitor);
@@ -364,23 +669,36 @@ int hs_monitor_refresh(hs_monitor *monitor)
     struct udev_device *udev_dev;
     int r;
 
+    if (monitor->replay)
+        return refresh_replay(monitor);
+
     errno = 0;
-    while ((udev_dev = udev_monitor_receive_device(monitor->monitor))) {
+    while ((udev_dev = receive_device(monitor))) {
         const char *action = udev_device_get_action(udev_dev);
+        _hs_uevent event;
 
-        r = 0;
-        if (strcmp(action, "add") == 0) {
-            hs_device *dev = NULL;
+        _hs_monitor_stats_add(monitor, events, 1);
 
-            r = read_device_information(udev_dev, &dev);
-            if (r > 0)
-                r = _hs_monitor_add(monitor, dev);
+        memset(event.attributes, 0, sizeof(event.attributes));
+        event.attributes[_HS_UEVENT_SUBSYSTEM] = udev_device_get_subsystem(udev_dev);
+        event.attributes[_HS_UEVENT_DEVPATH] = udev_device_get_devpath(udev_dev);
 
-            hs_device_unref(dev);
-        } else if (strcmp(action, "remove") == 0) {
-            _hs_monitor_remove(monitor, udev_device_get_devpath(udev_dev));
+        if (strcmp(action, "add") == 0) {
+            event.action = _HS_UEVENT_ADD;
+
+            /* Spurious add events for devices we already know are dropped by add_device(),
+               skip the sysfs walk (and the allocations libudev does for it). */
+            if (!event.attributes[_HS_UEVENT_DEVPATH] ||
+                    !_hs_monitor_has_device(monitor, event.attributes[_HS_UEVENT_DEVPATH])) {
+                _HS_MONITOR_TIMER(start);
+                collect_attributes(udev_dev, &event);
+                _hs_monitor_stats_time(monitor, inspect_time, start);
+            }
+        } else {
+            event.action = strcmp(action, "remove") == 0 ? _HS_UEVENT_REMOVE : _HS_UEVENT_OTHER;
         }
 
+        r = process_event(monitor, &event);
         udev_device_unref(udev_dev);
 
         if (r < 0)
@@ -29,18 +29,43 @@
 #include "htable.h"
 #include "list.h"
 #include "hs/monitor.h"
+#ifdef LIBHS_MONITOR_STATS
+    #include "hs/platform.h"
+#endif
 
 struct hs_device;
 
+#ifdef LIBHS_MONITOR_STATS
+    #define _HS_MONITOR_STATS \
+        hs_monitor_stats stats;
+
+    #define _hs_monitor_stats_add(monitor, field, value) \
+        ((monitor)->stats.field += (value))
+    #define _HS_MONITOR_TIMER(start) \
+        uint64_t start = hs_nanos()
+    #define _hs_monitor_stats_time(monitor, field, start) \
+        ((monitor)->stats.field += hs_nanos() - (start))
+#else
+    #define _HS_MONITOR_STATS
+
+    #define _hs_monitor_stats_add(monitor, field, value) ((void)0)
+    #define _HS_MONITOR_TIMER(start) ((void)0)
+    #define _hs_monitor_stats_time(monitor, field, start) ((void)0)
+#endif
+
 #define _HS_MONITOR \
     _hs_list_head callbacks; \
     int callback_id; \
     \
-    _hs_htable devices;
+    _hs_htable devices; \
+    _hs_list_head handles; \
+    \
+    _HS_MONITOR_STATS
 
 int _hs_monitor_init(hs_monitor *monitor);
 void _hs_monitor_release(hs_monitor *monitor);
 
+bool _hs_monitor_has_device(hs_monitor *monitor, const char *key);
 int _hs_monitor_add(hs_monitor *monitor, struct hs_device *dev);
 void _hs_monitor_remove(hs_monitor *monitor, const char *key);
 
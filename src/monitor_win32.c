@@ -39,6 +39,7 @@
 #include <wchar.h>
 #include "device_priv.h"
 #include "list.h"
+#include "log_priv.h"
 #include "monitor_priv.h"
 #include "hs/platform.h"
 
@@ -107,9 +108,9 @@ _HS_EXIT()
 static void free_notification(struct device_notification *notification)
 {
     if (notification)
-        free(notification->key);
+        _hs_free(notification->key);
 
-    free(notification);
+    _hs_free(notification);
 }
 
 static uint8_t find_controller(const char *id)
@@ -128,7 +129,7 @@ static int build_device_path(const char *id, const GUID *guid, char **rpath)
 {
     char *path, *ptr;
 
-    path = malloc(4 + strlen(id) + 41);
+    path = _hs_malloc(4 + strlen(id) + 41);
     if (!path)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
@@ -193,7 +194,7 @@ static int build_location_string(uint8_t ports[], unsigned int depth, char **rpa
         size -= (size_t)r;
     }
 
-    path = strdup(buf);
+    path = _hs_strdup(buf);
     if (!path)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
@@ -207,7 +208,7 @@ static int wide_to_cstring(const wchar_t *wide, size_t size, char **rs)
     char *s = NULL;
     int len, r;
 
-    tmp = calloc(1, size + sizeof(wchar_t));
+    tmp = _hs_calloc(1, size + sizeof(wchar_t));
     if (!tmp) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto cleanup;
@@ -222,7 +223,7 @@ static int wide_to_cstring(const wchar_t *wide, size_t size, char **rs)
         goto cleanup;
     }
 
-    s = malloc((size_t)len);
+    s = _hs_malloc((size_t)len);
     if (!s) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto cleanup;
@@ -240,8 +241,8 @@ static int wide_to_cstring(const wchar_t *wide, size_t size, char **rs)
 
     r = 0;
 cleanup:
-    free(s);
-    free(tmp);
+    _hs_free(s);
+    _hs_free(tmp);
     return r;
 }
 
@@ -255,7 +256,7 @@ static int get_port_driverkey(HANDLE hub, uint8_t port, char **rkey)
     int r;
 
     len = sizeof(node) + (sizeof(USB_PIPE_INFO) * 30);
-    node = calloc(1, len);
+    node = _hs_calloc(1, len);
     if (!node) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto cleanup;
@@ -285,7 +286,7 @@ static int get_port_driverkey(HANDLE hub, uint8_t port, char **rkey)
         goto cleanup;
     }
 
-    wide = calloc(1, pseudo.ActualLength);
+    wide = _hs_calloc(1, pseudo.ActualLength);
     if (!wide) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto cleanup;
@@ -307,8 +308,8 @@ static int get_port_driverkey(HANDLE hub, uint8_t port, char **rkey)
 
     r = 1;
 cleanup:
-    free(wide);
-    free(node);
+    _hs_free(wide);
+    _hs_free(node);
     return r;
 }
 
@@ -350,19 +351,19 @@ static int find_device_port_xp(const char *hub_id, const char *child_key)
             continue;
 
         if (strcmp(key, child_key) == 0) {
-            free(key);
+            _hs_free(key);
 
             r = port;
             break;
         } else {
-            free(key);
+            _hs_free(key);
         }
     }
 
 cleanup:
     if (h)
         CloseHandle(h);
-    free(path);
+    _hs_free(path);
     return r;
 }
 
@@ -626,7 +627,7 @@ static int read_device_properties(hs_device *dev, DEVINST inst, uint8_t port)
     }
 
     len = sizeof(node) + (sizeof(USB_PIPE_INFO) * 30);
-    node = calloc(1, len);
+    node = _hs_calloc(1, len);
     if (!node) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto cleanup;
@@ -666,10 +667,10 @@ static int read_device_properties(hs_device *dev, DEVINST inst, uint8_t port)
 
     r = 1;
 cleanup:
-    free(node);
+    _hs_free(node);
     if (h)
         CloseHandle(h);
-    free(path);
+    _hs_free(path);
     return r;
 }
 
@@ -698,7 +699,7 @@ static int get_device_comport(DEVINST inst, char **rnode)
         return 0;
     }
 
-    r = asprintf(&node, "\\\\.\\%s", buf);
+    r = _hs_asprintf(&node, "\\\\.\\%s", buf);
     if (r < 0)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
@@ -744,15 +745,14 @@ static int process_win32_device(DEVINST inst, const char *id, hs_device **rdev)
     unsigned int depth;
     int r;
 
-    dev = calloc(1, sizeof(*dev));
+    dev = _hs_device_new();
     if (!dev) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto cleanup;
     }
-    dev->refcount = 1;
 
     if (id) {
-        dev->key = strdup(id);
+        dev->key = _hs_strdup(id);
     } else {
         char buf[256];
         CONFIGRET cret;
@@ -764,7 +764,7 @@ static int process_win32_device(DEVINST inst, const char *id, hs_device **rdev)
             goto cleanup;
         }
 
-        dev->key = strdup(buf);
+        dev->key = _hs_strdup(buf);
     }
     if (!dev->key) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
@@ -834,7 +834,7 @@ static int add_controller(DEVINST inst, uint8_t index)
         return 0;
     }
 
-    controller = malloc(sizeof(*controller) + strlen(roothub_id) + 1);
+    controller = _hs_malloc(sizeof(*controller) + strlen(roothub_id) + 1);
     if (!controller)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
@@ -950,7 +950,7 @@ static int extract_device_id(const char *key, char **rid)
             || strncmp(key, "##?#", 4) == 0)
         key += 4;
 
-    id = strdup(key);
+    id = _hs_strdup(key);
     if (!id)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
@@ -973,7 +973,7 @@ static int post_device_event(hs_monitor *monitor, enum device_event event, DEV_B
     struct device_notification *notification;
     int r;
 
-    notification = calloc(1, sizeof(*notification));
+    notification = _hs_calloc(1, sizeof(*notification));
     if (!notification)
         return hs_error(HS_ERROR_MEMORY, NULL);
 
@@ -1134,7 +1134,7 @@ int hs_monitor_new(hs_monitor **rmonitor)
     hs_monitor *monitor;
     int r;
 
-    monitor = calloc(1, sizeof(*monitor));
+    monitor = _hs_calloc(1, sizeof(*monitor));
     if (!monitor) {
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
@@ -1203,7 +1203,7 @@ void hs_monitor_free(hs_monitor *monitor)
         }
     }
 
-    free(monitor);
+    _hs_free(monitor);
 }
 
 hs_descriptor hs_monitor_get_descriptor(const hs_monitor *monitor)
@@ -1261,12 +1261,14 @@ int hs_monitor_refresh(hs_monitor *monitor)
 
         switch (notification->event) {
         case DEVICE_EVENT_ADDED:
-            hs_log(HS_LOG_DEBUG, "Received arrival notification for device '%s'", notification->key);
+            _hs_log_ratelimited(HS_LOG_DEBUG, "Received arrival notification for device '%s'",
+                                notification->key);
             r = process_arrival_notification(monitor, notification->key);
             break;
 
         case DEVICE_EVENT_REMOVED:
-            hs_log(HS_LOG_DEBUG, "Received removal notification for device '%s'", notification->key);
+            _hs_log_ratelimited(HS_LOG_DEBUG, "Received removal notification for device '%s'",
+                                notification->key);
             _hs_monitor_remove(monitor, notification->key);
             r = 0;
             break;
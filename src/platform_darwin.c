@@ -37,6 +37,15 @@ uint64_t hs_millis(void)
     return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000000;
 }
 
+uint64_t hs_nanos(void)
+{
+    static mach_timebase_info_data_t tb;
+    if (!tb.numer)
+        mach_timebase_info(&tb);
+
+    return (uint64_t)mach_absolute_time() * tb.numer / tb.denom;
+}
+
 int hs_poll(const hs_descriptor_set *set, int timeout)
 {
     assert(set);
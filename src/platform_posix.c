@@ -24,10 +24,37 @@
 
 #include "util.h"
 #include <poll.h>
+#ifdef __linux__
+    #include <sys/epoll.h>
+    #include <unistd.h>
+#endif
 #include <sys/utsname.h>
 #include <time.h>
+#ifdef __linux__
+    #include "device_priv.h"
+#endif
 #include "hs/platform.h"
 
+#ifdef __linux__
+struct poller_entry {
+    _hs_fd_watch watch;
+
+    struct hs_poller *poller;
+    int id;
+};
+
+struct hs_poller {
+    int epfd;
+    /* Descriptors are tracked so they can be added back after a reconnection. The table is
+       indexed by descriptor, which the kernel keeps small and dense. */
+    struct poller_entry **entries;
+    unsigned int entries_size;
+
+    struct epoll_event *events;
+    unsigned int events_size;
+};
+#endif
+
 uint64_t hs_millis(void)
 {
     struct timespec ts;
@@ -40,7 +67,18 @@ uint64_t hs_millis(void)
 #endif
     assert(!r);
 
-    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 10000000;
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+uint64_t hs_nanos(void)
+{
+    struct timespec ts;
+    int r;
+
+    r = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(!r);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
 }
 
 int hs_poll(const hs_descriptor_set *set, int timeout)
@@ -80,6 +118,200 @@ restart:
 }
 
 #ifdef __linux__
+int hs_poller_new(hs_poller **rpoller)
+{
+    assert(rpoller);
+
+    hs_poller *poller;
+    int r;
+
+    poller = _hs_calloc(1, sizeof(*poller));
+    if (!poller)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+    poller->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (poller->epfd < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "epoll_create1() failed: %s", strerror(errno));
+        _hs_free(poller);
+        return r;
+    }
+
+    *rpoller = poller;
+    return 0;
+}
+
+void hs_poller_free(hs_poller *poller)
+{
+    if (poller) {
+        for (unsigned int i = 0; i < poller->entries_size; i++) {
+            struct poller_entry *entry = poller->entries[i];
+
+            if (entry) {
+                _hs_fd_watch_remove(&entry->watch);
+                _hs_free(entry);
+            }
+        }
+        _hs_free(poller->entries);
+
+        close(poller->epfd);
+        _hs_free(poller->events);
+    }
+
+    _hs_free(poller);
+}
+
+hs_descriptor hs_poller_get_descriptor(const hs_poller *poller)
+{
+    assert(poller);
+    return poller->epfd;
+}
+
+static int register_poller_entry(struct poller_entry *entry)
+{
+    struct epoll_event ev = {0};
+    int r;
+
+    // Level-triggered, so that hs_poller_wait() behaves like hs_poll()
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint32_t)entry->id;
+
+    r = epoll_ctl(entry->poller->epfd, EPOLL_CTL_ADD, entry->watch.fd, &ev);
+    if (r < 0 && errno == EEXIST)
+        r = epoll_ctl(entry->poller->epfd, EPOLL_CTL_MOD, entry->watch.fd, &ev);
+
+    return r;
+}
+
+static void reregister_poller_entry(_hs_fd_watch *watch)
+{
+    struct poller_entry *entry = _hs_container_of(watch, struct poller_entry, watch);
+
+    if (register_poller_entry(entry) < 0)
+        hs_log(HS_LOG_WARNING, "Failed to add descriptor %d back to poller: %s", watch->fd,
+               strerror(errno));
+}
+
+static struct poller_entry *find_poller_entry(hs_poller *poller, int fd)
+{
+    if ((unsigned int)fd >= poller->entries_size)
+        return NULL;
+    return poller->entries[fd];
+}
+
+static int grow_poller_entries(hs_poller *poller, int fd)
+{
+    struct poller_entry **entries;
+    unsigned int size;
+
+    if ((unsigned int)fd < poller->entries_size)
+        return 0;
+
+    size = poller->entries_size ? poller->entries_size : 64;
+    while (size <= (unsigned int)fd)
+        size *= 2;
+
+    entries = _hs_realloc(poller->entries, size * sizeof(*entries));
+    if (!entries)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    memset(entries + poller->entries_size, 0,
+           (size - poller->entries_size) * sizeof(*entries));
+    poller->entries = entries;
+    poller->entries_size = size;
+
+    return 0;
+}
+
+int hs_poller_add(hs_poller *poller, hs_descriptor desc, int id)
+{
+    assert(poller);
+    assert(desc >= 0);
+
+    struct poller_entry *entry;
+    int r;
+
+    if (find_poller_entry(poller, desc))
+        return hs_error(HS_ERROR_INVALID, "Descriptor %d is already in the poller", desc);
+    r = grow_poller_entries(poller, desc);
+    if (r < 0)
+        return r;
+
+    entry = _hs_calloc(1, sizeof(*entry));
+    if (!entry)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    entry->poller = poller;
+    entry->id = id;
+    entry->watch.fd = desc;
+
+    r = register_poller_entry(entry);
+    if (r < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "epoll_ctl(%d) failed: %s", desc, strerror(errno));
+        _hs_free(entry);
+        return r;
+    }
+
+    poller->entries[desc] = entry;
+    _hs_fd_watch_add(&entry->watch, desc, reregister_poller_entry);
+
+    return 0;
+}
+
+void hs_poller_remove(hs_poller *poller, hs_descriptor desc)
+{
+    assert(poller);
+
+    struct poller_entry *entry;
+
+    epoll_ctl(poller->epfd, EPOLL_CTL_DEL, desc, NULL);
+
+    entry = find_poller_entry(poller, desc);
+    if (entry) {
+        _hs_fd_watch_remove(&entry->watch);
+        poller->entries[desc] = NULL;
+        _hs_free(entry);
+    }
+}
+
+int hs_poller_wait(hs_poller *poller, int *ids, unsigned int count, int timeout)
+{
+    assert(poller);
+    assert(ids);
+    assert(count);
+
+    uint64_t start;
+    int r;
+
+    /* A single epoll_wait() call is needed for fairness. The kernel moves the descriptors it
+       reports to the end of its ready list, so the ones left over come first next time. */
+    if (count > INT_MAX)
+        count = INT_MAX;
+    if (count > poller->events_size) {
+        struct epoll_event *events;
+
+        events = _hs_realloc(poller->events, count * sizeof(*events));
+        if (!events)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+        poller->events = events;
+        poller->events_size = count;
+    }
+
+    if (timeout < 0)
+        timeout = -1;
+
+    start = hs_millis();
+restart:
+    r = epoll_wait(poller->epfd, poller->events, (int)count, hs_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+        return hs_error(HS_ERROR_SYSTEM, "epoll_wait() failed: %s", strerror(errno));
+    }
+
+    for (int i = 0; i < r; i++)
+        ids[i] = (int)(uint32_t)poller->events[i].data.u64;
+
+    return r;
+}
+
 uint32_t hs_linux_version(void)
 {
     static uint32_t version;
@@ -68,6 +68,28 @@ uint64_t hs_millis(void)
     return GetTickCount64_();
 }
 
+uint64_t hs_nanos(void)
+{
+    static LARGE_INTEGER freq;
+
+    LARGE_INTEGER now;
+    ULONGLONG ticks;
+    BOOL ret;
+
+    if (!freq.QuadPart) {
+        ret = QueryPerformanceFrequency(&freq);
+        assert(ret);
+    }
+
+    ret = QueryPerformanceCounter(&now);
+    assert(ret);
+
+    // Split the conversion to avoid overflowing after a few hours of uptime
+    ticks = (ULONGLONG)now.QuadPart;
+    return ticks / (ULONGLONG)freq.QuadPart * 1000000000 +
+           ticks % (ULONGLONG)freq.QuadPart * 1000000000 / (ULONGLONG)freq.QuadPart;
+}
+
 int hs_poll(const hs_descriptor_set *set, int timeout)
 {
     assert(set);
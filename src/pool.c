@@ -0,0 +1,145 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#ifdef _MSC_VER
+    #include <windows.h>
+#endif
+#include "pool.h"
+
+/* Pools that hold free objects, so hs_set_allocator() can give them back to the allocator
+   that made them. Pools are static and never leave the list, new ones are pushed in front. */
+static long pools_lock;
+static _hs_pool *pools;
+
+// Critical sections are a handful of pointer operations, spinning beats a mutex here
+static void spin_lock(long *lock)
+{
+#ifdef _MSC_VER
+    while (InterlockedExchange(lock, 1))
+        continue;
+#else
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+        continue;
+#endif
+}
+
+static void spin_unlock(long *lock)
+{
+#ifdef _MSC_VER
+    InterlockedExchange(lock, 0);
+#else
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+static void lock_pool(_hs_pool *pool)
+{
+    spin_lock(&pool->lock);
+}
+
+static void unlock_pool(_hs_pool *pool)
+{
+    spin_unlock(&pool->lock);
+}
+
+void *_hs_pool_alloc(_hs_pool *pool)
+{
+    void *ptr;
+
+    lock_pool(pool);
+    ptr = pool->free_list;
+    if (ptr) {
+        pool->free_list = *(void **)ptr;
+        pool->free_count--;
+    }
+    unlock_pool(pool);
+
+    if (ptr) {
+        memset(ptr, 0, pool->size);
+        return ptr;
+    }
+
+    return _hs_calloc(1, pool->size);
+}
+
+void _hs_pool_free(_hs_pool *pool, void *ptr)
+{
+    if (!ptr)
+        return;
+
+    lock_pool(pool);
+    if (pool->free_count < pool->max_free) {
+        if (!pool->registered) {
+            spin_lock(&pools_lock);
+            pool->next = pools;
+            pools = pool;
+            spin_unlock(&pools_lock);
+
+            pool->registered = true;
+        }
+
+        *(void **)ptr = pool->free_list;
+        pool->free_list = ptr;
+        pool->free_count++;
+
+        ptr = NULL;
+    }
+    unlock_pool(pool);
+
+    _hs_free(ptr);
+}
+
+static void release_pool(_hs_pool *pool)
+{
+    void *ptr;
+
+    lock_pool(pool);
+    ptr = pool->free_list;
+    pool->free_list = NULL;
+    pool->free_count = 0;
+    unlock_pool(pool);
+
+    while (ptr) {
+        void *next = *(void **)ptr;
+
+        _hs_free(ptr);
+        ptr = next;
+    }
+}
+
+void _hs_pool_release_all(void)
+{
+    _hs_pool *pool;
+
+    spin_lock(&pools_lock);
+    pool = pools;
+    spin_unlock(&pools_lock);
+
+    // The next pointers never change once a pool is in the list
+    while (pool) {
+        release_pool(pool);
+        pool = pool->next;
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef _HS_POOL_H
+#define _HS_POOL_H
+
+#include "util.h"
+
+/* Recycles fixed-size objects. Up to max_free released objects are kept around and handed
+   out again (zeroed) by _hs_pool_alloc(), the rest goes back to the allocator. Pools are
+   meant to be static, and are safe to use from multiple threads.
+
+   Free objects are never released at exit, the allocator may be gone by then. */
+typedef struct _hs_pool {
+    size_t size;
+    unsigned int max_free;
+
+    long lock;
+    void *free_list;
+    unsigned int free_count;
+
+    bool registered;
+    struct _hs_pool *next;
+} _hs_pool;
+
+#define _HS_POOL_INIT(size, max_free) {(size), (max_free), 0, NULL, 0, false, NULL}
+
+void *_hs_pool_alloc(_hs_pool *pool);
+void _hs_pool_free(_hs_pool *pool, void *ptr);
+
+// Give the free objects of every pool back to the allocator, see hs_set_allocator()
+void _hs_pool_release_all(void);
+
+#endif
@@ -0,0 +1,519 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "capture_priv.h"
+#include "hs/monitor.h"
+#include "hs/platform.h"
+#include "hs/virtual.h"
+
+// Upper bound for each wait, so that hs_replay_stop() is noticed quickly
+#define MAX_WAIT_SLICE 100000000ull
+
+struct replay_device {
+    hs_virtual_device *vdev;
+    bool numbered_reports;
+
+    // Latest recorded answer for each feature report ID, updated while the replay progresses
+    const _hs_capture_record *features[256];
+};
+
+struct hs_replay {
+    char *filename;
+    uint8_t *map;
+    size_t map_size;
+    size_t records_offset;
+    size_t records_end;
+
+    struct replay_device *devices;
+    unsigned int devices_count;
+    struct pollfd *pfds;
+
+    bool stop;
+};
+
+static inline const uint8_t *record_payload(const _hs_capture_record *record)
+{
+    return (const uint8_t *)(record + 1);
+}
+
+static const _hs_capture_record *next_record(const hs_replay *replay, size_t *roffset)
+{
+    const _hs_capture_record *record;
+
+    if (*roffset + sizeof(*record) > replay->records_end)
+        return NULL;
+    record = (const _hs_capture_record *)(replay->map + *roffset);
+    *roffset += sizeof(*record) + _HS_CAPTURE_ALIGN((size_t)record->size);
+
+    return record;
+}
+
+static int map_file(hs_replay *replay, const char *filename)
+{
+    const _hs_capture_header *header;
+    struct stat sb;
+    int fd, r;
+
+restart:
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        switch (errno) {
+        case EINTR:
+            goto restart;
+        case EACCES:
+            return hs_error(HS_ERROR_ACCESS, "Permission denied for '%s'", filename);
+        case ENOENT:
+            return hs_error(HS_ERROR_NOT_FOUND, "Capture file '%s' does not exist", filename);
+        }
+        return hs_error(HS_ERROR_SYSTEM, "open('%s') failed: %s", filename, strerror(errno));
+    }
+
+    r = fstat(fd, &sb);
+    if (r < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "fstat('%s') failed: %s", filename, strerror(errno));
+        goto cleanup;
+    }
+    if ((size_t)sb.st_size < sizeof(*header)) {
+        r = hs_error(HS_ERROR_INVALID, "File '%s' is not a capture file", filename);
+        goto cleanup;
+    }
+
+    replay->map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (replay->map == MAP_FAILED) {
+        replay->map = NULL;
+        r = hs_error(HS_ERROR_SYSTEM, "mmap('%s') failed: %s", filename, strerror(errno));
+        goto cleanup;
+    }
+    replay->map_size = (size_t)sb.st_size;
+
+    header = (const _hs_capture_header *)replay->map;
+    if (memcmp(header->magic, _HS_CAPTURE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->header_size < sizeof(*header) || header->header_size % 8 ||
+            header->header_size > replay->map_size) {
+        r = hs_error(HS_ERROR_INVALID, "File '%s' is not a capture file", filename);
+        goto cleanup;
+    }
+    if (header->version != _HS_CAPTURE_VERSION) {
+        r = hs_error(HS_ERROR_INVALID, "Unsupported version %u for capture file '%s'",
+                     header->version, filename);
+        goto cleanup;
+    }
+    replay->records_offset = header->header_size;
+
+    r = 0;
+cleanup:
+    close(fd);
+    return r;
+}
+
+// Returns the next string of a device record, or NULL if it is not NUL-terminated
+static const char *read_string(const uint8_t **rptr, const uint8_t *end)
+{
+    const char *s = (const char *)*rptr;
+    const uint8_t *nul;
+
+    nul = memchr(*rptr, 0, (size_t)(end - *rptr));
+    if (!nul)
+        return NULL;
+    *rptr = nul + 1;
+
+    return s;
+}
+
+static int create_device(hs_replay *replay, const _hs_capture_record *record)
+{
+    const uint8_t *ptr = record_payload(record), *end = ptr + record->size;
+    _hs_capture_device device;
+    const char *strings[4];
+    hs_virtual_device_info info = {0};
+    uint8_t desc[16];
+    size_t desc_size = 0;
+    struct replay_device *rdev;
+    int r;
+
+    if (record->size < sizeof(device))
+        goto invalid;
+    memcpy(&device, ptr, sizeof(device));
+    ptr += sizeof(device);
+    for (unsigned int i = 0; i < 4; i++) {
+        strings[i] = read_string(&ptr, end);
+        if (!strings[i])
+            goto invalid;
+    }
+
+    rdev = &replay->devices[replay->devices_count];
+
+    // Just enough for the virtual device to report the same usage and report numbering
+    desc[desc_size++] = 0x06;
+    desc[desc_size++] = (uint8_t)(device.usage_page & 0xFF);
+    desc[desc_size++] = (uint8_t)(device.usage_page >> 8);
+    desc[desc_size++] = 0x0A;
+    desc[desc_size++] = (uint8_t)(device.usage & 0xFF);
+    desc[desc_size++] = (uint8_t)(device.usage >> 8);
+    desc[desc_size++] = 0xA1;
+    desc[desc_size++] = 0x01;
+    if (rdev->numbered_reports) {
+        desc[desc_size++] = 0x85;
+        desc[desc_size++] = 0x01;
+    }
+    desc[desc_size++] = 0xC0;
+
+    info.type = HS_DEVICE_TYPE_HID;
+    info.vid = device.vid;
+    info.pid = device.pid;
+    info.iface = device.iface;
+    info.location = strings[0][0] ? strings[0] : NULL;
+    info.manufacturer = strings[1][0] ? strings[1] : NULL;
+    info.product = strings[2][0] ? strings[2] : NULL;
+    info.serial = strings[3][0] ? strings[3] : NULL;
+    info.report_descriptor = desc;
+    info.report_descriptor_size = desc_size;
+
+    r = hs_virtual_device_new(&info, &rdev->vdev);
+    if (r < 0)
+        return r;
+
+    replay->pfds[replay->devices_count].fd = hs_virtual_device_get_peer(rdev->vdev);
+    replay->pfds[replay->devices_count].events = POLLIN;
+    replay->devices_count++;
+
+    return 0;
+
+invalid:
+    return hs_error(HS_ERROR_INVALID, "Malformed device record in capture file '%s'",
+                    replay->filename);
+}
+
+static ssize_t answer_feature_report(hs_virtual_device *vdev, int set, uint8_t *buf,
+                                     size_t size, void *udata)
+{
+    struct replay_device *rdev = udata;
+    const _hs_capture_record *record;
+
+    if (set)
+        return (ssize_t)size;
+
+    record = __atomic_load_n(&rdev->features[buf[0]], __ATOMIC_ACQUIRE);
+    if (!record)
+        return hs_error(HS_ERROR_IO, "Feature report %u was not recorded for '%s'", buf[0],
+                        hs_device_get_path(hs_virtual_device_get_device(vdev)));
+
+    if (size > record->size)
+        size = record->size;
+    memcpy(buf, record_payload(record), size);
+
+    return (ssize_t)size;
+}
+
+static int load_devices(hs_replay *replay)
+{
+    const _hs_capture_record *record;
+    unsigned int count = 0;
+    size_t offset;
+    int r;
+
+    // Ignore a truncated last record, the capture may not have been closed properly
+    replay->records_end = replay->records_offset;
+    offset = replay->records_offset;
+    while (offset + sizeof(*record) <= replay->map_size) {
+        record = (const _hs_capture_record *)(replay->map + offset);
+        if (offset + sizeof(*record) + record->size > replay->map_size)
+            break;
+        offset += sizeof(*record) + _HS_CAPTURE_ALIGN((size_t)record->size);
+        replay->records_end = offset < replay->map_size ? offset : replay->map_size;
+
+        if (record->type == _HS_CAPTURE_DEVICE) {
+            if (record->device != count)
+                return hs_error(HS_ERROR_INVALID, "Malformed device record in capture file '%s'",
+                                replay->filename);
+            count++;
+        } else if (record->device >= count) {
+            return hs_error(HS_ERROR_INVALID, "Unknown device in capture file '%s'",
+                            replay->filename);
+        }
+    }
+
+    replay->devices = _hs_calloc(count ? count : 1, sizeof(*replay->devices));
+    replay->pfds = _hs_calloc(count ? count : 1, sizeof(*replay->pfds));
+    if (!replay->devices || !replay->pfds)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+    // Reports use the hidraw format, which only starts with the report ID for numbered reports
+    offset = replay->records_offset;
+    while ((record = next_record(replay, &offset))) {
+        struct replay_device *rdev = &replay->devices[record->device];
+        const uint8_t *payload = record_payload(record);
+
+        switch ((_hs_capture_record_type)record->type) {
+        case _HS_CAPTURE_INPUT:
+            if (record->size && payload[0])
+                rdev->numbered_reports = true;
+            break;
+        case _HS_CAPTURE_GET_FEATURE:
+            if (record->size && !rdev->features[payload[0]])
+                rdev->features[payload[0]] = record;
+            break;
+
+        case _HS_CAPTURE_DEVICE:
+        case _HS_CAPTURE_OUTPUT:
+        case _HS_CAPTURE_SEND_FEATURE:
+            break;
+        }
+    }
+
+    offset = replay->records_offset;
+    while ((record = next_record(replay, &offset))) {
+        if (record->type != _HS_CAPTURE_DEVICE)
+            continue;
+
+        r = create_device(replay, record);
+        if (r < 0)
+            return r;
+    }
+
+    for (unsigned int i = 0; i < replay->devices_count; i++)
+        hs_virtual_device_set_feature_func(replay->devices[i].vdev, answer_feature_report,
+                                           &replay->devices[i]);
+
+    return 0;
+}
+
+int hs_replay_new(const char *filename, hs_replay **rreplay)
+{
+    assert(filename);
+    assert(rreplay);
+
+    hs_replay *replay;
+    int r;
+
+    replay = _hs_calloc(1, sizeof(*replay));
+    if (!replay) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    replay->filename = _hs_strdup(filename);
+    if (!replay->filename) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    r = map_file(replay, filename);
+    if (r < 0)
+        goto error;
+    r = load_devices(replay);
+    if (r < 0)
+        goto error;
+
+    *rreplay = replay;
+    return 0;
+
+error:
+    hs_replay_free(replay);
+    return r;
+}
+
+void hs_replay_free(hs_replay *replay)
+{
+    if (replay) {
+        for (unsigned int i = 0; i < replay->devices_count; i++)
+            hs_virtual_device_free(replay->devices[i].vdev);
+        _hs_free(replay->devices);
+        _hs_free(replay->pfds);
+
+        if (replay->map)
+            munmap(replay->map, replay->map_size);
+        _hs_free(replay->filename);
+    }
+
+    _hs_free(replay);
+}
+
+unsigned int hs_replay_get_device_count(const hs_replay *replay)
+{
+    assert(replay);
+    return replay->devices_count;
+}
+
+hs_virtual_device *hs_replay_get_device(const hs_replay *replay, unsigned int idx)
+{
+    assert(replay);
+    assert(idx < replay->devices_count);
+
+    return replay->devices[idx].vdev;
+}
+
+int hs_replay_plug(hs_replay *replay, hs_monitor *monitor)
+{
+    assert(replay);
+    assert(monitor);
+
+    for (unsigned int i = 0; i < replay->devices_count; i++) {
+        int r = hs_virtual_device_plug(replay->devices[i].vdev, monitor);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+/* Wait up to timeout nanoseconds, and discard the output reports sent by the application in
+   the meantime. If out is not NULL, return early once this peer becomes writable. */
+static int wait_peers(hs_replay *replay, uint64_t timeout, struct pollfd *out)
+{
+    struct timespec ts;
+    int r;
+
+    if (timeout > MAX_WAIT_SLICE)
+        timeout = MAX_WAIT_SLICE;
+    ts.tv_sec = (time_t)(timeout / 1000000000);
+    ts.tv_nsec = (long)(timeout % 1000000000);
+
+    if (out)
+        out->events |= POLLOUT;
+    r = ppoll(replay->pfds, replay->devices_count, &ts, NULL);
+    if (out)
+        out->events = POLLIN;
+    if (r < 0) {
+        if (errno == EINTR)
+            return 0;
+        return hs_error(HS_ERROR_SYSTEM, "ppoll() failed: %s", strerror(errno));
+    }
+
+    for (unsigned int i = 0; r && i < replay->devices_count; i++) {
+        uint8_t buf[1024];
+
+        if (!(replay->pfds[i].revents & POLLIN))
+            continue;
+        while (read(replay->pfds[i].fd, buf, sizeof(buf)) > 0)
+            continue;
+    }
+
+    return 0;
+}
+
+static int send_report(hs_replay *replay, unsigned int idx, const _hs_capture_record *record)
+{
+    const struct replay_device *rdev = &replay->devices[idx];
+    const uint8_t *buf = record_payload(record);
+    size_t size = record->size;
+
+    if (!rdev->numbered_reports) {
+        buf++;
+        size--;
+    }
+
+    while (!__atomic_load_n(&replay->stop, __ATOMIC_RELAXED)) {
+        ssize_t r;
+        int r2;
+
+        r = write(replay->pfds[idx].fd, buf, size);
+        if (r >= 0)
+            return 1;
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN)
+            return hs_error(HS_ERROR_SYSTEM, "write('%s') failed: %s",
+                            hs_device_get_path(hs_virtual_device_get_device(rdev->vdev)),
+                            strerror(errno));
+
+        // The application is lagging behind, wait for it
+        r2 = wait_peers(replay, MAX_WAIT_SLICE, &replay->pfds[idx]);
+        if (r2 < 0)
+            return r2;
+    }
+
+    return 0;
+}
+
+ssize_t hs_replay_run(hs_replay *replay, double speed)
+{
+    assert(replay);
+
+    const _hs_capture_record *record;
+    uint64_t start;
+    size_t offset;
+    ssize_t sent = 0;
+    int r;
+
+    __atomic_store_n(&replay->stop, false, __ATOMIC_RELAXED);
+
+    start = hs_nanos();
+    offset = replay->records_offset;
+    while ((record = next_record(replay, &offset))) {
+        struct replay_device *rdev = &replay->devices[record->device];
+
+        if (__atomic_load_n(&replay->stop, __ATOMIC_RELAXED))
+            break;
+
+        switch ((_hs_capture_record_type)record->type) {
+        case _HS_CAPTURE_INPUT:
+            if (record->size < 2)
+                break;
+
+            if (speed > 0.0) {
+                uint64_t due = start + (uint64_t)((double)record->time / speed);
+                uint64_t now;
+
+                while ((now = hs_nanos()) < due &&
+                        !__atomic_load_n(&replay->stop, __ATOMIC_RELAXED)) {
+                    r = wait_peers(replay, due - now, NULL);
+                    if (r < 0)
+                        return r;
+                }
+            }
+
+            r = send_report(replay, record->device, record);
+            if (r < 0)
+                return r;
+            sent += r;
+            break;
+
+        case _HS_CAPTURE_GET_FEATURE:
+            if (record->size)
+                __atomic_store_n(&rdev->features[record_payload(record)[0]], record,
+                                 __ATOMIC_RELEASE);
+            break;
+
+        case _HS_CAPTURE_DEVICE:
+        case _HS_CAPTURE_OUTPUT:
+        case _HS_CAPTURE_SEND_FEATURE:
+            break;
+        }
+    }
+
+    return sent;
+}
+
+void hs_replay_stop(hs_replay *replay)
+{
+    assert(replay);
+    __atomic_store_n(&replay->stop, true, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,282 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include "device_posix_priv.h"
+#include "log_priv.h"
+#include "hs/platform.h"
+#include "hs/serial.h"
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+// Worst case for a COBS frame is one overhead byte per 254 bytes, plus the delimiters
+#define COBS_MAX_ENCODED_SIZE(size) ((size) + (size) / 254 + 3)
+#define SLIP_MAX_ENCODED_SIZE(size) (2 * (size) + 2)
+
+static ssize_t decode_cobs(const uint8_t *src, size_t len, uint8_t *dst, size_t size)
+{
+    size_t out = 0;
+
+    while (len) {
+        // The frame has been cut at the delimiter, so code cannot be 0
+        size_t code = src[0];
+
+        if (code > len || code - 1 > size - out)
+            return -1;
+
+        memcpy(dst + out, src + 1, code - 1);
+        out += code - 1;
+        src += code;
+        len -= code;
+
+        if (len && code != 0xFF) {
+            if (out == size)
+                return -1;
+            dst[out++] = 0;
+        }
+    }
+
+    return (ssize_t)out;
+}
+
+static ssize_t decode_slip(const uint8_t *src, size_t len, uint8_t *dst, size_t size)
+{
+    size_t out = 0;
+
+    while (len) {
+        const uint8_t *esc = memchr(src, SLIP_ESC, len);
+        size_t run = esc ? (size_t)(esc - src) : len;
+
+        if (run > size - out)
+            return -1;
+
+        memcpy(dst + out, src, run);
+        out += run;
+        src += run;
+        len -= run;
+
+        if (esc) {
+            if (len < 2 || out == size)
+                return -1;
+
+            switch (src[1]) {
+            case SLIP_ESC_END:
+                dst[out++] = SLIP_END;
+                break;
+            case SLIP_ESC_ESC:
+                dst[out++] = SLIP_ESC;
+                break;
+
+            default:
+                return -1;
+            }
+            src += 2;
+            len -= 2;
+        }
+    }
+
+    return (ssize_t)out;
+}
+
+static size_t encode_cobs(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t code_idx = 0;
+    size_t out = 1;
+
+    for (;;) {
+        size_t chunk = len < 254 ? len : 254;
+        const uint8_t *zero = memchr(src, 0, chunk);
+        size_t run = zero ? (size_t)(zero - src) : chunk;
+
+        memcpy(dst + out, src, run);
+        out += run;
+        dst[code_idx] = (uint8_t)(run + 1);
+        src += run;
+        len -= run;
+
+        if (zero) {
+            src++;
+            len--;
+        } else if (run < 254 || !len) {
+            break;
+        }
+        code_idx = out++;
+    }
+    dst[out++] = 0;
+
+    return out;
+}
+
+static size_t encode_slip(const uint8_t *src, size_t len, uint8_t *dst)
+{
+    size_t out = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        switch (src[i]) {
+        case SLIP_END:
+            dst[out++] = SLIP_ESC;
+            dst[out++] = SLIP_ESC_END;
+            break;
+        case SLIP_ESC:
+            dst[out++] = SLIP_ESC;
+            dst[out++] = SLIP_ESC_ESC;
+            break;
+
+        default:
+            dst[out++] = src[i];
+            break;
+        }
+    }
+    dst[out++] = SLIP_END;
+
+    return out;
+}
+
+void hs_serial_set_framing(hs_handle *h, hs_serial_framing framing)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(framing == HS_SERIAL_FRAMING_NONE || framing == HS_SERIAL_FRAMING_COBS ||
+           framing == HS_SERIAL_FRAMING_SLIP);
+
+    h->framing = framing;
+    h->frame_overflow = false;
+    h->frame_truncated = false;
+}
+
+ssize_t hs_serial_read_frame(hs_handle *h, uint8_t *buf, size_t size, int timeout)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(h->framing != HS_SERIAL_FRAMING_NONE);
+    assert(buf);
+    assert(size);
+
+    uint8_t delim = h->framing == HS_SERIAL_FRAMING_COBS ? 0 : SLIP_END;
+    size_t scanned = 0;
+    uint64_t start;
+    ssize_t r;
+
+    start = hs_millis();
+    for (;;) {
+        const uint8_t *frame = h->rx_buf + h->rx_start;
+        size_t len = h->rx_end - h->rx_start;
+        const uint8_t *end = NULL;
+
+        if (len > scanned)
+            end = memchr(frame + scanned, delim, len - scanned);
+
+        if (end) {
+            size_t frame_len = (size_t)(end - frame);
+
+            if (h->frame_overflow) {
+                r = -1;
+                h->frame_overflow = false;
+            } else if (h->framing == HS_SERIAL_FRAMING_COBS) {
+                r = decode_cobs(frame, frame_len, buf, size);
+            } else {
+                r = decode_slip(frame, frame_len, buf, size);
+            }
+
+            h->rx_start += frame_len + 1;
+            if (h->rx_start == h->rx_end)
+                h->rx_start = h->rx_end = 0;
+            scanned = 0;
+
+            // Empty frames are used as separators, skip them
+            if (r > 0)
+                return r;
+            if (r < 0)
+                _hs_log_ratelimited(HS_LOG_DEBUG,
+                                    "Dropping malformed or oversized frame from '%s'",
+                                    h->dev->path);
+            continue;
+        }
+
+        if (len == _HS_SERIAL_RX_BUFFER_SIZE) {
+            // This frame will never fit, drop everything up to the next delimiter
+            h->frame_overflow = true;
+            h->rx_start = h->rx_end = 0;
+            len = 0;
+        }
+        scanned = len;
+
+        r = _hs_serial_fill_rx_buffer(h, hs_adjust_timeout(timeout, start));
+        if (r <= 0)
+            return r;
+    }
+}
+
+ssize_t hs_serial_write_frame(hs_handle *h, const uint8_t *buf, size_t size, int timeout)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(h->framing != HS_SERIAL_FRAMING_NONE);
+    assert(buf);
+
+    size_t max_size, len = 0;
+    ssize_t r;
+
+    if (!size)
+        return 0;
+
+    if (h->framing == HS_SERIAL_FRAMING_COBS) {
+        max_size = COBS_MAX_ENCODED_SIZE(size);
+    } else {
+        max_size = SLIP_MAX_ENCODED_SIZE(size);
+    }
+    if (max_size > h->frame_buf_size) {
+        uint8_t *tmp = _hs_realloc(h->frame_buf, max_size);
+        if (!tmp)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+        h->frame_buf = tmp;
+        h->frame_buf_size = max_size;
+    }
+
+    /* SLIP frames always start with END to flush line noise (see RFC 1055), COBS frames only
+       need it to terminate the previous frame if we could not send it completely. */
+    if (h->framing == HS_SERIAL_FRAMING_COBS) {
+        if (h->frame_truncated)
+            h->frame_buf[len++] = 0;
+        len += encode_cobs(buf, size, h->frame_buf + len);
+    } else {
+        h->frame_buf[len++] = SLIP_END;
+        len += encode_slip(buf, size, h->frame_buf + len);
+    }
+
+    r = hs_serial_write_all(h, h->frame_buf, len, timeout);
+    if (r < 0)
+        return r;
+    if ((size_t)r < len) {
+        if (r)
+            h->frame_truncated = true;
+        return 0;
+    }
+    h->frame_truncated = false;
+
+    return (ssize_t)size;
+}
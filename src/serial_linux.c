@@ -0,0 +1,291 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// Can't include <termios.h> here, struct termios2 and the glibc definitions conflict
+#include <asm/termbits.h>
+#include <linux/serial.h>
+#include "cancel_posix_priv.h"
+#include "device_posix_priv.h"
+#include "log_priv.h"
+#include "hs/platform.h"
+#include "hs/serial.h"
+
+int _hs_linux_set_serial_rate(hs_handle *h, int fd, uint32_t rate)
+{
+    struct termios2 tio;
+    int r;
+
+    r = ioctl(fd, TCGETS2, &tio);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "Unable to read serial port settings: %s",
+                        strerror(errno));
+
+    tio.c_cflag &= (unsigned int)~(CBAUD | (CBAUD << IBSHIFT));
+    tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tio.c_ispeed = rate;
+    tio.c_ospeed = rate;
+
+    r = ioctl(fd, TCSETS2, &tio);
+    if (r < 0) {
+        if (errno == EINVAL)
+            return hs_error(HS_ERROR_INVALID, "Serial baud rate %"PRIu32" is not supported by '%s'",
+                            rate, h->dev->path);
+        return hs_error(HS_ERROR_SYSTEM, "Unable to change serial port settings: %s",
+                        strerror(errno));
+    }
+
+    return 0;
+}
+
+int _hs_linux_set_serial_low_latency(hs_handle *h, int fd, bool enable)
+{
+    struct serial_struct ss;
+    int r;
+
+    r = ioctl(fd, TIOCGSERIAL, &ss);
+    if (r < 0) {
+        // USB CDC-ACM devices, among others, don't implement these ioctls
+        if (errno == ENOTTY || errno == EINVAL) {
+            _hs_log_ratelimited(HS_LOG_DEBUG, "Device '%s' does not support ASYNC_LOW_LATENCY",
+                                h->dev->path);
+            return 0;
+        }
+        return hs_error(HS_ERROR_SYSTEM, "ioctl('%s', TIOCGSERIAL) failed: %s", h->dev->path,
+                        strerror(errno));
+    }
+
+    if (enable) {
+        ss.flags |= (int)ASYNC_LOW_LATENCY;
+    } else {
+        ss.flags &= ~(int)ASYNC_LOW_LATENCY;
+    }
+
+    r = ioctl(fd, TIOCSSERIAL, &ss);
+    if (r < 0) {
+        if (errno == ENOTTY || errno == EINVAL) {
+            _hs_log_ratelimited(HS_LOG_DEBUG, "Device '%s' does not support ASYNC_LOW_LATENCY",
+                                h->dev->path);
+            return 0;
+        }
+        if (errno == EPERM)
+            return hs_error(HS_ERROR_ACCESS, "Permission denied to change low-latency mode of '%s'",
+                            h->dev->path);
+        return hs_error(HS_ERROR_SYSTEM, "ioctl('%s', TIOCSSERIAL) failed: %s", h->dev->path,
+                        strerror(errno));
+    }
+
+    return 0;
+}
+
+// Returns 1 if fd is writable, 0 on timeout
+static int wait_writable(hs_handle *h, int fd, int timeout)
+{
+    return _hs_cancel_poll(h->cancel, fd, POLLOUT, timeout, h->dev->path);
+}
+
+// Write buffered bytes to fd, what does not fit before the timeout stays in the buffer
+static ssize_t copy_rx_buffer(hs_handle *h, int fd, size_t size, int timeout, uint64_t start)
+{
+    size_t written = 0;
+    ssize_t r;
+
+    if (size > h->rx_end - h->rx_start)
+        size = h->rx_end - h->rx_start;
+
+    while (written < size) {
+        r = write(fd, h->rx_buf + h->rx_start, size - written);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                r = wait_writable(h, fd, hs_adjust_timeout(timeout, start));
+                if (r < 0 && !written)
+                    return r;
+                if (r <= 0)
+                    break;
+                continue;
+            }
+            if (written)
+                break;
+            return hs_error(HS_ERROR_SYSTEM, "write() to descriptor %d failed: %s", fd,
+                            strerror(errno));
+        }
+        written += (size_t)r;
+        h->rx_start += (size_t)r;
+    }
+    if (h->rx_start == h->rx_end)
+        h->rx_start = h->rx_end = 0;
+
+    return (ssize_t)written;
+}
+
+// Move what is left in the intermediate pipe to the target, returns the number of bytes moved
+static ssize_t drain_splice_pipe(hs_handle *h, int fd, int timeout, uint64_t start)
+{
+    size_t moved = 0;
+    ssize_t r;
+
+    while (h->splice_pending) {
+        r = splice(h->splice_pipe[0], NULL, fd, NULL, h->splice_pending, SPLICE_F_MOVE);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                r = wait_writable(h, fd, hs_adjust_timeout(timeout, start));
+                if (r < 0)
+                    return r;
+                if (!r)
+                    break;
+                continue;
+            }
+            return hs_error(HS_ERROR_SYSTEM, "splice() to descriptor %d failed: %s", fd,
+                            strerror(errno));
+        }
+        h->splice_pending -= (size_t)r;
+        moved += (size_t)r;
+    }
+
+    return (ssize_t)moved;
+}
+
+// Returns 0 and sets splice_unsupported if the driver or the target can't splice
+static ssize_t splice_from_device(hs_handle *h, int fd, size_t size, int timeout,
+                                  uint64_t start)
+{
+    struct stat sb;
+    int out;
+    ssize_t r;
+
+    r = fstat(fd, &sb);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "fstat() on descriptor %d failed: %s", fd, strerror(errno));
+
+    if (S_ISFIFO(sb.st_mode)) {
+        out = fd;
+    } else {
+        if (!h->splice_pipe_init) {
+            r = pipe2(h->splice_pipe, O_CLOEXEC | O_NONBLOCK);
+            if (r < 0)
+                return hs_error(HS_ERROR_SYSTEM, "pipe2() failed: %s", strerror(errno));
+            h->splice_pipe_init = true;
+        }
+        out = h->splice_pipe[1];
+    }
+
+restart:
+    r = splice(h->fd, NULL, out, NULL, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (r < 0) {
+        switch (errno) {
+        case EINTR:
+            goto restart;
+        case EAGAIN:
+            /* The device is readable, so EAGAIN can also mean that the target pipe is full.
+               Returning would make the caller spin, wait for room instead. */
+            if (out == fd) {
+                r = wait_writable(h, fd, 0);
+                if (!r) {
+                    r = wait_writable(h, fd, hs_adjust_timeout(timeout, start));
+                    if (r > 0)
+                        goto restart;
+                }
+                if (r < 0)
+                    return r;
+            }
+            return 0;
+        case EINVAL:
+            // Before Linux 6.5, ttys don't support splice_read
+            h->splice_unsupported = true;
+            return 0;
+        case EIO:
+        case ENXIO:
+            return hs_error(HS_ERROR_IO, "I/O error while reading from '%s'", h->dev->path);
+        }
+        return hs_error(HS_ERROR_SYSTEM, "splice('%s') failed: %s", h->dev->path, strerror(errno));
+    }
+
+    if (out != fd && r > 0) {
+        ssize_t r2;
+
+        // Bytes that miss the timeout stay in the pipe until the next call
+        h->splice_pending = (size_t)r;
+        r2 = drain_splice_pipe(h, fd, timeout, start);
+        if (r2 < 0)
+            return r2;
+        r = r2;
+    }
+
+    return r;
+}
+
+ssize_t hs_serial_splice_to(hs_handle *h, int fd, size_t size, int timeout)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(fd >= 0);
+    assert(size);
+
+    uint64_t start, stats_start = 0;
+    ssize_t r;
+
+    start = hs_millis();
+    if (h->stats)
+        stats_start = hs_nanos();
+
+    // Flush data stuck in the pipe by a previous call, and buffered data, to preserve order
+    if (h->splice_pending)
+        return drain_splice_pipe(h, fd, timeout, start);
+    if (h->rx_end > h->rx_start)
+        return copy_rx_buffer(h, fd, size, timeout, start);
+
+    if (timeout) {
+        r = _hs_cancel_poll(h->cancel, h->fd, POLLIN, timeout, h->dev->path);
+        if (r <= 0)
+            return r;
+    } else if (_hs_cancel_token_is_triggered(h->cancel)) {
+        return HS_ERROR_CANCELLED;
+    }
+
+    if (!h->splice_unsupported) {
+        r = splice_from_device(h, fd, size, timeout, start);
+        if (r > 0 && h->timestamping)
+            h->read_timestamp = hs_nanos();
+        if (h->stats)
+            _hs_handle_stats_read(h->stats, r, stats_start);
+        if (r || !h->splice_unsupported)
+            return r;
+    }
+
+    // Fall back to a copy through the receive buffer, which keeps what the target refuses
+    r = _hs_serial_fill_rx_buffer(h, 0);
+    if (r <= 0)
+        return r;
+
+    return copy_rx_buffer(h, fd, size, timeout, start);
+}
@@ -24,83 +24,205 @@
 
 #include "util.h"
 #include <poll.h>
+#ifdef __linux__
+    #include <linux/serial.h>
+    #include <pthread.h>
+    #include <signal.h>
+    #include <sys/eventfd.h>
+    #include <time.h>
+#endif
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#ifdef __APPLE__
+    #include <IOKit/serial/ioss.h>
+#endif
 #include <termios.h>
 #include <unistd.h>
+#include "cancel_posix_priv.h"
 #include "device_posix_priv.h"
 #include "hs/platform.h"
 #include "hs/serial.h"
 
+static int cache_attributes(hs_handle *h, const struct termios *tio)
+{
+    if (!h->tio_cache) {
+        h->tio_cache = _hs_malloc(sizeof(*h->tio_cache));
+        if (!h->tio_cache)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+    *h->tio_cache = *tio;
+
+    return 0;
+}
+
+static int set_custom_rate(hs_handle *h, int fd, uint32_t rate)
+{
+#if defined(__linux__)
+    return _hs_linux_set_serial_rate(h, fd, rate);
+#elif defined(__APPLE__)
+    speed_t speed = (speed_t)rate;
+    int r;
+
+    r = ioctl(fd, IOSSIOSPEED, &speed);
+    if (r < 0)
+        return hs_error(HS_ERROR_INVALID, "Serial baud rate %"PRIu32" is not supported by '%s'",
+                        rate, h->dev->path);
+    return 0;
+#else
+    _HS_UNUSED(h);
+    _HS_UNUSED(fd);
+    return hs_error(HS_ERROR_INVALID, "Serial baud rate %"PRIu32" is not supported", rate);
+#endif
+}
+
 int hs_serial_set_attributes(hs_handle *h, uint32_t rate, int flags)
 {
     assert(h);
     assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
 
     struct termios tio;
+    speed_t speed;
     int r;
 
+    if (!rate)
+        return hs_error(HS_ERROR_INVALID, "Invalid serial baud rate 0");
+
     r = tcgetattr(h->fd, &tio);
     if (r < 0)
         return hs_error(HS_ERROR_SYSTEM, "Unable to read serial port settings: %s",
                         strerror(errno));
 
     cfmakeraw(&tio);
-    tio.c_cc[VMIN] = 1;
-    tio.c_cc[VTIME] = 0;
+    tio.c_cc[VMIN] = h->vmin;
+    tio.c_cc[VTIME] = h->vtime;
     tio.c_cflag |= CLOCAL;
 
     switch (rate) {
     case 110:
-        rate = B110;
+        speed = B110;
         break;
     case 134:
-        rate = B134;
+        speed = B134;
         break;
     case 150:
-        rate = B150;
+        speed = B150;
         break;
     case 200:
-        rate = B200;
+        speed = B200;
         break;
     case 300:
-        rate = B300;
+        speed = B300;
         break;
     case 600:
-        rate = B600;
+        speed = B600;
         break;
     case 1200:
-        rate = B1200;
+        speed = B1200;
         break;
     case 1800:
-        rate = B1800;
+        speed = B1800;
         break;
     case 2400:
-        rate = B2400;
+        speed = B2400;
         break;
     case 4800:
-        rate = B4800;
+        speed = B4800;
         break;
     case 9600:
-        rate = B9600;
+        speed = B9600;
         break;
     case 19200:
-        rate = B19200;
+        speed = B19200;
         break;
     case 38400:
-        rate = B38400;
+        speed = B38400;
         break;
     case 57600:
-        rate = B57600;
+        speed = B57600;
         break;
     case 115200:
-        rate = B115200;
+        speed = B115200;
+        break;
+#ifdef B230400
+    case 230400:
+        speed = B230400;
         break;
+#endif
+#ifdef B460800
+    case 460800:
+        speed = B460800;
+        break;
+#endif
+#ifdef B500000
+    case 500000:
+        speed = B500000;
+        break;
+#endif
+#ifdef B576000
+    case 576000:
+        speed = B576000;
+        break;
+#endif
+#ifdef B921600
+    case 921600:
+        speed = B921600;
+        break;
+#endif
+#ifdef B1000000
+    case 1000000:
+        speed = B1000000;
+        break;
+#endif
+#ifdef B1152000
+    case 1152000:
+        speed = B1152000;
+        break;
+#endif
+#ifdef B1500000
+    case 1500000:
+        speed = B1500000;
+        break;
+#endif
+#ifdef B2000000
+    case 2000000:
+        speed = B2000000;
+        break;
+#endif
+#ifdef B2500000
+    case 2500000:
+        speed = B2500000;
+        break;
+#endif
+#ifdef B3000000
+    case 3000000:
+        speed = B3000000;
+        break;
+#endif
+#ifdef B3500000
+    case 3500000:
+        speed = B3500000;
+        break;
+#endif
+#ifdef B4000000
+    case 4000000:
+        speed = B4000000;
+        break;
+#endif
 
     default:
-        assert(false);
+#if defined(__linux__) || defined(__APPLE__)
+        // Non-standard rate, set it once the other attributes are in place
+        speed = B0;
+        break;
+#else
+        return hs_error(HS_ERROR_INVALID, "Serial baud rate %"PRIu32" is not supported", rate);
+#endif
     }
 
-    cfsetispeed(&tio, rate);
-    cfsetospeed(&tio, rate);
+    if (speed != B0) {
+        cfsetispeed(&tio, speed);
+        cfsetospeed(&tio, speed);
+    }
 
     tio.c_cflag &= (unsigned int)~CSIZE;
     switch (flags & HS_SERIAL_MASK_CSIZE) {
@@ -162,10 +284,216 @@ int hs_serial_set_attributes(hs_handle *h, uint32_t rate, int flags)
     if (r < 0)
         return hs_error(HS_ERROR_SYSTEM, "Unable to change serial port settings: %s",
                         strerror(errno));
+    r = cache_attributes(h, &tio);
+    if (r < 0)
+        return r;
+
+    h->custom_rate = 0;
+    if (speed == B0) {
+        r = set_custom_rate(h, h->fd, rate);
+        if (r < 0)
+            return r;
+        h->custom_rate = rate;
+    }
+
+    return 0;
+}
+
+int _hs_serial_restore_attributes(hs_handle *h, int fd)
+{
+    int r;
+
+    if (h->tio_cache) {
+        r = tcsetattr(fd, TCSANOW, h->tio_cache);
+        if (r < 0)
+            return hs_error(HS_ERROR_SYSTEM, "Unable to restore serial port settings: %s",
+                            strerror(errno));
+    }
+    if (h->custom_rate) {
+        r = set_custom_rate(h, fd, h->custom_rate);
+        if (r < 0)
+            return r;
+    }
+#ifdef __linux__
+    if (h->low_latency) {
+        r = _hs_linux_set_serial_low_latency(h, fd, true);
+        if (r < 0)
+            return r;
+    }
+#endif
+
+    return 0;
+}
+
+static ssize_t read_device(hs_handle *h, uint8_t *buf, size_t size, int timeout)
+{
+    uint64_t start, stats_start = 0;
+    ssize_t r;
+
+    start = hs_millis();
+    if (h->stats)
+        stats_start = hs_nanos();
+
+    if (h->spin_budget && timeout) {
+        uint64_t spin_end = hs_nanos() + (uint64_t)h->spin_budget * 1000;
+
+        // Burn CPU with non-blocking reads to avoid the poll() wakeup latency
+        do {
+            if (_hs_cancel_token_is_triggered(h->cancel))
+                return HS_ERROR_CANCELLED;
+
+            r = read(h->fd, buf, size);
+            if (r > 0)
+                goto success;
+            if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                goto error;
+        } while (hs_nanos() < spin_end);
+    }
+
+    if (timeout) {
+        r = _hs_cancel_poll(h->cancel, h->fd, POLLIN, hs_adjust_timeout(timeout, start),
+                            h->dev->path);
+        if (r <= 0)
+            return r;
+    } else if (_hs_cancel_token_is_triggered(h->cancel)) {
+        return HS_ERROR_CANCELLED;
+    }
+
+    r = read(h->fd, buf, size);
+    if (r < 0)
+        goto error;
+
+success:
+    if (h->timestamping && r > 0)
+        h->read_timestamp = hs_nanos();
+    if (h->stats)
+        _hs_handle_stats_read(h->stats, r, stats_start);
+    return r;
+
+error:
+    switch (errno) {
+    case EAGAIN:
+#if defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+        if (h->stats) {
+            _HS_STATS_INC(h->stats->eagain);
+            if (timeout)
+                _HS_STATS_INC(h->stats->empty_wakeups);
+        }
+        return 0;
+    case EIO:
+    case ENXIO:
+        r = hs_error(HS_ERROR_IO, "I/O error while reading from '%s'", h->dev->path);
+        break;
+    default:
+        r = hs_error(HS_ERROR_SYSTEM, "read('%s') failed: %s", h->dev->path, strerror(errno));
+        break;
+    }
+    if (h->stats)
+        _hs_handle_stats_read(h->stats, r, stats_start);
+    return r;
+}
+
+int hs_serial_set_low_latency(hs_handle *h, int enable)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+
+#ifdef __linux__
+    int r;
+
+    r = _hs_linux_set_serial_low_latency(h, h->fd, enable);
+    if (r < 0)
+        return r;
+    h->low_latency = enable;
+
+    return 0;
+#else
+    _HS_UNUSED(h);
+    _HS_UNUSED(enable);
+    return 0;
+#endif
+}
+
+int hs_serial_set_batching(hs_handle *h, unsigned int vmin, unsigned int vtime)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(vmin <= UINT8_MAX && vtime <= UINT8_MAX);
+
+    struct termios tio;
+    int r;
+
+    r = tcgetattr(h->fd, &tio);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "Unable to read serial port settings: %s",
+                        strerror(errno));
+
+    tio.c_cc[VMIN] = (cc_t)vmin;
+    tio.c_cc[VTIME] = (cc_t)vtime;
+
+    r = tcsetattr(h->fd, TCSANOW, &tio);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "Unable to change serial port settings: %s",
+                        strerror(errno));
+    r = cache_attributes(h, &tio);
+    if (r < 0)
+        return r;
+
+    // Remember them for hs_serial_set_attributes()
+    h->vmin = (uint8_t)vmin;
+    h->vtime = (uint8_t)vtime;
 
     return 0;
 }
 
+void hs_serial_set_spin_budget(hs_handle *h, unsigned int budget)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+
+    h->spin_budget = budget;
+}
+
+ssize_t _hs_serial_fill_rx_buffer(hs_handle *h, int timeout)
+{
+    ssize_t r;
+
+    if (!h->rx_buf) {
+        h->rx_buf = _hs_malloc(_HS_SERIAL_RX_BUFFER_SIZE);
+        if (!h->rx_buf)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+
+    if (h->rx_start) {
+        memmove(h->rx_buf, h->rx_buf + h->rx_start, h->rx_end - h->rx_start);
+        h->rx_end -= h->rx_start;
+        h->rx_start = 0;
+    }
+    if (h->rx_end == _HS_SERIAL_RX_BUFFER_SIZE)
+        return 0;
+
+    r = read_device(h, h->rx_buf + h->rx_end, _HS_SERIAL_RX_BUFFER_SIZE - h->rx_end, timeout);
+    if (r > 0)
+        h->rx_end += (size_t)r;
+
+    return r;
+}
+
+static size_t drain_rx_buffer(hs_handle *h, uint8_t *buf, size_t size)
+{
+    if (size > h->rx_end - h->rx_start)
+        size = h->rx_end - h->rx_start;
+
+    memcpy(buf, h->rx_buf + h->rx_start, size);
+    h->rx_start += size;
+    if (h->rx_start == h->rx_end)
+        h->rx_start = h->rx_end = 0;
+
+    return size;
+}
+
 ssize_t hs_serial_read(hs_handle *h, uint8_t *buf, size_t size, int timeout)
 {
     assert(h);
@@ -173,41 +501,139 @@ ssize_t hs_serial_read(hs_handle *h, uint8_t *buf, size_t size, int timeout)
     assert(buf);
     assert(size);
 
+    // Data left over by the buffered functions comes first
+    if (h->rx_end > h->rx_start)
+        return (ssize_t)drain_rx_buffer(h, buf, size);
+
+    return read_device(h, buf, size, timeout);
+}
+
+ssize_t hs_serial_read_until(hs_handle *h, uint8_t *buf, size_t size, uint8_t delim,
+                             int timeout)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(buf);
+    assert(size);
+
+    size_t scanned = 0;
+    uint64_t start;
     ssize_t r;
 
-    if (timeout) {
-        struct pollfd pfd;
-        uint64_t start;
+    start = hs_millis();
+    for (;;) {
+        size_t len = h->rx_end - h->rx_start;
+        const uint8_t *end;
 
-        pfd.events = POLLIN;
-        pfd.fd = h->fd;
+        if (len > size)
+            len = size;
 
-        start = hs_millis();
-restart:
-        r = poll(&pfd, 1, hs_adjust_timeout(timeout, start));
-        if (r < 0) {
-            if (errno == EINTR)
-                goto restart;
-            return hs_error(HS_ERROR_SYSTEM, "poll('%s') failed: %s", h->dev->path,
-                            strerror(errno));
-        }
+        // Only scan new bytes, the rest of the buffer was checked on previous iterations
+        end = NULL;
+        if (len > scanned)
+            end = memchr(h->rx_buf + h->rx_start + scanned, delim, len - scanned);
+        if (end)
+            return (ssize_t)drain_rx_buffer(h, buf, (size_t)(end - (h->rx_buf + h->rx_start)) + 1);
+        if (len == size || len == _HS_SERIAL_RX_BUFFER_SIZE)
+            return (ssize_t)drain_rx_buffer(h, buf, len);
+        scanned = len;
+
+        r = _hs_serial_fill_rx_buffer(h, hs_adjust_timeout(timeout, start));
+        if (r <= 0)
+            return r;
+    }
+}
+
+ssize_t hs_serial_read_exact(hs_handle *h, uint8_t *buf, size_t size, int timeout)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(buf);
+
+    size_t total;
+    uint64_t start;
+    ssize_t r;
+
+    total = h->rx_end > h->rx_start ? drain_rx_buffer(h, buf, size) : 0;
+
+    // Read straight into the caller buffer, there is nothing to gain from an extra copy
+    start = hs_millis();
+    while (total < size) {
+        int adjusted_timeout = hs_adjust_timeout(timeout, start);
+
+        r = read_device(h, buf + total, size - total, adjusted_timeout);
+        // Don't lose what we already have, the error will show up again on the next call
+        if (r < 0)
+            return total ? (ssize_t)total : r;
+        // Timeout, or end of stream (e.g. hangup) which would make us spin forever
         if (!r)
-            return 0;
+            break;
+
+        total += (size_t)r;
     }
 
-    r = read(h->fd, buf, size);
+    return (ssize_t)total;
+}
+
+ssize_t hs_serial_borrow(hs_handle *h, const uint8_t **rbuf, int timeout)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(rbuf);
+
+    ssize_t r;
+
+    if (h->rx_end == h->rx_start) {
+        r = _hs_serial_fill_rx_buffer(h, timeout);
+        if (r <= 0)
+            return r;
+    }
+
+    *rbuf = h->rx_buf + h->rx_start;
+    return (ssize_t)(h->rx_end - h->rx_start);
+}
+
+void hs_serial_release(hs_handle *h, size_t size)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(size <= h->rx_end - h->rx_start);
+
+    h->rx_start += size;
+    if (h->rx_start == h->rx_end)
+        h->rx_start = h->rx_end = 0;
+}
+
+static ssize_t write_error(hs_handle *h, const char *func)
+{
+    if (errno == EIO || errno == ENXIO)
+        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
+    return hs_error(HS_ERROR_SYSTEM, "%s('%s') failed: %s", func, h->dev->path, strerror(errno));
+}
+
+static ssize_t write_device(hs_handle *h, const uint8_t *buf, ssize_t size)
+{
+    ssize_t r;
+
+    // Most of the time there is room in the output buffer, don't waste a poll() call on it
+restart:
+    r = write(h->fd, buf, (size_t)size);
     if (r < 0) {
         switch (errno) {
+        case EINTR:
+            goto restart;
         case EAGAIN:
 #if defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
         case EWOULDBLOCK:
 #endif
-            return 0;
-        case EIO:
-        case ENXIO:
-            return hs_error(HS_ERROR_IO, "I/O error while reading from '%s'", h->dev->path);
+            if (h->stats)
+                _HS_STATS_INC(h->stats->eagain);
+            r = _hs_cancel_poll(h->cancel, h->fd, POLLOUT, -1, h->dev->path);
+            if (r < 0)
+                return r;
+            goto restart;
         }
-        return hs_error(HS_ERROR_SYSTEM, "read('%s') failed: %s", h->dev->path, strerror(errno));
+        return write_error(h, "write");
     }
 
     return r;
@@ -221,35 +647,398 @@ ssize_t hs_serial_write(hs_handle *h, const uint8_t *buf, ssize_t size)
 
     if (!size)
         return 0;
+    if (_hs_cancel_token_is_triggered(h->cancel))
+        return HS_ERROR_CANCELLED;
+    if (h->detached)
+        return hs_error(HS_ERROR_IO, "Device '%s' is disconnected", h->dev->path);
 
-    struct pollfd pfd;
+    uint64_t start = 0;
     ssize_t r;
 
-    pfd.events = POLLOUT;
-    pfd.fd = h->fd;
+    if (h->stats)
+        start = hs_nanos();
+    r = write_device(h, buf, size);
+    if (h->stats)
+        _hs_handle_stats_write(h->stats, r, (size_t)size, start);
 
-restart:
-    r = poll(&pfd, 1, -1);
-    if (r < 0) {
-        switch (errno) {
-        case EINTR:
-            goto restart;
-        case EIO:
-        case ENXIO:
-            return hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
+    return r;
+}
+
+ssize_t hs_serial_write_all(hs_handle *h, const uint8_t *buf, size_t size, int timeout)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(buf || !size);
+
+    hs_serial_iovec iov;
+
+    iov.buf = buf;
+    iov.size = size;
+
+    return hs_serial_writev(h, &iov, 1, timeout);
+}
+
+static ssize_t writev_device(hs_handle *h, const hs_serial_iovec *iov, unsigned int count,
+                             int timeout)
+{
+    struct iovec vec[16];
+    unsigned int vec_count;
+    size_t offset = 0;
+    size_t total = 0;
+    uint64_t start;
+    ssize_t r;
+
+    start = hs_millis();
+    while (count) {
+        if (_hs_cancel_token_is_triggered(h->cancel))
+            return total ? (ssize_t)total : HS_ERROR_CANCELLED;
+
+        vec_count = 0;
+        for (unsigned int i = 0; i < count && vec_count < _HS_COUNTOF(vec); i++) {
+            size_t skip = i ? 0 : offset;
+
+            if (iov[i].size == skip)
+                continue;
+
+            vec[vec_count].iov_base = (void *)(iov[i].buf + skip);
+            vec[vec_count].iov_len = iov[i].size - skip;
+            vec_count++;
+        }
+        if (!vec_count)
+            break;
+
+        r = writev(h->fd, vec, (int)vec_count);
+        if (r < 0) {
+            switch (errno) {
+            case EINTR:
+                continue;
+            case EAGAIN:
+#if defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+#endif
+                if (h->stats)
+                    _HS_STATS_INC(h->stats->eagain);
+                r = _hs_cancel_poll(h->cancel, h->fd, POLLOUT, hs_adjust_timeout(timeout, start),
+                                    h->dev->path);
+                if (r == HS_ERROR_CANCELLED && total)
+                    return (ssize_t)total;
+                if (r < 0)
+                    return r;
+                if (!r)
+                    return (ssize_t)total;
+                continue;
+            }
+            return write_error(h, "writev");
+        }
+        total += (size_t)r;
+
+        // Skip fully written buffers, and remember where to resume in the last one
+        offset += (size_t)r;
+        while (count && offset >= iov->size) {
+            offset -= iov->size;
+            iov++;
+            count--;
         }
-        return hs_error(HS_ERROR_SYSTEM, "poll('%s') failed: %s", h->dev->path,
-                        strerror(errno));
     }
-    assert(r == 1);
 
-    r = write(h->fd, buf, (size_t)size);
+    return (ssize_t)total;
+}
+
+ssize_t hs_serial_writev(hs_handle *h, const hs_serial_iovec *iov, unsigned int count,
+                         int timeout)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(iov || !count);
+
+    uint64_t start = 0;
+    size_t size = 0;
+    ssize_t r;
+
+    if (h->detached)
+        return hs_error(HS_ERROR_IO, "Device '%s' is disconnected", h->dev->path);
+
+    if (!h->stats)
+        return writev_device(h, iov, count, timeout);
+
+    for (unsigned int i = 0; i < count; i++)
+        size += iov[i].size;
+    start = hs_nanos();
+    r = writev_device(h, iov, count, timeout);
+    _hs_handle_stats_write(h->stats, r, size, start);
+
+    return r;
+}
+
+static int lines_to_tiocm(int lines)
+{
+    int bits = 0;
+
+    if (lines & HS_SERIAL_LINE_DTR)
+        bits |= TIOCM_DTR;
+    if (lines & HS_SERIAL_LINE_RTS)
+        bits |= TIOCM_RTS;
+    if (lines & HS_SERIAL_LINE_CTS)
+        bits |= TIOCM_CTS;
+    if (lines & HS_SERIAL_LINE_DSR)
+        bits |= TIOCM_DSR;
+    if (lines & HS_SERIAL_LINE_DCD)
+        bits |= TIOCM_CAR;
+    if (lines & HS_SERIAL_LINE_RI)
+        bits |= TIOCM_RNG;
+
+    return bits;
+}
+
+static int tiocm_to_lines(int bits)
+{
+    int lines = 0;
+
+    if (bits & TIOCM_DTR)
+        lines |= HS_SERIAL_LINE_DTR;
+    if (bits & TIOCM_RTS)
+        lines |= HS_SERIAL_LINE_RTS;
+    if (bits & TIOCM_CTS)
+        lines |= HS_SERIAL_LINE_CTS;
+    if (bits & TIOCM_DSR)
+        lines |= HS_SERIAL_LINE_DSR;
+    if (bits & TIOCM_CAR)
+        lines |= HS_SERIAL_LINE_DCD;
+    if (bits & TIOCM_RNG)
+        lines |= HS_SERIAL_LINE_RI;
+
+    return lines;
+}
+
+int hs_serial_get_lines(hs_handle *h)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+
+    int bits;
+    int r;
+
+    r = ioctl(h->fd, TIOCMGET, &bits);
     if (r < 0) {
         if (errno == EIO || errno == ENXIO)
-            return hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
-        return hs_error(HS_ERROR_SYSTEM, "write('%s') failed: %s", h->dev->path,
+            return hs_error(HS_ERROR_IO, "I/O error while reading modem lines of '%s'",
+                            h->dev->path);
+        return hs_error(HS_ERROR_SYSTEM, "ioctl('%s', TIOCMGET) failed: %s", h->dev->path,
                         strerror(errno));
     }
 
-    return r;
+    return tiocm_to_lines(bits);
+}
+
+int hs_serial_set_lines(hs_handle *h, int mask, int values)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(!(mask & ~(HS_SERIAL_LINE_DTR | HS_SERIAL_LINE_RTS)));
+
+    int set, clear;
+    int r;
+
+    if (h->detached)
+        return hs_error(HS_ERROR_IO, "Device '%s' is disconnected", h->dev->path);
+
+    set = lines_to_tiocm(mask & values);
+    clear = lines_to_tiocm(mask & ~values);
+
+    if (set) {
+        r = ioctl(h->fd, TIOCMBIS, &set);
+        if (r < 0)
+            goto error;
+    }
+    if (clear) {
+        r = ioctl(h->fd, TIOCMBIC, &clear);
+        if (r < 0)
+            goto error;
+    }
+
+    return 0;
+
+error:
+    if (errno == EIO || errno == ENXIO)
+        return hs_error(HS_ERROR_IO, "I/O error while changing modem lines of '%s'",
+                        h->dev->path);
+    return hs_error(HS_ERROR_SYSTEM, "Unable to change modem lines of '%s': %s", h->dev->path,
+                    strerror(errno));
+}
+
+#ifdef __linux__
+
+/* The watcher is stopped with a signal, which makes TIOCMIWAIT fail with EINTR because the
+   handler is installed without SA_RESTART. Cancelling the thread would be simpler, but
+   ioctl() is not async-cancel-safe. */
+#define LINE_WAKE_SIGNAL (SIGRTMIN + 4)
+
+static pthread_once_t line_signal_once = PTHREAD_ONCE_INIT;
+static int line_signal_error;
+
+static void line_signal_handler(int sig)
+{
+    _HS_UNUSED(sig);
+}
+
+static void install_line_signal(void)
+{
+    struct sigaction sa, old_sa;
+
+    // Don't steal the signal from the application
+    if (sigaction(LINE_WAKE_SIGNAL, NULL, &old_sa) < 0) {
+        line_signal_error = errno;
+        return;
+    }
+    if (old_sa.sa_handler != SIG_DFL && old_sa.sa_handler != SIG_IGN) {
+        line_signal_error = EBUSY;
+        return;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = line_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(LINE_WAKE_SIGNAL, &sa, NULL) < 0)
+        line_signal_error = errno;
+}
+
+static void *line_thread(void *udata)
+{
+    hs_handle *h = udata;
+
+    uint64_t one = 1;
+    sigset_t mask;
+    int r;
+
+    // The thread inherits the signal mask of its creator
+    sigemptyset(&mask);
+    sigaddset(&mask, LINE_WAKE_SIGNAL);
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+
+    while (!__atomic_load_n(&h->line_stop, __ATOMIC_ACQUIRE)) {
+        r = ioctl(h->fd, TIOCMIWAIT, (unsigned long)h->line_mask);
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+
+            __atomic_store_n(&h->line_error, errno, __ATOMIC_RELEASE);
+            r = (int)write(h->line_event, &one, sizeof(one));
+            break;
+        }
+
+        r = (int)write(h->line_event, &one, sizeof(one));
+    }
+
+    _HS_UNUSED(r);
+    return NULL;
+}
+
+int hs_serial_watch_lines(hs_handle *h, int mask)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(!(mask & (HS_SERIAL_LINE_DTR | HS_SERIAL_LINE_RTS)));
+
+    struct serial_icounter_struct icount;
+    int r;
+
+    _hs_serial_stop_line_watch(h);
+    if (!mask)
+        return 0;
+
+    // Drivers that can't report counters don't implement TIOCMIWAIT either, ptys for example
+    r = ioctl(h->fd, TIOCGICOUNT, &icount);
+    if (r < 0) {
+        if (errno == ENOTTY || errno == EINVAL)
+            return hs_error(HS_ERROR_SYSTEM, "Device '%s' does not report modem line changes",
+                            h->dev->path);
+        return hs_error(HS_ERROR_SYSTEM, "ioctl('%s', TIOCGICOUNT) failed: %s", h->dev->path,
+                        strerror(errno));
+    }
+
+    if (!h->line_event_init) {
+        h->line_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (h->line_event < 0)
+            return hs_error(HS_ERROR_SYSTEM, "eventfd() failed: %s", strerror(errno));
+        h->line_event_init = true;
+    }
+
+    pthread_once(&line_signal_once, install_line_signal);
+    if (line_signal_error)
+        return hs_error(HS_ERROR_SYSTEM, "Cannot install the modem line watcher signal: %s",
+                        strerror(line_signal_error));
+
+    h->line_mask = lines_to_tiocm(mask);
+    h->line_error = 0;
+    h->line_stop = false;
+
+    r = pthread_create(&h->line_thread, NULL, line_thread, h);
+    if (r)
+        return hs_error(HS_ERROR_SYSTEM, "pthread_create() failed: %s", strerror(r));
+    h->line_thread_running = true;
+
+    return 0;
+}
+
+hs_descriptor hs_serial_get_line_descriptor(const hs_handle *h)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(h->line_event_init);
+
+    return h->line_event;
 }
+
+int hs_serial_read_line_event(hs_handle *h)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(h->line_event_init);
+
+    uint64_t count;
+    int error;
+    ssize_t r;
+
+    r = read(h->line_event, &count, sizeof(count));
+    _HS_UNUSED(r);
+
+    error = __atomic_load_n(&h->line_error, __ATOMIC_ACQUIRE);
+    if (error) {
+        if (error == EIO || error == ENXIO)
+            return hs_error(HS_ERROR_IO, "I/O error while waiting for modem lines of '%s'",
+                            h->dev->path);
+        return hs_error(HS_ERROR_SYSTEM, "ioctl('%s', TIOCMIWAIT) failed: %s", h->dev->path,
+                        strerror(error));
+    }
+
+    return hs_serial_get_lines(h);
+}
+
+void _hs_serial_stop_line_watch(hs_handle *h)
+{
+    if (h->line_thread_running) {
+        __atomic_store_n(&h->line_stop, true, __ATOMIC_RELEASE);
+
+        /* The signal is lost if it arrives before the thread enters TIOCMIWAIT, keep sending
+           it until the thread is gone. */
+        for (;;) {
+            struct timespec ts;
+
+            pthread_kill(h->line_thread, LINE_WAKE_SIGNAL);
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 10000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            if (pthread_timedjoin_np(h->line_thread, NULL, &ts) != ETIMEDOUT)
+                break;
+        }
+
+        h->line_thread_running = false;
+    }
+}
+
+#endif
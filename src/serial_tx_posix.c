@@ -0,0 +1,240 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "cancel_posix_priv.h"
+#include "device_posix_priv.h"
+#include "hs/platform.h"
+#include "hs/serial.h"
+
+int hs_serial_set_tx_ring(hs_handle *h, size_t size)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+
+    uint8_t *ring = NULL;
+
+    if (size < h->tx_len)
+        return hs_error(HS_ERROR_INVALID, "Cannot shrink transmit ring of '%s' below %zu queued bytes",
+                        h->dev->path, h->tx_len);
+
+    if (size) {
+        size_t head_len;
+
+        ring = _hs_malloc(size);
+        if (!ring)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+
+        // Linearize pending data while we're at it
+        head_len = h->tx_ring_size - h->tx_start;
+        if (head_len > h->tx_len)
+            head_len = h->tx_len;
+        if (head_len)
+            memcpy(ring, h->tx_ring + h->tx_start, head_len);
+        if (h->tx_len > head_len)
+            memcpy(ring + head_len, h->tx_ring, h->tx_len - head_len);
+    }
+
+    _hs_free(h->tx_ring);
+    h->tx_ring = ring;
+    h->tx_ring_size = size;
+    h->tx_start = 0;
+
+    return 0;
+}
+
+void hs_serial_set_tx_watermarks(hs_handle *h, size_t low, size_t high,
+                                 hs_serial_tx_watermark_func *f, void *udata)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(low <= high);
+
+    h->tx_low = low;
+    h->tx_high = high;
+    h->tx_above_high = false;
+    h->tx_watermark_func = f;
+    h->tx_watermark_udata = udata;
+}
+
+static ssize_t write_available(hs_handle *h, const struct iovec *vec, int count)
+{
+    uint64_t start = 0;
+    ssize_t r;
+
+    if (h->detached)
+        return hs_error(HS_ERROR_IO, "Device '%s' is disconnected", h->dev->path);
+
+    if (h->stats)
+        start = hs_nanos();
+
+restart:
+    r = writev(h->fd, vec, count);
+    if (r < 0) {
+        switch (errno) {
+        case EINTR:
+            goto restart;
+        case EAGAIN:
+#if defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+            if (h->stats)
+                _HS_STATS_INC(h->stats->eagain);
+            return 0;
+        case EIO:
+        case ENXIO:
+            r = hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
+            break;
+        default:
+            r = hs_error(HS_ERROR_SYSTEM, "writev('%s') failed: %s", h->dev->path,
+                         strerror(errno));
+            break;
+        }
+    }
+
+    if (h->stats) {
+        size_t size = 0;
+
+        for (int i = 0; i < count; i++)
+            size += vec[i].iov_len;
+        _hs_handle_stats_write(h->stats, r, size, start);
+    }
+
+    return r;
+}
+
+ssize_t hs_serial_enqueue(hs_handle *h, const uint8_t *buf, size_t size)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(h->tx_ring);
+    assert(buf || !size);
+
+    size_t accepted = 0;
+    size_t end, head_len;
+
+    if (_hs_cancel_token_is_triggered(h->cancel))
+        return HS_ERROR_CANCELLED;
+
+    // Skip the copy when the kernel has room and nothing is queued ahead of us
+    if (!h->tx_len && size) {
+        struct iovec vec;
+        ssize_t r;
+
+        vec.iov_base = (void *)buf;
+        vec.iov_len = size;
+
+        r = write_available(h, &vec, 1);
+        if (r < 0)
+            return r;
+        accepted = (size_t)r;
+    }
+
+    size -= accepted;
+    if (size > h->tx_ring_size - h->tx_len)
+        size = h->tx_ring_size - h->tx_len;
+
+    end = (h->tx_start + h->tx_len) % h->tx_ring_size;
+    head_len = h->tx_ring_size - end;
+    if (head_len > size)
+        head_len = size;
+    memcpy(h->tx_ring + end, buf + accepted, head_len);
+    memcpy(h->tx_ring, buf + accepted + head_len, size - head_len);
+    h->tx_len += size;
+    accepted += size;
+
+    if (h->tx_watermark_func && !h->tx_above_high && h->tx_high && h->tx_len >= h->tx_high) {
+        h->tx_above_high = true;
+        (*h->tx_watermark_func)(h, 1, h->tx_watermark_udata);
+    }
+
+    return (ssize_t)accepted;
+}
+
+int hs_serial_flush_tx(hs_handle *h)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+
+    while (h->tx_len) {
+        struct iovec vec[2];
+        int count = 1;
+        ssize_t r;
+
+        vec[0].iov_base = h->tx_ring + h->tx_start;
+        vec[0].iov_len = h->tx_ring_size - h->tx_start;
+        if (vec[0].iov_len >= h->tx_len) {
+            vec[0].iov_len = h->tx_len;
+        } else {
+            vec[1].iov_base = h->tx_ring;
+            vec[1].iov_len = h->tx_len - vec[0].iov_len;
+            count++;
+        }
+
+        r = write_available(h, vec, count);
+        if (r < 0)
+            return (int)r;
+        if (!r)
+            break;
+
+        h->tx_start = (h->tx_start + (size_t)r) % h->tx_ring_size;
+        h->tx_len -= (size_t)r;
+    }
+    if (!h->tx_len)
+        h->tx_start = 0;
+
+    if (h->tx_above_high && h->tx_len <= h->tx_low) {
+        h->tx_above_high = false;
+        (*h->tx_watermark_func)(h, 0, h->tx_watermark_udata);
+    }
+
+    return !h->tx_len;
+}
+
+size_t hs_serial_get_tx_queued(const hs_handle *h)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+
+    return h->tx_len;
+}
+
+ssize_t hs_serial_get_output_queue(const hs_handle *h)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+
+    int queued;
+    int r;
+
+    r = ioctl(h->fd, TIOCOUTQ, &queued);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "ioctl('%s', TIOCOUTQ) failed: %s", h->dev->path,
+                        strerror(errno));
+
+    return queued;
+}
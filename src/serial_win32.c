@@ -43,28 +43,10 @@ int hs_serial_set_attributes(hs_handle *h, uint32_t rate, int flags)
     if (!success)
         return hs_error(HS_ERROR_SYSTEM, "GetCommState() failed: %s", hs_win32_strerror(0));
 
-    switch (rate) {
-    case 110:
-    case 134:
-    case 150:
-    case 200:
-    case 300:
-    case 600:
-    case 1200:
-    case 1800:
-    case 2400:
-    case 4800:
-    case 9600:
-    case 19200:
-    case 38400:
-    case 57600:
-    case 115200:
-        dcb.BaudRate = rate;
-        break;
-
-    default:
-        assert(false);
-    }
+    // Let the driver reject the rates it can't handle in SetCommState()
+    if (!rate)
+        return hs_error(HS_ERROR_INVALID, "Invalid serial baud rate 0");
+    dcb.BaudRate = rate;
 
     switch (flags & HS_SERIAL_MASK_CSIZE) {
     case HS_SERIAL_CSIZE_5BITS:
@@ -128,8 +110,12 @@ int hs_serial_set_attributes(hs_handle *h, uint32_t rate, int flags)
     }
 
     success = SetCommState(h->handle, &dcb);
-    if (!success)
+    if (!success) {
+        if (GetLastError() == ERROR_INVALID_PARAMETER)
+            return hs_error(HS_ERROR_INVALID, "Serial baud rate %"PRIu32" is not supported by '%s'",
+                            rate, h->dev->path);
         return hs_error(HS_ERROR_SYSTEM, "SetCommState() failed: %s", hs_win32_strerror(0));
+    }
 
     return 0;
 }
@@ -187,19 +173,51 @@ ssize_t hs_serial_write(hs_handle *h, const uint8_t *buf, ssize_t size)
     if (!size)
         return 0;
 
-    OVERLAPPED ov = {0};
-    DWORD len;
-    BOOL success;
+    return _hs_win32_write_sync(h, buf, (size_t)size);
+}
 
-    success = WriteFile(h->handle, buf, (DWORD)size, NULL, &ov);
-    if (!success && GetLastError() != ERROR_IO_PENDING) {
-        CancelIo(h->handle);
-        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
-    }
+ssize_t hs_serial_write_all(hs_handle *h, const uint8_t *buf, size_t size, int timeout)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(buf || !size);
 
-    success = GetOverlappedResult(h->handle, &ov, &len, TRUE);
-    if (!success)
-        return hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", h->dev->path);
+    hs_serial_iovec iov;
+
+    iov.buf = buf;
+    iov.size = size;
+
+    return hs_serial_writev(h, &iov, 1, timeout);
+}
+
+ssize_t hs_serial_writev(hs_handle *h, const hs_serial_iovec *iov, unsigned int count,
+                         int timeout)
+{
+    assert(h);
+    assert(h->dev->type == HS_DEVICE_TYPE_SERIAL);
+    assert(iov || !count);
+
+    size_t total = 0;
+    uint64_t start;
+    ssize_t r;
+
+    // There is no gather write for serial ports, and WriteFile() blocks until it is done anyway
+    start = hs_millis();
+    for (unsigned int i = 0; i < count; i++) {
+        size_t offset = 0;
+
+        while (offset < iov[i].size) {
+            if (total && !hs_adjust_timeout(timeout, start))
+                return (ssize_t)total;
+
+            r = hs_serial_write(h, iov[i].buf + offset, (ssize_t)(iov[i].size - offset));
+            if (r < 0)
+                return r;
+
+            offset += (size_t)r;
+            total += (size_t)r;
+        }
+    }
 
-    return (ssize_t)len;
+    return (ssize_t)total;
 }
@@ -7,17 +7,22 @@ CONFIG += dll thread
 TARGET = ../hs
 
 HEADERS += ../include/hs.h \
+    ../include/hs/capture.h \
     ../include/hs/common.h \
     ../include/hs/device.h \
     ../include/hs/hid.h \
+    ../include/hs/io.h \
     ../include/hs/monitor.h \
     ../include/hs/platform.h \
     ../include/hs/serial.h \
+    ../include/hs/virtual.h \
     compat.h \
     device_priv.h \
     htable.h \
     list.h \
+    log_priv.h \
     monitor_priv.h \
+    pool.h \
     util.h
 
 SOURCES += common.c \
@@ -25,7 +30,8 @@ SOURCES += common.c \
     device.c \
     htable.c \
     monitor.c \
-    platform.c
+    platform.c \
+    pool.c
 
 win32 {
     LIBS += -lhid -lsetupapi
@@ -42,23 +48,46 @@ win32 {
 linux {
     LIBS += -ludev -lpthread
 
-    SOURCES += device_posix.c \
+    SOURCES += cancel_posix.c \
+        capture_posix.c \
+        device_posix.c \
         hid_linux.c \
+        hid_queue_posix.c \
+        io_linux.c \
+        log_posix.c \
         monitor_linux.c \
         platform_posix.c \
-        serial_posix.c
+        replay_linux.c \
+        serial_linux.c \
+        serial_frame_posix.c \
+        serial_posix.c \
+        serial_tx_posix.c \
+        uevent_trace_linux.c \
+        virtual_linux.c
 
-    HEADERS += device_posix_priv.h
+    HEADERS += cancel_posix_priv.h \
+        capture_priv.h \
+        device_posix_priv.h \
+        uevent_trace_priv.h \
+        virtual_priv.h
 }
 
 macx {
     LIBS += -framework IOKit -framework CoreFoundation
 
-    SOURCES += device_posix.c \
+    SOURCES += cancel_posix.c \
+        capture_posix.c \
+        device_posix.c \
         hid_darwin.c \
+        hid_queue_posix.c \
+        log_posix.c \
         monitor_darwin.c \
         platform_darwin.c \
-        serial_posix.c
+        serial_frame_posix.c \
+        serial_posix.c \
+        serial_tx_posix.c
 
-    HEADERS += device_posix_priv.h
+    HEADERS += cancel_posix_priv.h \
+        capture_priv.h \
+        device_posix_priv.h
 }
@@ -0,0 +1,329 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "uevent_trace_priv.h"
+#include "hs/platform.h"
+
+#define TRACE_MAGIC "HSUT"
+#define TRACE_VERSION 1
+
+#define ALIGN_RECORD(size) (((size) + 7) & ~(size_t)7)
+
+struct trace_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint64_t start_time;
+};
+
+struct trace_record {
+    uint64_t time;
+    uint32_t size;
+    uint8_t action;
+    uint8_t reserved;
+    uint16_t mask;
+};
+
+struct _hs_uevent_writer {
+    FILE *fp;
+    char *filename;
+    uint64_t start;
+};
+
+struct _hs_uevent_trace {
+    uint8_t *map;
+    size_t map_size;
+
+    size_t offset;
+    size_t end;
+};
+
+int _hs_uevent_writer_open(const char *filename, _hs_uevent_writer **rwriter)
+{
+    _hs_uevent_writer *writer;
+    struct trace_header header = {{0}};
+    struct timespec ts;
+    int r;
+
+    writer = _hs_calloc(1, sizeof(*writer));
+    if (!writer) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    writer->filename = _hs_strdup(filename);
+    if (!writer->filename) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    writer->fp = fopen(filename, "wbe");
+    if (!writer->fp) {
+        switch (errno) {
+        case EACCES:
+            r = hs_error(HS_ERROR_ACCESS, "Permission denied for '%s'", filename);
+            break;
+        case ENOENT:
+            r = hs_error(HS_ERROR_NOT_FOUND, "Directory for '%s' does not exist", filename);
+            break;
+        default:
+            r = hs_error(HS_ERROR_SYSTEM, "fopen('%s') failed: %s", filename, strerror(errno));
+            break;
+        }
+        goto error;
+    }
+
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.header_size = sizeof(header);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header.start_time = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+    fwrite(&header, sizeof(header), 1, writer->fp);
+
+    writer->start = hs_nanos();
+
+    *rwriter = writer;
+    return 0;
+
+error:
+    _hs_uevent_writer_close(writer);
+    return r;
+}
+
+int _hs_uevent_writer_close(_hs_uevent_writer *writer)
+{
+    int r = 0;
+
+    if (writer) {
+        if (writer->fp) {
+            bool failed = ferror(writer->fp);
+
+            if (fclose(writer->fp) || failed)
+                r = hs_error(HS_ERROR_IO, "I/O error while writing to '%s'", writer->filename);
+        }
+        _hs_free(writer->filename);
+    }
+
+    _hs_free(writer);
+    return r;
+}
+
+// Errors are reported by _hs_uevent_writer_close(), the trace must not break the monitor
+void _hs_uevent_writer_append(_hs_uevent_writer *writer, const _hs_uevent *event)
+{
+    static const uint8_t padding[8];
+
+    struct trace_record record = {0};
+    size_t lengths[_HS_UEVENT_ATTRIBUTE_COUNT];
+    size_t size = 0;
+
+    if (ferror(writer->fp))
+        return;
+
+    for (unsigned int i = 0; i < _HS_UEVENT_ATTRIBUTE_COUNT; i++) {
+        if (event->attributes[i]) {
+            lengths[i] = strlen(event->attributes[i]) + 1;
+            size += lengths[i];
+            record.mask |= (uint16_t)(1u << i);
+        }
+    }
+
+    record.time = hs_nanos() - writer->start;
+    record.size = (uint32_t)size;
+    record.action = (uint8_t)event->action;
+
+    fwrite(&record, sizeof(record), 1, writer->fp);
+    for (unsigned int i = 0; i < _HS_UEVENT_ATTRIBUTE_COUNT; i++) {
+        if (event->attributes[i])
+            fwrite(event->attributes[i], 1, lengths[i], writer->fp);
+    }
+    fwrite(padding, 1, ALIGN_RECORD(size) - size, writer->fp);
+}
+
+static bool validate_record(const struct trace_record *record)
+{
+    const char *ptr = (const char *)(record + 1), *end = ptr + record->size;
+
+    if (record->action > _HS_UEVENT_OTHER || record->mask >> _HS_UEVENT_ATTRIBUTE_COUNT)
+        return false;
+
+    for (unsigned int i = 0; i < _HS_UEVENT_ATTRIBUTE_COUNT; i++) {
+        const char *nul;
+
+        if (!(record->mask & (1u << i)))
+            continue;
+
+        nul = memchr(ptr, 0, (size_t)(end - ptr));
+        if (!nul)
+            return false;
+        ptr = nul + 1;
+    }
+
+    return true;
+}
+
+int _hs_uevent_trace_load(const char *filename, _hs_uevent_trace **rtrace)
+{
+    _hs_uevent_trace *trace;
+    const struct trace_header *header;
+    struct stat sb;
+    int fd = -1, r;
+
+    trace = _hs_calloc(1, sizeof(*trace));
+    if (!trace) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+restart:
+    fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        switch (errno) {
+        case EINTR:
+            goto restart;
+        case EACCES:
+            r = hs_error(HS_ERROR_ACCESS, "Permission denied for '%s'", filename);
+            break;
+        case ENOENT:
+            r = hs_error(HS_ERROR_NOT_FOUND, "Trace file '%s' does not exist", filename);
+            break;
+        default:
+            r = hs_error(HS_ERROR_SYSTEM, "open('%s') failed: %s", filename, strerror(errno));
+            break;
+        }
+        goto error;
+    }
+
+    r = fstat(fd, &sb);
+    if (r < 0) {
+        r = hs_error(HS_ERROR_SYSTEM, "fstat('%s') failed: %s", filename, strerror(errno));
+        goto error;
+    }
+    if ((size_t)sb.st_size < sizeof(*header)) {
+        r = hs_error(HS_ERROR_INVALID, "File '%s' is not a uevent trace", filename);
+        goto error;
+    }
+
+    trace->map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED) {
+        trace->map = NULL;
+        r = hs_error(HS_ERROR_SYSTEM, "mmap('%s') failed: %s", filename, strerror(errno));
+        goto error;
+    }
+    trace->map_size = (size_t)sb.st_size;
+
+    header = (const struct trace_header *)trace->map;
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->header_size < sizeof(*header) || header->header_size % 8 ||
+            header->header_size > trace->map_size) {
+        r = hs_error(HS_ERROR_INVALID, "File '%s' is not a uevent trace", filename);
+        goto error;
+    }
+    if (header->version != TRACE_VERSION) {
+        r = hs_error(HS_ERROR_INVALID, "Unsupported version %u for uevent trace '%s'",
+                     header->version, filename);
+        goto error;
+    }
+
+    // Validate everything now, and ignore a truncated last record
+    trace->offset = header->header_size;
+    trace->end = trace->offset;
+    while (trace->end + sizeof(struct trace_record) <= trace->map_size) {
+        const struct trace_record *record = (const struct trace_record *)(trace->map + trace->end);
+
+        if (trace->end + sizeof(*record) + record->size > trace->map_size)
+            break;
+        if (!validate_record(record)) {
+            r = hs_error(HS_ERROR_INVALID, "Malformed record in uevent trace '%s'", filename);
+            goto error;
+        }
+
+        trace->end += sizeof(*record) + ALIGN_RECORD((size_t)record->size);
+    }
+    if (trace->end > trace->map_size)
+        trace->end = trace->map_size;
+
+    close(fd);
+
+    *rtrace = trace;
+    return 0;
+
+error:
+    if (fd >= 0)
+        close(fd);
+    _hs_uevent_trace_free(trace);
+    return r;
+}
+
+void _hs_uevent_trace_free(_hs_uevent_trace *trace)
+{
+    if (trace) {
+        if (trace->map)
+            munmap(trace->map, trace->map_size);
+    }
+
+    _hs_free(trace);
+}
+
+uint64_t _hs_uevent_trace_peek(const _hs_uevent_trace *trace, _hs_uevent_action *raction)
+{
+    const struct trace_record *record;
+
+    if (trace->offset + sizeof(*record) > trace->end)
+        return UINT64_MAX;
+    record = (const struct trace_record *)(trace->map + trace->offset);
+
+    if (raction)
+        *raction = (_hs_uevent_action)record->action;
+    return record->time;
+}
+
+bool _hs_uevent_trace_next(_hs_uevent_trace *trace, _hs_uevent *revent)
+{
+    const struct trace_record *record;
+    const char *ptr;
+
+    if (trace->offset + sizeof(*record) > trace->end)
+        return false;
+    record = (const struct trace_record *)(trace->map + trace->offset);
+    trace->offset += sizeof(*record) + ALIGN_RECORD((size_t)record->size);
+
+    revent->action = (_hs_uevent_action)record->action;
+    ptr = (const char *)(record + 1);
+    for (unsigned int i = 0; i < _HS_UEVENT_ATTRIBUTE_COUNT; i++) {
+        if (record->mask & (1u << i)) {
+            revent->attributes[i] = ptr;
+            ptr += strlen(ptr) + 1;
+        } else {
+            revent->attributes[i] = NULL;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,87 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _HS_UEVENT_TRACE_PRIV_H
+#define _HS_UEVENT_TRACE_PRIV_H
+
+#include "util.h"
+
+/* Uevent traces store what the Linux monitor reads from udev for each event, so that the
+   monitor can run on a trace instead of netlink and sysfs. The layout follows capture files
+   (see hs/capture.h): a 16-byte header with the "HSUT" magic, then 8-byte aligned records
+   made of a 16-byte record header (time in nanoseconds since the start of the trace, payload
+   size, action, presence mask of the attributes) and the present attributes as consecutive
+   NUL-terminated strings, in _hs_uevent_attribute order. */
+
+typedef enum _hs_uevent_action {
+    // Device present when the trace was started
+    _HS_UEVENT_SNAPSHOT,
+    _HS_UEVENT_ADD,
+    _HS_UEVENT_REMOVE,
+    _HS_UEVENT_OTHER
+} _hs_uevent_action;
+
+typedef enum _hs_uevent_attribute {
+    _HS_UEVENT_SUBSYSTEM,
+    _HS_UEVENT_DEVPATH,
+    // Only set if the node existed when the event was received
+    _HS_UEVENT_DEVNODE,
+
+    // Attributes of the usb_device parent
+    _HS_UEVENT_USB_BUSNUM,
+    _HS_UEVENT_USB_DEVPATH,
+    _HS_UEVENT_USB_VID,
+    _HS_UEVENT_USB_PID,
+    _HS_UEVENT_USB_MANUFACTURER,
+    _HS_UEVENT_USB_PRODUCT,
+    _HS_UEVENT_USB_SERIAL,
+
+    // Devpath of the usb_interface parent
+    _HS_UEVENT_IFACE_DEVPATH,
+
+    _HS_UEVENT_ATTRIBUTE_COUNT
+} _hs_uevent_attribute;
+
+typedef struct _hs_uevent {
+    _hs_uevent_action action;
+    const char *attributes[_HS_UEVENT_ATTRIBUTE_COUNT];
+} _hs_uevent;
+
+typedef struct _hs_uevent_writer _hs_uevent_writer;
+typedef struct _hs_uevent_trace _hs_uevent_trace;
+
+int _hs_uevent_writer_open(const char *filename, _hs_uevent_writer **rwriter);
+int _hs_uevent_writer_close(_hs_uevent_writer *writer);
+void _hs_uevent_writer_append(_hs_uevent_writer *writer, const _hs_uevent *event);
+
+int _hs_uevent_trace_load(const char *filename, _hs_uevent_trace **rtrace);
+void _hs_uevent_trace_free(_hs_uevent_trace *trace);
+
+/* Time of the next event in nanoseconds since the start of the trace, UINT64_MAX at the end.
+   If raction is not NULL, it receives the action of the next event. */
+uint64_t _hs_uevent_trace_peek(const _hs_uevent_trace *trace, _hs_uevent_action *raction);
+// Strings point into the trace, which must outlive the event
+bool _hs_uevent_trace_next(_hs_uevent_trace *trace, _hs_uevent *revent);
+
+#endif
@@ -43,6 +43,12 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__GNUC__)
+    #define _HS_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+    #define _HS_THREAD_LOCAL __declspec(thread)
+#endif
+
 #if defined(__GNUC__)
     #define _HS_INIT() \
         __attribute__((constructor)) \
@@ -77,4 +83,13 @@
 #define _hs_container_of(head, type, member) \
     ((type *)((char *)(head) - (size_t)(&((type *)0)->member)))
 
+// Allocation functions, they go through the allocator set with hs_set_allocator()
+void *_hs_malloc(size_t size);
+void *_hs_calloc(size_t count, size_t size);
+void *_hs_realloc(void *ptr, size_t size);
+void _hs_free(void *ptr);
+
+char *_hs_strdup(const char *s);
+int _hs_asprintf(char **strp, const char *fmt, ...) HS_PRINTF_FORMAT(2, 3);
+
 #endif
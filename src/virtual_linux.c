@@ -0,0 +1,265 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "util.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include "device_priv.h"
+#include "monitor_priv.h"
+#include "virtual_priv.h"
+
+extern const struct _hs_device_vtable _hs_posix_device_vtable;
+
+static unsigned int next_id;
+
+static int create_serial_endpoint(hs_virtual_device *vdev)
+{
+    struct termios tio;
+    const char *name;
+    int r;
+
+    vdev->peer_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (vdev->peer_fd < 0)
+        return hs_error(HS_ERROR_SYSTEM, "posix_openpt() failed: %s", strerror(errno));
+
+    r = grantpt(vdev->peer_fd);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "grantpt() failed: %s", strerror(errno));
+    r = unlockpt(vdev->peer_fd);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "unlockpt() failed: %s", strerror(errno));
+
+    // The peer gets the raw bytes, whatever the handle side does with its own termios
+    r = tcgetattr(vdev->peer_fd, &tio);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "tcgetattr() failed: %s", strerror(errno));
+    cfmakeraw(&tio);
+    r = tcsetattr(vdev->peer_fd, TCSANOW, &tio);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "tcsetattr() failed: %s", strerror(errno));
+
+    name = ptsname(vdev->peer_fd);
+    if (!name)
+        return hs_error(HS_ERROR_SYSTEM, "ptsname() failed: %s", strerror(errno));
+    vdev->dev->path = _hs_strdup(name);
+    if (!vdev->dev->path)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+    vdev->dev->vtable = &_hs_posix_device_vtable;
+    return 0;
+}
+
+static int create_hid_endpoint(hs_virtual_device *vdev, const hs_virtual_device_info *info,
+                               unsigned int id)
+{
+    int fds[2], r;
+
+    r = socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds);
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "socketpair() failed: %s", strerror(errno));
+    vdev->host_fd = fds[0];
+    vdev->peer_fd = fds[1];
+
+    if (info->report_descriptor_size) {
+        vdev->report_descriptor = _hs_malloc(info->report_descriptor_size);
+        if (!vdev->report_descriptor)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+        memcpy(vdev->report_descriptor, info->report_descriptor, info->report_descriptor_size);
+        vdev->report_descriptor_size = info->report_descriptor_size;
+    }
+
+    r = _hs_asprintf(&vdev->dev->path, "virtual-hid-%u", id);
+    if (r < 0)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+    vdev->dev->vtable = &_hs_linux_virtual_hid_vtable;
+    return 0;
+}
+
+static int copy_string(char **rdest, const char *s)
+{
+    if (s) {
+        *rdest = _hs_strdup(s);
+        if (!*rdest)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+
+    return 0;
+}
+
+int hs_virtual_device_new(const hs_virtual_device_info *info, hs_virtual_device **rvdev)
+{
+    assert(info);
+    assert(info->type == HS_DEVICE_TYPE_HID || info->type == HS_DEVICE_TYPE_SERIAL);
+    assert(info->report_descriptor || !info->report_descriptor_size);
+    assert(rvdev);
+
+    hs_virtual_device *vdev;
+    hs_device *dev;
+    unsigned int id;
+    int r;
+
+    vdev = _hs_calloc(1, sizeof(*vdev));
+    if (!vdev)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    vdev->host_fd = -1;
+    vdev->peer_fd = -1;
+
+    dev = _hs_device_new();
+    if (!dev) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    dev->state = HS_DEVICE_STATUS_ONLINE;
+    dev->vdev = vdev;
+    vdev->dev = dev;
+
+    id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+
+    dev->type = info->type;
+    dev->vid = info->vid;
+    dev->pid = info->pid;
+    dev->iface = info->iface;
+
+    r = _hs_asprintf(&dev->key, "/virtual/%u", id);
+    if (r < 0) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    if (info->location) {
+        r = copy_string(&dev->location, info->location);
+    } else {
+        r = _hs_asprintf(&dev->location, "virtual-%u", id);
+        if (r < 0)
+            r = hs_error(HS_ERROR_MEMORY, NULL);
+    }
+    if (r < 0)
+        goto error;
+
+    r = copy_string(&dev->manufacturer, info->manufacturer);
+    if (r < 0)
+        goto error;
+    r = copy_string(&dev->product, info->product);
+    if (r < 0)
+        goto error;
+    r = copy_string(&dev->serial, info->serial);
+    if (r < 0)
+        goto error;
+
+    if (info->type == HS_DEVICE_TYPE_HID) {
+        r = create_hid_endpoint(vdev, info, id);
+    } else {
+        r = create_serial_endpoint(vdev);
+    }
+    if (r < 0)
+        goto error;
+
+    *rvdev = vdev;
+    return 0;
+
+error:
+    hs_virtual_device_free(vdev);
+    return r;
+}
+
+void hs_virtual_device_free(hs_virtual_device *vdev)
+{
+    if (vdev) {
+        if (vdev->dev) {
+            hs_virtual_device_unplug(vdev);
+
+            vdev->dev->vdev = NULL;
+            hs_device_unref(vdev->dev);
+        }
+
+        if (vdev->host_fd >= 0)
+            close(vdev->host_fd);
+        if (vdev->peer_fd >= 0)
+            close(vdev->peer_fd);
+        _hs_free(vdev->report_descriptor);
+    }
+
+    _hs_free(vdev);
+}
+
+hs_device *hs_virtual_device_get_device(const hs_virtual_device *vdev)
+{
+    assert(vdev);
+    return vdev->dev;
+}
+
+hs_descriptor hs_virtual_device_get_peer(const hs_virtual_device *vdev)
+{
+    assert(vdev);
+    return vdev->peer_fd;
+}
+
+void hs_virtual_device_set_feature_func(hs_virtual_device *vdev, hs_virtual_feature_func *f,
+                                        void *udata)
+{
+    assert(vdev);
+    assert(vdev->dev->type == HS_DEVICE_TYPE_HID);
+
+    vdev->feature_func = f;
+    vdev->feature_udata = udata;
+}
+
+int hs_virtual_device_plug(hs_virtual_device *vdev, hs_monitor *monitor)
+{
+    assert(vdev);
+    assert(monitor);
+    assert(!vdev->dev->monitor || vdev->dev->state != HS_DEVICE_STATUS_ONLINE);
+
+    return _hs_monitor_add(monitor, vdev->dev);
+}
+
+void hs_virtual_device_unplug(hs_virtual_device *vdev)
+{
+    assert(vdev);
+
+    hs_device *dev = vdev->dev;
+
+    if (!dev->monitor || dev->state != HS_DEVICE_STATUS_ONLINE)
+        return;
+
+    // Keep the device alive while the monitor drops its reference
+    hs_device_ref(dev);
+    _hs_monitor_remove(dev->monitor, dev->key);
+    hs_device_unref(dev);
+}
+
+ssize_t _hs_virtual_feature_report(hs_device *dev, bool set, uint8_t *buf, size_t size)
+{
+    hs_virtual_device *vdev = dev->vdev;
+
+    if (!vdev)
+        return hs_error(HS_ERROR_IO, "Device '%s' was removed", dev->path);
+    if (!vdev->feature_func)
+        return hs_error(HS_ERROR_IO, "Virtual device '%s' does not handle feature reports",
+                        dev->path);
+
+    return (*vdev->feature_func)(vdev, set, buf, size, vdev->feature_udata);
+}
@@ -0,0 +1,50 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2015 Niels Martignène <niels.martignene@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef _HS_VIRTUAL_PRIV_H
+#define _HS_VIRTUAL_PRIV_H
+
+#include "util.h"
+#include "device_priv.h"
+#include "hs/virtual.h"
+
+struct hs_virtual_device {
+    hs_device *dev;
+
+    // HID devices: socket end duplicated by each handle, -1 for serial devices
+    int host_fd;
+    int peer_fd;
+
+    uint8_t *report_descriptor;
+    size_t report_descriptor_size;
+
+    hs_virtual_feature_func *feature_func;
+    void *feature_udata;
+};
+
+extern const struct _hs_device_vtable _hs_linux_virtual_hid_vtable;
+
+ssize_t _hs_virtual_feature_report(hs_device *dev, bool set, uint8_t *buf, size_t size);
+
+#endif